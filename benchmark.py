@@ -0,0 +1,220 @@
+#!/usr/bin/python
+
+# Runs the prep stages on generated WGS and WES datasets, records the wall time,
+# CPU time, peak RSS and output bytes of each stage, and compares them with a
+# baseline file; the exit status is 1 if any stage has regressed beyond the
+# tolerance.  Runs with python 2.7 or python 3.
+
+from __future__ import print_function
+
+import argparse
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+BASE_DIR = os.path.dirname(os.path.abspath(__file__))
+
+# datasets generated by snvgen; a WES dataset is approximated by a low density of
+# deeply covered variants spread over the genome
+DATASETS = {
+	"wgs": ["-density=1000", "-coverage=40"],
+	"wes": ["-density=20",   "-coverage=100", "-tumorcoverage=120"],
+}
+
+FIELDS = ["wall", "cpu", "rss_kb", "output_bytes"]
+
+def parseArguments():
+	# Create argument parser
+	parser = argparse.ArgumentParser()
+
+	# optional argument (The "-" prefix of the argument name specifies optional status)
+	parser.add_argument("-Datasets", help="Comma-separated datasets to run (wgs, wes)", type=str, default="wgs,wes")
+	parser.add_argument("-Assembly", help="Assembly to use (hg19, hg38)", type=str, default="hg19")
+	parser.add_argument("-BinDir", help="Directory of the snvgen, snvcounts and consprep programs", type=str, default=os.path.join(BASE_DIR, "src"))
+	parser.add_argument("-WorkDir", help="Directory for the generated and output files, kept after the run", type=str, default="")
+	parser.add_argument("-Baseline", help="Baseline file", type=str, default=os.path.join(BASE_DIR, "benchmark_baseline.txt"))
+	parser.add_argument("-Tolerance", help="Allowed fractional increase of time and memory", type=float, default=0.25)
+	parser.add_argument("-MinSeconds", help="Time differences below this are never regressions", type=float, default=1.0)
+	parser.add_argument("-Update", help="Write the results as the new baseline", action="store_true")
+
+	# Parse arguments
+	args = parser.parse_args()
+	return args
+
+def runStage(args, outputs):
+	# runs one stage and returns its wall time, CPU time, peak RSS and output bytes
+	for path in outputs:
+		if os.path.exists(path):
+			os.remove(path)
+
+	devnull = open(os.devnull, "wb")
+
+	# wait4() gives the resource usage of this child alone
+	start = time.time()
+	p = subprocess.Popen(args, stdout=devnull)
+	pid, status, usage = os.wait4(p.pid, 0)
+	wall = time.time() - start
+
+	devnull.close()
+
+	if status != 0:
+		sys.exit("stage failed: " + " ".join(args))
+
+	outputBytes = 0
+	for path in outputs:
+		if os.path.isfile(path):
+			outputBytes += os.path.getsize(path)
+
+	return {"wall": wall, "cpu": usage.ru_utime + usage.ru_stime,
+		"rss_kb": usage.ru_maxrss, "output_bytes": outputBytes}
+
+def consprepOutputs(prefix):
+	chrs = [str(i) for i in range(1, 23)] + ["X", "Y"]
+	return [prefix + ".ai"] + [prefix + "_chr" + c + "_100" for c in chrs]
+
+def runDataset(name, LineArgs, workdir):
+	# generates a dataset and runs each stage on it; the results are returned in
+	# order as (stage, result) pairs
+	bindir   = LineArgs.BinDir
+	assembly = LineArgs.Assembly
+	prep     = os.path.join(BASE_DIR, "vcf2cna_prep")
+
+	sizes  = os.path.join(prep, "chr_sizes_" + assembly + ".txt")
+	window = os.path.join(prep, assembly + "_winbin_100bp.txt")
+
+	if assembly == "hg38":
+		goodbad = os.path.join(prep, "good.bad.new.hg38")
+		bundle  = os.path.join(BASE_DIR, "gb38.tar.bz2:vcf2cna_prep/good.bad.new.hg38")
+	else:
+		goodbad = os.path.join(prep, "good.bad.new")
+		bundle  = os.path.join(BASE_DIR, "gb19.tar.bz2:vcf2cna_prep/good.bad.new")
+
+	if not os.path.exists(goodbad):
+		goodbad = bundle
+
+	maf = os.path.join(workdir, name + ".maf")
+	vcf = os.path.join(workdir, name + ".vcf")
+
+	generate = [os.path.join(bindir, "snvgen"), "-seed=1"] + DATASETS[name] + [sizes]
+	subprocess.check_call(generate + [maf])
+	subprocess.check_call(generate[:1] + ["-format=vcf"] + generate[1:] + [vcf])
+
+	counts = os.path.join(workdir, name + "_snvcounts")
+	median = os.path.join(workdir, name + "_median")
+	prefix = os.path.join(workdir, name + "_out")
+
+	results = []
+
+	results.append(("snvcounts", runStage([os.path.join(bindir, "snvcounts"), maf, counts, median], [counts, counts + ".idx", median])))
+
+	medianValue = open(median).read().strip()
+	results.append(("consprep", runStage([os.path.join(bindir, "consprep"), "-median=" + medianValue, "-input=" + counts, goodbad, window, prefix], consprepOutputs(prefix))))
+
+	# the Perl VCF parser appends to snvcounts_outputfile in its working directory
+	vcfdir = os.path.join(workdir, name + "_vcf")
+	if not os.path.isdir(vcfdir):
+		os.makedirs(vcfdir)
+
+	vcfcounts = os.path.join(vcfdir, "snvcounts_outputfile")
+	results.append(("vcf_parser", runStage(["perl", os.path.join(BASE_DIR, "source", "vcf_parser_4.1.pl"), vcf, "TN", vcfdir], [vcfcounts, os.path.join(vcfdir, "median_outputfile")])))
+
+	sortedcounts = os.path.join(workdir, name + "_sorted")
+	sortprefix   = os.path.join(workdir, name + "_sortout")
+	results.append(("consprep_sort", runStage([os.path.join(bindir, "consprep"), "-sort", "-median=-1", "-counts=" + sortedcounts, "-input=" + vcfcounts, goodbad, window, sortprefix], [sortedcounts, sortedcounts + ".idx"] + consprepOutputs(sortprefix))))
+
+	return results
+
+def readBaseline(filename):
+	baseline = {}
+	if not os.path.exists(filename):
+		return baseline
+
+	for line in open(filename):
+		column = line.rstrip("\n").split("\t")
+		if len(column) != 2 + len(FIELDS) or column[0] == "Dataset":
+			continue
+
+		baseline[(column[0], column[1])] = dict(zip(FIELDS, [float(v) for v in column[2:]]))
+
+	return baseline
+
+def writeBaseline(filename, results):
+	outfile = open(filename, "w")
+	outfile.write("Dataset\tStage\t" + "\t".join(FIELDS) + "\n")
+
+	for dataset, stage, result in results:
+		outfile.write("%s\t%s\t%.3f\t%.3f\t%d\t%d\n" % (dataset, stage, result["wall"], result["cpu"], result["rss_kb"], result["output_bytes"]))
+
+	outfile.close()
+
+def regressions(result, base, LineArgs):
+	# returns the fields of a result that are worse than the baseline allows; output
+	# bytes must match exactly, since the datasets are generated deterministically
+	worse = []
+
+	for field in ["wall", "cpu"]:
+		if result[field] > base[field] * (1 + LineArgs.Tolerance) + LineArgs.MinSeconds:
+			worse.append(field)
+
+	if result["rss_kb"] > base["rss_kb"] * (1 + LineArgs.Tolerance):
+		worse.append("rss_kb")
+
+	if result["output_bytes"] != base["output_bytes"]:
+		worse.append("output_bytes")
+
+	return worse
+
+def main(LineArgs):
+	workdir = LineArgs.WorkDir
+	keep    = (workdir != "")
+
+	if keep:
+		if not os.path.isdir(workdir):
+			os.makedirs(workdir)
+	else:
+		workdir = tempfile.mkdtemp(prefix="vcf2cna_bench.")
+
+	results = []
+
+	try:
+		for name in LineArgs.Datasets.split(","):
+			if name not in DATASETS:
+				sys.exit("unknown dataset " + name)
+
+			for stage, result in runDataset(name, LineArgs, workdir):
+				results.append((name, stage, result))
+	finally:
+		if not keep:
+			shutil.rmtree(workdir, True)
+
+	baseline = readBaseline(LineArgs.Baseline)
+	failed = False
+
+	print("Dataset\tStage\t" + "\t".join(FIELDS) + "\tStatus")
+
+	for dataset, stage, result in results:
+		base = baseline.get((dataset, stage))
+
+		if LineArgs.Update:
+			status = "updated"
+		elif base is None:
+			status = "no baseline"
+		else:
+			worse = regressions(result, base, LineArgs)
+			status = "REGRESSED " + ",".join(worse) if worse else "ok"
+			failed = failed or bool(worse)
+
+		print("%s\t%s\t%.3f\t%.3f\t%d\t%d\t%s" % (dataset, stage, result["wall"], result["cpu"], result["rss_kb"], result["output_bytes"], status))
+
+	if LineArgs.Update:
+		writeBaseline(LineArgs.Baseline, results)
+
+	sys.exit(1 if failed else 0)
+
+if __name__ == '__main__':
+	# Parse args
+	LineArgs = parseArguments()
+	main(LineArgs)
@@ -57,6 +57,15 @@ else
 fi
 
 
+# read the badlist straight from its compressed bundle if it has not been extracted
+if [ ! -f "$GOOD_BAD" ]; then
+    if [[ "$ASSEMBLY" == "hg38" ]]; then
+        GOOD_BAD="$BASE_DIR/gb38.tar.bz2:vcf2cna_prep/good.bad.new.hg38"
+    else
+        GOOD_BAD="$BASE_DIR/gb19.tar.bz2:vcf2cna_prep/good.bad.new"
+    fi
+fi
+
 echo "$GOOD_BAD"
 echo "$WINDOW"
 echo "$CHR_SIZES"
@@ -68,7 +77,7 @@ BEDGRAPH="$BASE_DIR/vcf2cna_prep/bedGraphToBigWig"
 
 # determine input filetype
 echo "Determine input filetype"
-head -n 1 $FILE_DIR/$FILENAME > $HEADER
+gzip -cdf $FILE_DIR/$FILENAME | head -n 1 > $HEADER
 FILETYPE=$(perl ${BASE_DIR}/source/file_type.pl $HEADER)
 echo "$FILETYPE"
 
@@ -77,8 +86,8 @@ then
     error_exit "Unrecognized filetype. Aborting!"
 fi
 
-# parse files based on filetype and generate snvcounts_outputfile with median_outputfile
-echo "Parse files based on filetype and generate snvcounts_outputfile with median_outputfile"
+# parse files based on filetype and generate snvcounts_outputfile
+echo "Parse files based on filetype and generate snvcounts_outputfile"
 if [ "$FILETYPE" == "VCF" ]
 then
     if [ $# -lt 3 ]
@@ -86,37 +95,45 @@ then
 	error_exit "For VCF_FILES you must specify pair order: TN or NT! aborting."
     fi
     VCF_SNPCOUNT=$(perl ${BASE_DIR}/source/vcf_parser_4.1.pl $FILE_DIR/$FILENAME $VCF_ORDER $WORK_DIR)
-    grep 'Pos' $WORK_DIR/snvcounts_outputfile > $WORK_DIR/sort_file
-    grep -v -E 'X|Y|Pos' $WORK_DIR/snvcounts_outputfile | sort -n -k1.4 -k2 >> $WORK_DIR/sort_file
-    grep -E 'X|Y' $WORK_DIR/snvcounts_outputfile | sort -t$'\t' -k1.4,1d -k2,2n >> $WORK_DIR/sort_file
-    mv $WORK_DIR/sort_file $WORK_DIR/snvcounts_outputfile
 fi
 
 if [ "$FILETYPE" == "SJ_MAF" ]
 then
-    cp $FILE_DIR/$FILENAME $WORK_DIR/snvcounts_outputfile
+    gzip -cdf $FILE_DIR/$FILENAME > $WORK_DIR/snvcounts_outputfile
     HEADER_LINE="Chr\tPos\tTumorMutant\tTumorTotal\tNormalMutant\tNormalTotal"
     sed -i "1s/.*/$HEADER_LINE/" $WORK_DIR/snvcounts_outputfile
-    SJ_MAF_MEDIAN=$(perl ${BASE_DIR}/source/sj_maf_parser.pl $WORK_DIR/snvcounts_outputfile > $WORK_DIR/median_outputfile)
 fi
 
-if [[ "$FILETYPE" == "HIGH20" || "$FILETYPE" == "MAF" ]];
+CONSPREP_INPUT=""
+CONSPREP_STDIN="$WORK_DIR/snvcounts_outputfile"
+SORTED_COUNTS=""
+
+if [ "$FILETYPE" == "VCF" ]
 then
-    echo "Starting snvcounts"
-    $SNVCOUNTS $FILE_DIR/$FILENAME $WORK_DIR/snvcounts_outputfile $WORK_DIR/median_outputfile
+    # the parsed VCF is not in order; consprep sorts it and writes the sorted
+    # snvcounts_outputfile needed by the later stages
+    SORTED_COUNTS="$WORK_DIR/snvcounts_sorted"
+    CONSPREP_INPUT="-sort -counts=$SORTED_COUNTS"
 fi
 
-# consprep
-echo "Starting consprep"
-
-if [ "$MEDIAN" == "-1" ]
+if [[ "$FILETYPE" == "HIGH20" || "$FILETYPE" == "MAF" ]];
 then
-    MEDIAN=`cat $WORK_DIR/median_outputfile`
+    # consprep reads the file itself (no separate snvcounts run) and writes the
+    # snvcounts_outputfile needed by the later stages
+    CONSPREP_INPUT="-input=$FILE_DIR/$FILENAME -counts=$WORK_DIR/snvcounts_outputfile"
+    CONSPREP_STDIN="/dev/null"
 fi
 
+# consprep; with -median=-1 it computes the median normal coverage from its input
+echo "Starting consprep"
+
 # Run CONSPREP Program and catch errors
-if $CONSPREP -median=$MEDIAN -minfactor=$MINSF -maxfactor=$MAXSF -xminfactor=$XMINSF -xmaxfactor=$XMAXSF $GOOD_BAD $WINDOW $WORK_DIR/$FILENAME < $WORK_DIR/snvcounts_outputfile; then
+if $CONSPREP $CONSPREP_INPUT -median=$MEDIAN -minfactor=$MINSF -maxfactor=$MAXSF -xminfactor=$XMINSF -xmaxfactor=$XMAXSF $GOOD_BAD $WINDOW $WORK_DIR/$FILENAME < $CONSPREP_STDIN; then
     echo "Successfully ran consprep"
+    if [ -n "$SORTED_COUNTS" ]; then
+        mv $SORTED_COUNTS $WORK_DIR/snvcounts_outputfile
+        mv $SORTED_COUNTS.idx $WORK_DIR/snvcounts_outputfile.idx
+    fi
 else
     error_exit "consprep crashed! aborting."
 fi
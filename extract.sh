@@ -1,5 +1,9 @@
 #!/bin/bash
 
+# Extraction is optional: consprep and VCF2CNA.R read the badlist, GC and
+# mapability files straight from these bundles when they have not been extracted.
+# Extracting them trades disk space for faster repeated runs.
+
 BASE_DIR=$PWD
 tar -jxvf gb19.tar.bz2
 tar -jxvf gb38.tar.bz2
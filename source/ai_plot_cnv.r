@@ -218,10 +218,40 @@ read.loh<-function(loh.ifn) {
 }
 
 
+# reads an snvcounts file, either text or the binary columnar form written by
+# snvcounts -binary (the layout is described in src/snvutil.h)
+read.snvcounts<-function(ifn) {
+  sz<-file.info(ifn)$size
+  con<-file(ifn,"rb")
+  bytes<-readBin(con,"raw",min(sz,4))
+  close(con)
+  if(sz<24 || !identical(bytes,charToRaw("SNVC"))) return(read.table(ifn,header=T))
+  con<-file(ifn,"rb")
+  bytes<-readBin(con,"raw",sz)
+  close(con)
+  u32<-function(at,n=1) readBin(bytes[at:(at+4*n-1)],"integer",n,size=4,endian="big") %% 2^32
+  u16<-function(at,n) readBin(bytes[at:(at+2*n-1)],"integer",n,size=2,signed=FALSE,endian="big")
+  chr.names<-c(paste("chr",1:22,sep=""),"chrX","chrY")
+  dir.at<-u32(sz-11)*2^32+u32(sz-7)+1
+  parts<-list()
+  for(i in seq_len(u32(dir.at))) {
+    e<-dir.at+4+21*(i-1)
+    n<-u32(e+1)
+    at<-u32(e+5)*2^32+u32(e+9)+1
+    parts[[i]]<-data.frame(Chr=chr.names[as.integer(bytes[e])],
+                           Pos=cumsum(u32(at,n)),
+                           TumorMutant=u16(at+4*n,n),
+                           TumorTotal=u16(at+6*n,n),
+                           NormalMutant=u16(at+8*n,n),
+                           NormalTotal=u16(at+10*n,n))
+  }
+  return(do.call(rbind,parts))
+}
+
 do.one.file<-function(chr.inf.ifn, dt.ifn, cnv.ifn,loh.ifn, jpg.ofn,maxcvg) {
   cnv<-read.cnv(cnv.ifn)
   loh<-read.loh(loh.ifn)
-  dt0<-read.table(dt.ifn,header=T)
+  dt0<-read.snvcounts(dt.ifn)
   if(!("dMAF" %in% colnames(dt0))) {
     dMAF<-dt0[,"TumorMutant"]/dt0[,"TumorTotal"]
     dt0<-cbind(dt0,dMAF)
@@ -36,8 +36,16 @@ my $medianpath = $work_dir . "/median_outputfile";
 # Open filehandle for write access
 open(my $fh, '>>', $basepath);
 
-# Open filehandle for read access
-open my $filehandle, '<', $vcf_file;
+# Open filehandle for read access; gzip and BGZF files are decompressed on the fly
+my $filehandle;
+if( $vcf_file =~ /\.(gz|bgz)$/)
+{
+  open $filehandle, '-|', 'gzip', '-cd', $vcf_file;
+}
+else
+{
+  open $filehandle, '<', $vcf_file;
+}
 
 # Analysis will be set on chromsomes 1-22, X, and Y
 
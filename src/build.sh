@@ -1,5 +1,16 @@
 bash genutil_build.sh
-g++ -std=c++0x -c consprep.cpp 
-g++ -std=c++0x -c snvcounts.cpp 
-g++ -std=c++0x -o consprep consprep.o genutil.o 
-g++ -std=c++0x -o snvcounts snvcounts.o genutil.o
+g++ -std=c++0x -O3 -c snvutil.cpp
+g++ -std=c++0x -O3 -c consprep.cpp
+g++ -std=c++0x -O3 -c snvcounts.cpp
+g++ -std=c++0x -O3 -c tarcat.cpp
+g++ -std=c++0x -O3 -c snvquery.cpp
+g++ -std=c++0x -O3 -c genbench.cpp
+g++ -std=c++0x -O3 -c snvgen.cpp
+g++ -std=c++0x -O3 -c gentest.cpp
+g++ -std=c++0x -pthread -o consprep consprep.o snvutil.o genutil.o -lz -lbz2
+g++ -std=c++0x -pthread -o snvcounts snvcounts.o snvutil.o genutil.o -lz -lbz2
+g++ -std=c++0x -pthread -o tarcat tarcat.o genutil.o -lz -lbz2
+g++ -std=c++0x -pthread -o snvquery snvquery.o snvutil.o genutil.o -lz -lbz2
+g++ -std=c++0x -pthread -o genbench genbench.o genutil.o -lz -lbz2
+g++ -std=c++0x -pthread -o snvgen snvgen.o genutil.o -lz -lbz2
+g++ -std=c++0x -pthread -o gentest gentest.o genutil.o -lz -lbz2
@@ -8,7 +8,16 @@
 //
 //------------------------------------------------------------------------------------
 
-#include "genutil.h"
+#include "snvutil.h"
+#include <cerrno>
+#include <climits>
+#include <condition_variable>
+#include <csignal>
+#include <mutex>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <system_error>
+#include <thread>
 
 // command-line option variables and default values
 
@@ -24,6 +33,20 @@ double maxfactor  = DEFAULT_MAXFACTOR;
 double xminfactor = DEFAULT_XMINFACTOR;
 double xmaxfactor = DEFAULT_XMAXFACTOR;
 
+const double COMPUTE_MEDIAN = -1; // -median=-1 computes the median from the input
+
+std::string input_filename;  // MAF, Bambino, text or binary snvcounts file read
+                             // instead of stdin
+std::string counts_filename; // snvcounts file written when reading input_filename
+std::string region_string;   // region of an indexed input_filename to be processed
+bool        use_container;   // true to write one container file of all outputs
+bool        use_rds;         // true to also write the outputs as R data files
+
+const int DEFAULT_SORTMEM = 1024; // megabytes
+
+bool sort_input;                 // true to sort the input positions
+int  sortmem = DEFAULT_SORTMEM;  // memory limit of the sort, in megabytes
+
 // one set for each chromosome holds the bad positions in that chromosome; these sets
 // are initialized from data read from the goodbad_file
 std::set<int> badlist[NUM_CHROMOSOMES + 1];
@@ -33,19 +56,43 @@ std::set<int> badlist[NUM_CHROMOSOMES + 1];
 // read from the wincount_file
 int numWindows[NUM_CHROMOSOMES + 1];
 
-// filename suffixes and file handles for the output files
+// with -batch, the jobs of a manifest file are run by a pool of worker threads, which
+// share the badlist and numWindows data read once
+std::string batch_filename;
+int         numThreads; // 0 means one thread per processor
+
+// with -serve, consprep runs as a daemon that keeps the badlist and numWindows data
+// and runs the jobs sent to a Unix domain socket; -submit sends a job to it
+std::string serve_socket;
+std::string submit_socket;
+
+// with -metrics, the time of each phase and counts of what was read, excluded and
+// written are reported in a JSON file
+std::string metrics_filename;
+Metrics    *metrics;
+
+// filename suffixes of the output files
+
+// with -container, each output file becomes a section of one container file, named
+// by its filename suffix without the leading '.' or '_'
+const char *CONTAINER_FILENAME_SUFFIX = ".consprep";
 
-const char *AI_FILENAME_SUFFIX = ".ai";
-std::ofstream *aifile; // allelic imbalance output file
+const char *AI_FILENAME_SUFFIX  = ".ai";     // allelic imbalance output file
+const char *CHR_FILENAME_SUFFIX = "_%s_100"; // one output file for each chromosome
 
-const char *CHR_FILENAME_SUFFIX = "_%s_100";
-std::ofstream *chrfile[NUM_CHROMOSOMES + 1]; // one output file for each chromosome
+// with -rds, each output file is also written as an R data frame that readRDS() loads
+// without parsing text
+const char *RDS_FILENAME_SUFFIX = ".rds";
 
 //------------------------------------------------------------------------------------
 
 class PosData // data associated with a particular position within a chromosome
 {
 public:
+   PosData()
+      : chrnum(0), position(0), tumorMutant(0), tumorTotal(0), normalMutant(0),
+	normalTotal(0), window(0) { }
+
    PosData(int inChrnum, int inPosition, int inTumorMutant, int inTumorTotal,
 	   int inNormalMutant, int inNormalTotal)
       : chrnum(inChrnum), position(inPosition),
@@ -56,6 +103,182 @@ public:
    int chrnum, position, tumorMutant, tumorTotal, normalMutant, normalTotal, window;
 };
 
+//------------------------------------------------------------------------------------
+
+class PositionSource // supplies position data in order by chromosome and position
+{
+public:
+   PositionSource(const std::string& inName) : name(inName) { }
+   virtual ~PositionSource() { }
+
+   // nextPosition() passes back the data of the next position; false is returned if
+   // EOF has been reached
+   virtual bool nextPosition(PosData& pd) = 0;
+
+   std::string name; // describes the source in error messages
+};
+
+//------------------------------------------------------------------------------------
+
+class TextPositionSource : public PositionSource // reads lines of an snvcounts file
+{
+public:
+   TextPositionSource(const std::string& filename);
+   virtual ~TextPositionSource() { }
+
+   virtual bool nextPosition(PosData& pd);
+
+   LineReader infile;
+};
+
+//------------------------------------------------------------------------------------
+
+class CountsPositionSource : public PositionSource // iterates over counts held in
+                                                   // memory
+{
+public:
+   CountsPositionSource(const SnvCounts& inCounts, const std::string& inName)
+      : PositionSource(inName), counts(inCounts), chrnum(1),
+        ppos(inCounts.posmap[1].begin()) { }
+
+   virtual ~CountsPositionSource() { }
+
+   virtual bool nextPosition(PosData& pd);
+
+   const SnvCounts&       counts;
+   int                    chrnum;
+   PosMap::const_iterator ppos;
+};
+
+//------------------------------------------------------------------------------------
+
+class BinaryPositionSource : public PositionSource // reads the blocks of a binary
+                                                   // snvcounts file
+{
+public:
+   BinaryPositionSource(const std::string& filename);
+   virtual ~BinaryPositionSource() { }
+
+   virtual bool nextPosition(PosData& pd);
+
+   SnvCountsBinaryFile infile;
+   SnvBlock            block;      // the decoded current block
+   size_t              blockIndex; // index of the next block to decode
+   size_t              index;      // index of the next position in the block
+};
+
+//------------------------------------------------------------------------------------
+
+class RegionPositionSource : public PositionSource // reads the positions in one
+                                                   // region of an indexed snvcounts
+                                                   // file
+{
+public:
+   RegionPositionSource(const std::string& filename, const SnvRegion& region)
+      : PositionSource(filename), reader(filename, region) { }
+
+   virtual ~RegionPositionSource() { }
+
+   virtual bool nextPosition(PosData& pd);
+
+   SnvRegionReader reader;
+};
+
+//------------------------------------------------------------------------------------
+
+class SortedPositionSource : public PositionSource // supplies the positions of another
+                                                   // source in sorted order, and
+                                                   // optionally writes them to an
+                                                   // snvcounts file
+{
+public:
+   SortedPositionSource(PositionSource *inSource, size_t memoryLimit,
+		        const std::string& countsFilename);
+   virtual ~SortedPositionSource() { delete counts; }
+
+   virtual bool nextPosition(PosData& pd);
+
+   PositionSorter sorter;
+   CountsWriter  *counts; // NULL if no snvcounts file is written
+};
+
+//------------------------------------------------------------------------------------
+
+class RdsOutput // collects the output data and writes it as R data frames
+{
+public:
+   RdsOutput(const std::string& inFilenamePrefix) : filenamePrefix(inFilenamePrefix) { }
+   virtual ~RdsOutput() { }
+
+   void addWindow(int tumorCoverage, int normalCoverage)
+   {
+      dcvg.push_back(tumorCoverage);
+      gcvg.push_back(normalCoverage);
+   }
+
+   virtual void addImbalance(int chrnum, int position, double aiDiff, double baft,
+		             double bafn);
+   virtual void writeWindows(int chrnum);
+   virtual void writeImbalance();
+
+   std::string filenamePrefix;
+
+   std::vector<int>    dcvg, gcvg; // window averages of the current chromosome
+   StringVector        aiChr;      // allelic imbalance rows
+   std::vector<int>    aiPos;
+   std::vector<double> aiDiff, aiBaft, aiBafn;
+};
+
+//------------------------------------------------------------------------------------
+
+class SampleJob // prepares the data files of one sample from its snvcounts
+{
+public:
+   SampleJob(const std::string& inInputFilename, double inMedian,
+	     const std::string& inFilenamePrefix);
+   virtual ~SampleJob();
+
+   // run() reads the input, writing the snvcounts file too if countsFilename is
+   // not empty, and writes the output files; only the given region is processed if
+   // regionString is not empty
+   void run(const std::string& countsFilename, const std::string& regionString);
+
+   std::string inputFilename;  // MAF, Bambino, text or binary snvcounts file, or ""
+                               // for stdin
+   double      median;         // median normal coverage, or COMPUTE_MEDIAN
+   std::string filenamePrefix; // output path prefix
+
+protected:
+   PositionSource *openSource(const std::string& countsFilename,
+		              const std::string& regionString);
+
+   TextWriter *createOutputFile(const char *suffix);
+   void createOutputFiles();
+   void closeOutputFiles();
+
+   bool processWindow(PositionSource& source, PosData& pd);
+   void processAllChromosomes(PositionSource& source);
+
+   SnvCounts  counts; // the positions of a MAF or Bambino file
+   SnvRegion *region; // NULL if all chromosomes are processed
+
+   // output buffers are written by a background thread so that processing does not
+   // wait for the file system
+   BackgroundWriter *background;
+
+   ContainerWriter *container;                     // NULL without -container
+   TextWriter      *aifile;                        // allelic imbalance output file
+   TextWriter      *chrfile[NUM_CHROMOSOMES + 1];  // one file for each chromosome
+   RdsOutput       *rdsOutput;                     // NULL without -rds
+
+   // counters for -metrics
+   uint64_t numPositions;      // positions read
+   uint64_t numBad;            // positions excluded as bad SNVs
+   uint64_t numOutOfRange;     // positions excluded for their normal coverage
+   uint64_t numImbalance;      // allelic imbalance lines written
+   uint64_t numWindowsWritten; // window lines written
+};
+
 //------------------------------------------------------------------------------------
 // processOptions() processes the command-line arguments; false is returned if any of
 // the arguments are invalid
@@ -78,7 +301,39 @@ bool processOptions(int argc, char *argv[],
          StringVector part;
 	 getDelimitedStrings(s, '=', part);
 
-	 if (!(part.size() == 2 &&
+	 if (s == "-container")
+            use_container = true;
+	 else if (s == "-rds")
+            use_rds = true;
+	 else if (s == "-sort")
+            sort_input = true;
+	 else if (part.size() == 2 && part[0] == "-sortmem")
+	 {
+            if ((sortmem = stringToInt(part[1])) <= 0)
+               return false;
+	 }
+	 else if (part.size() == 2 && part[0] == "-batch")
+            batch_filename = part[1];
+	 else if (part.size() == 2 && part[0] == "-metrics")
+            metrics_filename = part[1];
+	 else if (part.size() == 2 && part[0] == "-serve")
+            serve_socket = part[1];
+	 else if (part.size() == 2 && part[0] == "-submit")
+            submit_socket = part[1];
+	 else if (part.size() == 2 && part[0] == "-threads")
+	 {
+            if ((numThreads = stringToInt(part[1])) <= 0)
+               return false;
+	 }
+	 else if (part.size() == 2 && part[0] == "-input")
+            input_filename = part[1];
+	 else if (part.size() == 2 && part[0] == "-counts")
+            counts_filename = part[1];
+	 else if (part.size() == 2 && part[0] == "-region")
+            region_string = part[1];
+	 else if (part.size() == 2 && part[0] == "-median" && part[1] == "-1")
+            median = COMPUTE_MEDIAN;
+	 else if (!(part.size() == 2 &&
               (part[0] == "-median"     && (median     = stringToDbl(part[1])) >= 0 ||
                part[0] == "-minfactor"  && (minfactor  = stringToDbl(part[1])) >= 0 ||
                part[0] == "-maxfactor"  && (maxfactor  = stringToDbl(part[1])) >= 0 ||
@@ -96,6 +351,28 @@ bool processOptions(int argc, char *argv[],
 	 }
    }
 
+   if (batch_filename != "" || serve_socket != "") // jobs give the inputs and output
+                                                   // prefixes
+      return (n == 2 && (batch_filename == "" || serve_socket == "") &&
+	      submit_socket == "" && input_filename == "" && counts_filename == "" &&
+	      region_string == "" && minfactor <= maxfactor &&
+	      xminfactor <= xmaxfactor);
+
+   if (submit_socket != "") // the server has the reference data, so the only
+   {                        // argument is the output path prefix
+      output_filenamePrefix = goodbad_filename;
+      goodbad_filename = "";
+
+      return (n == 1 && input_filename != "" && counts_filename == "" &&
+	      region_string == "");
+   }
+
+   if (region_string != "" && input_filename == "")
+      return false;
+
+   if (counts_filename != "" && input_filename == "" && !sort_input)
+      return false;
+
    return (n == 3 && minfactor <= maxfactor && xminfactor <= xmaxfactor);
 }
 
@@ -115,7 +392,16 @@ void showUsage(const char *progname)
 {
    std::cout << "Usage: " << progname
 	     << " [OPTION ...] goodbad_file wincount_file"
-	     << " output_path_prefix < snvcounts_file"
+	     << " output_path_prefix [< snvcounts_file]"
+	     << std::endl
+	     << "       " << progname
+	     << " -batch=FILE [OPTION ...] goodbad_file wincount_file"
+	     << std::endl
+	     << "       " << progname
+	     << " -serve=SOCKET [OPTION ...] goodbad_file wincount_file"
+	     << std::endl
+	     << "       " << progname
+	     << " -submit=SOCKET -input=FILE [-median=N] output_path_prefix"
 	     << std::endl << std::endl;
 
    showOption("-median=N",     "median normal coverage",         DEFAULT_MEDIAN);
@@ -123,6 +409,72 @@ void showUsage(const char *progname)
    showOption("-maxfactor=N",  "maximum scale factor, non-chrX", DEFAULT_MAXFACTOR);
    showOption("-xminfactor=N", "minimum scale factor, chrX",     DEFAULT_XMINFACTOR);
    showOption("-xmaxfactor=N", "maximum scale factor, chrX",     DEFAULT_XMAXFACTOR);
+
+   std::cout << "  -input=FILE\tread a MAF, Bambino, text or binary snvcounts file"
+	     << " instead of snvcounts_file"
+	     << std::endl
+	     << "  -counts=FILE\twith -input or -sort, also write the snvcounts file"
+	     << std::endl
+	     << "  -median=-1\tcompute the median normal coverage from the input"
+	     << std::endl
+	     << "  -region=R\twith an indexed snvcounts -input, process only region R,"
+	     << " e.g. chr7 or chr7:1000000-2000000"
+	     << std::endl
+	     << "  -container\twrite all outputs as sections of one file,"
+	     << " output_path_prefix" << CONTAINER_FILENAME_SUFFIX
+	     << std::endl
+	     << "  -rds\t\talso write each output as an R data file (FILE"
+	     << RDS_FILENAME_SUFFIX << ")"
+	     << std::endl
+	     << "  -sort\t\tsort the input, which need not be in order by chromosome and"
+	     << " position"
+	     << std::endl
+	     << "  -sortmem=N\tmemory used by -sort before sorting on disk, default is "
+	     << DEFAULT_SORTMEM << " MB"
+	     << std::endl
+	     << "  -batch=FILE\trun the jobs of a manifest file, each line of which gives"
+	     << " an input file, a median"
+	     << std::endl
+	     << "\t\t(-1 to compute it) and an output_path_prefix, separated by tabs;"
+	     << " -input, -counts"
+	     << std::endl
+	     << "\t\tand -region are not used"
+	     << std::endl
+	     << "  -threads=N\twith -batch or -serve, number of jobs run at once, default"
+	     << " is one per processor"
+	     << std::endl
+	     << "  -serve=SOCKET\trun as a daemon, running the jobs sent to the Unix"
+	     << " domain socket; each"
+	     << std::endl
+	     << "\t\tjob is a line as in a manifest, answered by OK or ERROR and a"
+	     << " message"
+	     << std::endl
+	     << "  -submit=SOCKET\tsend a job to a -serve daemon, which uses its own"
+	     << " options, and wait for it"
+	     << std::endl
+	     << "  -metrics=FILE\twrite the time of each phase and counters as JSON;"
+	     << " with -serve, after"
+	     << std::endl
+	     << "\t\teach job"
+	     << std::endl;
+}
+
+//------------------------------------------------------------------------------------
+// addPhase() adds the time since a timer started to a phase of the -metrics report
+
+void addPhase(const std::string& name, const Metrics::Timer& timer)
+{
+   if (metrics)
+      metrics->addPhase(name, timer);
+}
+
+//------------------------------------------------------------------------------------
+// writeMetrics() writes the -metrics report, if one was requested
+
+void writeMetrics()
+{
+   if (metrics && !metrics->writeFile(metrics_filename, "consprep"))
+      throw std::runtime_error("unable to write " + metrics_filename);
 }
 
 //------------------------------------------------------------------------------------
@@ -131,13 +483,13 @@ void showUsage(const char *progname)
 
 void readGoodBadList(const std::string& filename)
 {
-   std::ifstream infile(filename.c_str());
-   if (!infile.is_open())
+   LineReader infile;
+   if (!infile.openFile(filename.c_str()))
       throw std::runtime_error("unable to open " + filename);
 
    std::string line;
 
-   while (std::getline(infile, line))
+   while (infile.getLine(line))
    {
       StringVector column;
       getDelimitedStrings(line, '\t', column);
@@ -168,10 +520,7 @@ void readGoodBadList(const std::string& filename)
       }
    }
 
-   if (infile.bad())
-      throw std::runtime_error("read error in " + filename);
-
-   infile.close();
+   infile.closeFile();
 }
 
 //------------------------------------------------------------------------------------
@@ -180,13 +529,13 @@ void readGoodBadList(const std::string& filename)
 
 void readNumWindows(const std::string& filename)
 {
-   std::ifstream infile(filename.c_str());
-   if (!infile.is_open())
+   LineReader infile;
+   if (!infile.openFile(filename.c_str()))
       throw std::runtime_error("unable to open " + filename);
 
    std::string line;
 
-   while (std::getline(infile, line))
+   while (infile.getLine(line))
    {
       StringVector column;
       getDelimitedStrings(line, '\t', column);
@@ -202,10 +551,7 @@ void readNumWindows(const std::string& filename)
       numWindows[chrnum] = stringToInt(column[1]);
    }
 
-   if (infile.bad())
-      throw std::runtime_error("read error in " + filename);
-
-   infile.close();
+   infile.closeFile();
 
    for (int chrnum = 1; chrnum <= NUM_CHROMOSOMES; chrnum++)
       if (numWindows[chrnum] <= 0)
@@ -214,204 +560,1157 @@ void readNumWindows(const std::string& filename)
 }
 
 //------------------------------------------------------------------------------------
-// createOutputFiles() creates the output files and writes a heading line to each
+// TextPositionSource::TextPositionSource() opens an snvcounts file, which may be
+// compressed; a filename of "-" means stdin
 
-void createOutputFiles(const std::string& filenamePrefix)
+TextPositionSource::TextPositionSource(const std::string& filename)
+   : PositionSource(filename == "-" ? "stdin" : filename)
 {
-   std::string filename = filenamePrefix + AI_FILENAME_SUFFIX;
+   if (!infile.openFile(filename.c_str()))
+      throw std::runtime_error("unable to open " + name);
+}
 
-   aifile = new std::ofstream(filename.c_str());
-   if (!aifile->is_open())
-      throw std::runtime_error("unable to open " + filename);
+//------------------------------------------------------------------------------------
+// TextPositionSource::nextPosition() reads the next line of the file and passes back
+// the data in the line; false is returned if EOF has been reached
+
+bool TextPositionSource::nextPosition(PosData& pd)
+{
+   std::string line;
+   int chrnum, position, tumorMutant, tumorTotal, normalMutant, normalTotal;
+
+   while (infile.getLine(line))
+      if (parseCountsLine(line, name, chrnum, position, tumorMutant, tumorTotal,
+			  normalMutant, normalTotal)) // skip heading line and
+                                                      // unrecognized chromosomes
+      {
+         pd = PosData(chrnum, position, tumorMutant, tumorTotal, normalMutant,
+		      normalTotal);
+	 return true;
+      }
 
-   *aifile << "Chr"
-	   << "\t" << "Pos"
-	   << "\t" << "AIDiff"
-	   << "\t" << "BAFT"
-	   << "\t" << "BAFN"
-	   << std::endl;
+   return false; // reached EOF
+}
 
-   for (int chrnum = 1; chrnum <= NUM_CHROMOSOMES; chrnum++)
+//------------------------------------------------------------------------------------
+// CountsPositionSource::nextPosition() passes back the data of the next position in
+// the counts maps; false is returned after the last position of the last chromosome
+
+bool CountsPositionSource::nextPosition(PosData& pd)
+{
+   while (ppos == counts.posmap[chrnum].end())
    {
-      char suffix[100];
-      std::sprintf(suffix, CHR_FILENAME_SUFFIX, chrLongName[chrnum].c_str());
+      if (chrnum == NUM_CHROMOSOMES)
+         return false;
+
+      ppos = counts.posmap[++chrnum].begin();
+   }
 
-      filename = filenamePrefix + suffix;
+   const PosCounts& pc = ppos->second;
 
-      chrfile[chrnum] = new std::ofstream(filename.c_str());
-      if (!chrfile[chrnum]->is_open())
-         throw std::runtime_error("unable to open " + filename);
+   pd = PosData(chrnum, ppos->first, pc.tumorMutant, pc.tumorTotal, pc.normalMutant,
+		pc.normalTotal);
+
+   ++ppos;
+   return true;
+}
+
+//------------------------------------------------------------------------------------
+// BinaryPositionSource::BinaryPositionSource() maps a binary snvcounts file
+
+BinaryPositionSource::BinaryPositionSource(const std::string& filename)
+   : PositionSource(filename), blockIndex(0), index(0)
+{
+   if (!infile.openFile(filename))
+      throw std::runtime_error("unable to open " + filename);
+}
 
-      *chrfile[chrnum] << "Dcvg"
-	               << "\t" << "Gcvg"
-		       << std::endl;
+//------------------------------------------------------------------------------------
+// BinaryPositionSource::nextPosition() passes back the data of the next position,
+// decoding the next block when the current one is used up; false is returned after
+// the last position of the last block
+
+bool BinaryPositionSource::nextPosition(PosData& pd)
+{
+   while (index >= block.position.size())
+   {
+      if (blockIndex >= infile.block.size())
+         return false;
+
+      infile.decodeBlock(blockIndex, block);
+
+      blockIndex++;
+      index = 0;
    }
+
+   int chrnum = infile.block[blockIndex - 1].chrnum;
+
+   pd = PosData(chrnum, block.position[index],
+		std::min(block.tumorMutant[index],  block.tumorTotal[index]),
+		block.tumorTotal[index],
+		std::min(block.normalMutant[index], block.normalTotal[index]),
+		block.normalTotal[index]);
+
+   index++;
+   return true;
 }
 
 //------------------------------------------------------------------------------------
-// closeOutputFiles() closes all of the output files
+// RegionPositionSource::nextPosition() passes back the data of the next position in
+// the region; false is returned after the last one
 
-void closeOutputFiles()
+bool RegionPositionSource::nextPosition(PosData& pd)
 {
-   aifile->close();
+   int chrnum, position, tumorMutant, tumorTotal, normalMutant, normalTotal;
 
-   for (int chrnum = 1; chrnum <= NUM_CHROMOSOMES; chrnum++)
-      chrfile[chrnum]->close();
+   if (!reader.nextPosition(chrnum, position, tumorMutant, tumorTotal, normalMutant,
+			    normalTotal))
+      return false;
+
+   pd = PosData(chrnum, position, tumorMutant, tumorTotal, normalMutant,
+		normalTotal);
+   return true;
 }
 
 //------------------------------------------------------------------------------------
-// readNextPosition() reads the next line from stdin and returns a pointer to a newly
-// allocated PosData object containing the data in the line, or returns NULL if EOF
-// has been reached
+// SortedPositionSource::SortedPositionSource() reads and sorts all of the positions of
+// a source, which is then deleted
 
-PosData *readNextPosition()
+SortedPositionSource::SortedPositionSource(PositionSource *inSource,
+		                           size_t memoryLimit,
+					   const std::string& countsFilename)
+   : PositionSource(inSource->name), sorter(memoryLimit), counts(NULL)
 {
-   std::string line;
+   PosData pd;
 
-   while (std::getline(std::cin, line))
-   {
-      StringVector column;
-      getDelimitedStrings(line, '\t', column);
+   while (inSource->nextPosition(pd))
+      sorter.add(SortRecord(pd.chrnum, pd.position, pd.tumorMutant, pd.tumorTotal,
+			    pd.normalMutant, pd.normalTotal));
 
-      if (column.size() != 6)
-         throw std::runtime_error("unexpected #columns in line read from stdin \"" +
-			          line + "\"");
+   delete inSource;
 
-      int chrnum = getChrNumber(column[0]);
-      if (chrnum == 0)
-         continue; // ignore heading line and unrecognized chromosomes
+   sorter.finish();
 
-      int position     = stringToInt(column[1]);
-      int tumorMutant  = stringToInt(column[2]);
-      int tumorTotal   = stringToInt(column[3]);
-      int normalMutant = stringToInt(column[4]);
-      int normalTotal  = stringToInt(column[5]);
+   if (countsFilename != "")
+   {
+      counts = new CountsWriter;
+      counts->openFile(countsFilename);
+   }
+}
 
-      if (position < 0 || tumorMutant < 0 || tumorTotal < 0 || normalMutant < 0 ||
-	  normalTotal < 0)
-         throw std::runtime_error("invalid data in line read from stdin \"" + line +
-			          "\"");
+//------------------------------------------------------------------------------------
+// SortedPositionSource::nextPosition() passes back the data of the next position in
+// sorted order, also writing it to the snvcounts file; false is returned after the
+// last position, when the snvcounts file is closed
 
-      if (tumorMutant > tumorTotal)
-         tumorMutant = tumorTotal;
+bool SortedPositionSource::nextPosition(PosData& pd)
+{
+   SortRecord r;
 
-      if (normalMutant > normalTotal)
-         normalMutant = normalTotal;
+   if (!sorter.next(r))
+   {
+      if (counts)
+      {
+         counts->closeFile();
+	 delete counts;
+	 counts = NULL;
+      }
 
-      return new PosData(chrnum, position, tumorMutant, tumorTotal, normalMutant,
-		         normalTotal);
+      return false;
    }
 
-   return NULL; // reached EOF
+   pd = PosData(r.chrnum(), r.position(), r.tumorMutant, r.tumorTotal,
+		r.normalMutant, r.normalTotal);
+
+   if (counts)
+      counts->writePosition(pd.chrnum, pd.position, pd.tumorMutant, pd.tumorTotal,
+			    pd.normalMutant, pd.normalTotal);
+
+   return true;
 }
 
 //------------------------------------------------------------------------------------
-// processWindow() processes positions that fall in a particular window and writes to
-// the chromosome file the average tumor coverage and average normal coverage of these
-// positions; note that positions not in chrX that have a bad SNV are excluded from
-// the computation of average coverage; positions with normal coverage below the
-// minimum or above the maximum are also excluded; this function returns the first
-// position not in the current window, or returns NULL if EOF has been reached
+// roundedValue() returns a number as R would read it from the text output, where it
+// has the given digits after the decimal point
 
-PosData *processWindow(PosData *pd)
+double roundedValue(double value, int decimals)
 {
-   const int chrX = 23;
-   const double EPSILON = 0.0001; // to avoid division by zero
+   char text[32];
+   text[TextWriter::formatFixed(text, sizeof(text) - 1, value, decimals)] = '\0';
 
-   int count          = 0;
-   int sumTumorTotal  = 0;
-   int sumNormalTotal = 0;
+   return std::strtod(text, NULL);
+}
 
-   int chrnum = pd->chrnum;
-   int window = pd->window;
+//------------------------------------------------------------------------------------
+// RdsOutput::addImbalance() adds a row of the allelic imbalance data frame, with the
+// values rounded as in the .ai file
 
-   double minCoverage = median * (chrnum == chrX ? xminfactor : minfactor);
-   double maxCoverage = median * (chrnum == chrX ? xmaxfactor : maxfactor);
+void RdsOutput::addImbalance(int chrnum, int position, double aiDiff, double baft,
+		             double bafn)
+{
+   aiChr.push_back(chrLongName[chrnum]);
+   aiPos.push_back(position);
+   this->aiDiff.push_back(roundedValue(aiDiff, 2));
+   aiBaft.push_back(roundedValue(baft, 2));
+   aiBafn.push_back(roundedValue(bafn, 2));
+}
+
+//------------------------------------------------------------------------------------
+// RdsOutput::writeWindows() writes the window averages of a chromosome as a data frame
+// with the Dcvg and Gcvg columns of the chromosome file, and then clears them
+
+void RdsOutput::writeWindows(int chrnum)
+{
+   char suffix[100];
+   std::sprintf(suffix, CHR_FILENAME_SUFFIX, chrLongName[chrnum].c_str());
+
+   std::string filename = filenamePrefix + suffix + RDS_FILENAME_SUFFIX;
+
+   RdsWriter writer;
+   if (!writer.openFile(filename.c_str()))
+      throw std::runtime_error("unable to open " + filename);
+
+   writer.beginDataFrame(2);
+   writer.writeIntegerColumn(dcvg);
+   writer.writeIntegerColumn(gcvg);
+
+   StringVector names;
+   names.push_back("Dcvg");
+   names.push_back("Gcvg");
+
+   writer.endDataFrame(names, dcvg.size());
+   writer.closeFile();
+
+   dcvg.clear();
+   gcvg.clear();
+}
+
+//------------------------------------------------------------------------------------
+// RdsOutput::writeImbalance() writes the allelic imbalance data frame, which has the
+// columns of the .ai file
+
+void RdsOutput::writeImbalance()
+{
+   std::string filename = filenamePrefix + AI_FILENAME_SUFFIX + RDS_FILENAME_SUFFIX;
+
+   RdsWriter writer;
+   if (!writer.openFile(filename.c_str()))
+      throw std::runtime_error("unable to open " + filename);
+
+   writer.beginDataFrame(5);
+   writer.writeStringColumn(aiChr);
+   writer.writeIntegerColumn(aiPos);
+   writer.writeDoubleColumn(aiDiff);
+   writer.writeDoubleColumn(aiBaft);
+   writer.writeDoubleColumn(aiBafn);
+
+   StringVector names;
+   names.push_back("Chr");
+   names.push_back("Pos");
+   names.push_back("AIDiff");
+   names.push_back("BAFT");
+   names.push_back("BAFN");
+
+   writer.endDataFrame(names, aiChr.size());
+   writer.closeFile();
+}
+
+
+//------------------------------------------------------------------------------------
+// SampleJob::SampleJob() sets up a job; nothing is read or written until run()
+
+SampleJob::SampleJob(const std::string& inInputFilename, double inMedian,
+		     const std::string& inFilenamePrefix)
+   : inputFilename(inInputFilename), median(inMedian),
+     filenamePrefix(inFilenamePrefix), region(NULL), background(NULL),
+     container(NULL), aifile(NULL), rdsOutput(NULL), numPositions(0), numBad(0),
+     numOutOfRange(0), numImbalance(0), numWindowsWritten(0)
+{
+   for (int chrnum = 0; chrnum <= NUM_CHROMOSOMES; chrnum++)
+      chrfile[chrnum] = NULL;
+}
+
+//------------------------------------------------------------------------------------
+// SampleJob::~SampleJob() releases whatever a failed run() left behind
+
+SampleJob::~SampleJob()
+{
+   delete aifile;
+
+   for (int chrnum = 0; chrnum <= NUM_CHROMOSOMES; chrnum++)
+      delete chrfile[chrnum];
+
+   delete container;
+   delete rdsOutput;
+   delete background;
+   delete region;
+}
+
+//------------------------------------------------------------------------------------
+// SampleJob::openSource() returns the source of the input positions, finding the
+// median normal coverage first if it is to be computed
+
+PositionSource *SampleJob::openSource(const std::string& countsFilename,
+		                      const std::string& regionString)
+{
+   PositionSource *source;
+
+   // a MAF or Bambino file is read into memory; any other input is an snvcounts
+   // file, whose median normal coverage is found in a first pass over the file
+   bool countsInput = (inputFilename == "" || regionString != "" ||
+		       isBinaryCountsFile(inputFilename) ||
+		       isTextCountsFile(inputFilename));
+
+   if (countsInput && countsFilename != "" && !sort_input)
+      throw std::runtime_error("-counts needs a MAF or Bambino file, or -sort");
 
-   while (pd && chrnum == pd->chrnum && window == pd->window)
+   if (countsInput && median == COMPUTE_MEDIAN)
    {
-      if (chrnum == chrX ||
-          badlist[chrnum].find(pd->position) == badlist[chrnum].end())
-      {
-         double normalMAF = pd->normalMutant / (pd->normalTotal + EPSILON);
+      Metrics::Timer timer;
 
-	 if (pd->tumorTotal > 15 && pd->normalTotal > 15 &&
-	     normalMAF > 0.4 && normalMAF < 0.6)
-	 {
-            double tumorMAF = pd->tumorMutant / (pd->tumorTotal + EPSILON);
+      CoverageHistogram normalCoverage;
+      normalCoverage.addCountsFile(inputFilename == "" ? "-" : inputFilename);
 
-	    char buffer[100];
+      // the two middle values are averaged, as for VCF and SJ_MAF input before
+      median = normalCoverage.median();
+      addPhase("computeMedian", timer);
+   }
 
-	    std::sprintf(buffer, "%s\t%d\t%.2f\t%.2f\t%.2f\n",
-			 chrLongName[chrnum].c_str(), pd->position,
-			 std::abs(tumorMAF - normalMAF), tumorMAF, normalMAF);
+   if (regionString != "")
+   {
+      // widen the region to whole windows
+      region = new SnvRegion(regionString);
+      region->start = region->start / 100 * 100;
+      region->end   = region->end   / 100 * 100 + 99;
 
-	    *aifile << buffer;
-	 }
+      source = new RegionPositionSource(inputFilename, *region);
+   }
+   else if (inputFilename != "" && isBinaryCountsFile(inputFilename))
+      source = new BinaryPositionSource(inputFilename);
+   else if (inputFilename != "" && isTextCountsFile(inputFilename))
+      source = new TextPositionSource(inputFilename);
+   else if (inputFilename != "") // read the MAF or Bambino file directly
+   {
+      Metrics::Timer timer;
+      counts.readFile(inputFilename);
+      addPhase("readFile", timer);
 
-	 if (pd->normalTotal >= minCoverage && pd->normalTotal <= maxCoverage)
-	 {
-            count++;
-	    sumTumorTotal  += pd->tumorTotal;
-	    sumNormalTotal += pd->normalTotal;
-	 }
+      if (countsFilename != "")
+      {
+         Metrics::Timer timer;
+         counts.writeCounts(countsFilename);
+	 addPhase("writeCounts", timer);
+      }
+
+      if (median == COMPUTE_MEDIAN)
+      {
+         Metrics::Timer timer;
+         median = counts.medianNormalCoverage(); // as snvcounts writes it
+	 addPhase("computeMedian", timer);
       }
 
-      delete pd;
-      pd = readNextPosition();
+      source = new CountsPositionSource(counts, inputFilename);
    }
+   else
+      source = new TextPositionSource("-");
 
-   *chrfile[chrnum] << roundit(sumTumorTotal  / (count + EPSILON)) << "\t"
-		    << roundit(sumNormalTotal / (count + EPSILON)) << "\n";
+   if (sort_input)
+   {
+      Metrics::Timer timer;
+      source = new SortedPositionSource(source, static_cast<size_t>(sortmem) << 20,
+		                        countsInput ? countsFilename : "");
+      addPhase("sort", timer);
+   }
 
-   return pd;
+   return source;
 }
 
 //------------------------------------------------------------------------------------
-// processAllChromosomes() reads position data from stdin and writes one line for each
-// window in each chromosome giving the average tumor coverage and average normal
-// coverage of positions in that window
+// SampleJob::createOutputFile() creates one output file, or a section of the
+// container file
 
-void processAllChromosomes()
+TextWriter *SampleJob::createOutputFile(const char *suffix)
 {
-   PosData *pd = readNextPosition(); // read first position
+   TextWriter *outfile = new TextWriter(DEFAULT_BUFFER_SIZE, background);
 
-   for (int chrnum = 1; chrnum <= NUM_CHROMOSOMES; chrnum++)
+   if (container)
+      outfile->openSection(*container, suffix + 1);
+   else
    {
-      int wincount = numWindows[chrnum];
+      std::string filename = filenamePrefix + suffix;
 
-      for (int window = 0; window < wincount; window++)
-         if (pd && chrnum == pd->chrnum && window == pd->window)
-            pd = processWindow(pd); // process one or more positions in this window
-         else // no positions in this window
-	    *chrfile[chrnum] << "0\t0\n"; // average coverage is zero
+      if (!outfile->openFile(filename.c_str()))
+      {
+         delete outfile;
+         throw std::runtime_error("unable to open " + filename);
+      }
    }
 
-   if (pd)
-      throw std::runtime_error("lines read from stdin are invalid or unsorted");
+   return outfile;
 }
 
 //------------------------------------------------------------------------------------
+// SampleJob::createOutputFiles() creates the output files and writes a heading line
+// to each; if there is a region, only the file of its chromosome is created
 
-int main(int argc, char *argv[])
+void SampleJob::createOutputFiles()
 {
-   std::string goodbad_filename, wincount_filename, output_filenamePrefix;
-
-   if (!processOptions(argc, argv, goodbad_filename, wincount_filename,
-		       output_filenamePrefix))
+   if (use_container)
    {
-      showUsage(argv[0]);
-      return 1;
+      std::string filename = filenamePrefix + CONTAINER_FILENAME_SUFFIX;
+
+      container = new ContainerWriter;
+      if (!container->openFile(filename.c_str()))
+         throw std::runtime_error("unable to open " + filename);
    }
 
-   try
+   aifile = createOutputFile(AI_FILENAME_SUFFIX);
+   aifile->write_string("Chr\tPos\tAIDiff\tBAFT\tBAFN\n");
+
+   for (int chrnum = 1; chrnum <= NUM_CHROMOSOMES; chrnum++)
    {
-      readGoodBadList(goodbad_filename);
-      readNumWindows(wincount_filename);
+      if (region && region->chrnum != chrnum)
+         continue;
 
-      createOutputFiles(output_filenamePrefix);
-      processAllChromosomes();
-      closeOutputFiles();
+      char suffix[100];
+      std::sprintf(suffix, CHR_FILENAME_SUFFIX, chrLongName[chrnum].c_str());
+
+      chrfile[chrnum] = createOutputFile(suffix);
+      chrfile[chrnum]->write_string("Dcvg\tGcvg\n");
+   }
+}
+
+//------------------------------------------------------------------------------------
+// SampleJob::closeOutputFiles() closes all of the output files
+
+void SampleJob::closeOutputFiles()
+{
+   aifile->closeFile();
+   delete aifile;
+   aifile = NULL;
+
+   for (int chrnum = 1; chrnum <= NUM_CHROMOSOMES; chrnum++)
+      if (chrfile[chrnum])
+      {
+         chrfile[chrnum]->closeFile();
+	 delete chrfile[chrnum];
+	 chrfile[chrnum] = NULL;
+      }
+
+   if (container)
+   {
+      container->closeFile();
+      delete container;
+      container = NULL;
+   }
+}
+
+//------------------------------------------------------------------------------------
+// SampleJob::run() prepares the data files of the sample
+
+void SampleJob::run(const std::string& countsFilename,
+		    const std::string& regionString)
+{
+   PositionSource *source = openSource(countsFilename, regionString);
+
+   try
+   {
+      background = new BackgroundWriter;
+
+      if (use_rds)
+         rdsOutput = new RdsOutput(filenamePrefix);
+
+      Metrics::Timer timer;
+
+      createOutputFiles();
+      processAllChromosomes(*source);
+      addPhase("processAllChromosomes", timer);
+
+      Metrics::Timer closeTimer;
+
+      closeOutputFiles();
+
+      if (rdsOutput)
+      {
+         rdsOutput->writeImbalance();
+	 delete rdsOutput;
+	 rdsOutput = NULL;
+      }
+
+      delete background;
+      background = NULL;
+
+      addPhase("closeOutputFiles", closeTimer);
+   }
+   catch (...)
+   {
+      delete source;
+      throw;
+   }
+
+   delete source;
+
+   if (metrics)
+   {
+      metrics->addCount("jobs",                  1);
+      metrics->addCount("positionsRead",         numPositions);
+      metrics->addCount("positionsBad",          numBad);
+      metrics->addCount("positionsOutOfRange",   numOutOfRange);
+      metrics->addCount("imbalanceLinesWritten", numImbalance);
+      metrics->addCount("windowsWritten",        numWindowsWritten);
+   }
+}
+
+//------------------------------------------------------------------------------------
+// SampleJob::processWindow() processes positions that fall in a particular window and
+// writes to the chromosome file the average tumor coverage and average normal
+// coverage of these positions; note that positions not in chrX that have a bad SNV
+// are excluded from the computation of average coverage; positions with normal
+// coverage below the minimum or above the maximum are also excluded; on return, pd
+// holds the first position not in the current window, and false is returned if EOF
+// has been reached
+
+bool SampleJob::processWindow(PositionSource& source, PosData& pd)
+{
+   const int chrX = 23;
+   const double EPSILON = 0.0001; // to avoid division by zero
+
+   int count          = 0;
+   int sumTumorTotal  = 0;
+   int sumNormalTotal = 0;
+
+   int chrnum = pd.chrnum;
+   int window = pd.window;
+
+   double minCoverage = median * (chrnum == chrX ? xminfactor : minfactor);
+   double maxCoverage = median * (chrnum == chrX ? xmaxfactor : maxfactor);
+
+   bool more = true; // false when EOF has been reached
+
+   while (more && chrnum == pd.chrnum && window == pd.window)
+   {
+      numPositions++;
+
+      if (chrnum == chrX ||
+          badlist[chrnum].find(pd.position) == badlist[chrnum].end())
+      {
+         double normalMAF = pd.normalMutant / (pd.normalTotal + EPSILON);
+
+	 if (pd.tumorTotal > 15 && pd.normalTotal > 15 &&
+	     normalMAF > 0.4 && normalMAF < 0.6)
+	 {
+            double tumorMAF = pd.tumorMutant / (pd.tumorTotal + EPSILON);
+
+	    aifile->write_string(chrLongName[chrnum]);
+	    aifile->write_char('\t');
+	    aifile->write_int(pd.position);
+	    aifile->write_char('\t');
+	    aifile->write_fixed(std::abs(tumorMAF - normalMAF), 2);
+	    aifile->write_char('\t');
+	    aifile->write_fixed(tumorMAF, 2);
+	    aifile->write_char('\t');
+	    aifile->write_fixed(normalMAF, 2);
+	    aifile->write_char('\n');
+
+	    if (rdsOutput)
+               rdsOutput->addImbalance(chrnum, pd.position,
+			               std::abs(tumorMAF - normalMAF), tumorMAF,
+				       normalMAF);
+
+	    numImbalance++;
+	 }
+
+	 if (pd.normalTotal >= minCoverage && pd.normalTotal <= maxCoverage)
+	 {
+            count++;
+	    sumTumorTotal  += pd.tumorTotal;
+	    sumNormalTotal += pd.normalTotal;
+	 }
+	 else
+            numOutOfRange++;
+      }
+      else
+         numBad++;
+
+      more = source.nextPosition(pd);
+   }
+
+   int tumorCoverage  = roundit(sumTumorTotal  / (count + EPSILON));
+   int normalCoverage = roundit(sumNormalTotal / (count + EPSILON));
+
+   TextWriter *outfile = chrfile[chrnum];
+
+   outfile->write_int(tumorCoverage);
+   outfile->write_char('\t');
+   outfile->write_int(normalCoverage);
+   outfile->write_char('\n');
+
+   if (rdsOutput)
+      rdsOutput->addWindow(tumorCoverage, normalCoverage);
+
+   numWindowsWritten++;
+
+   return more;
+}
+
+//------------------------------------------------------------------------------------
+// SampleJob::processAllChromosomes() reads position data from a source and writes one
+// line for each window in each chromosome giving the average tumor coverage and
+// average normal coverage of positions in that window; if there is a region, lines
+// are written only for the windows of the region
+
+void SampleJob::processAllChromosomes(PositionSource& source)
+{
+   PosData pd;
+   bool more = source.nextPosition(pd); // read first position
+
+   for (int chrnum = 1; chrnum <= NUM_CHROMOSOMES; chrnum++)
+   {
+      int firstWindow = 0;
+      int wincount    = numWindows[chrnum];
+
+      if (region)
+      {
+         if (region->chrnum != chrnum)
+            continue;
+
+	 firstWindow = region->start / 100;
+	 wincount    = std::min(wincount, region->end / 100 + 1);
+      }
+
+      for (int window = firstWindow; window < wincount; window++)
+         if (more && chrnum == pd.chrnum && window == pd.window)
+            more = processWindow(source, pd); // process positions in this window
+         else // no positions in this window
+	 {
+	    chrfile[chrnum]->write_string("0\t0\n", 4); // average coverage is zero
+
+	    if (rdsOutput)
+               rdsOutput->addWindow(0, 0);
+
+	    numWindowsWritten++;
+	 }
+
+      if (rdsOutput)
+         rdsOutput->writeWindows(chrnum);
+   }
+
+   if (more)
+      throw std::runtime_error("lines read from " + source.name +
+		               " are invalid or unsorted");
+}
+
+//------------------------------------------------------------------------------------
+// parseJob() returns a new job described by a line of a batch manifest or a job
+// request to the server: the input filename, the median normal coverage (-1 to compute
+// it) and the output path prefix, separated by tabs; NULL is returned if the line is
+// invalid
+
+SampleJob *parseJob(const std::string& line)
+{
+   StringVector column;
+   getDelimitedStrings(line, '\t', column);
+
+   if (column.size() != 3 || column[0] == "" || column[2] == "")
+      return NULL;
+
+   double jobMedian = stringToDbl(column[1]);
+   if (jobMedian < 0 && jobMedian != COMPUTE_MEDIAN)
+      return NULL;
+
+   return new SampleJob(column[0], jobMedian, column[2]);
+}
+
+//------------------------------------------------------------------------------------
+// readManifest() reads the jobs of a batch manifest file; blank lines and lines
+// beginning with '#' are ignored
+
+void readManifest(const std::string& filename, std::vector<SampleJob *>& jobs)
+{
+   LineReader infile;
+   if (!infile.openFile(filename.c_str()))
+      throw std::runtime_error("unable to open " + filename);
+
+   std::string line;
+
+   while (infile.getLine(line))
+   {
+      if (line == "" || line[0] == '#')
+         continue;
+
+      SampleJob *job = parseJob(line);
+      if (!job)
+         throw std::runtime_error("invalid line in " + filename + " \"" + line +
+			          "\"");
+
+      jobs.push_back(job);
+   }
+
+   infile.closeFile();
+}
+
+//------------------------------------------------------------------------------------
+
+class BatchRunner // runs the jobs of a batch on a pool of worker threads
+{
+public:
+   BatchRunner(std::vector<SampleJob *>& inJobs, const char *inProgname)
+      : jobs(inJobs), progname(inProgname), nextJob(0), numFailed(0) { }
+
+   // run() returns once every job has been run, using the given number of threads;
+   // the number of failed jobs is returned
+   int run(int threads);
+
+protected:
+   static void runWorker(BatchRunner *runner) { runner->worker(); }
+   void worker();
+
+   std::vector<SampleJob *>& jobs;
+   const char               *progname; // prefix of error messages
+
+   std::mutex mutex;     // guards nextJob, numFailed and std::cerr
+   size_t     nextJob;   // index of the next job to be started
+   int        numFailed;
+};
+
+//------------------------------------------------------------------------------------
+// BatchRunner::run() starts the worker threads and waits for them to finish
+
+int BatchRunner::run(int threads)
+{
+   threads = std::max(1, std::min(threads, static_cast<int>(jobs.size())));
+
+   std::vector<std::thread> pool;
+
+   for (int i = 0; i < threads; i++)
+      pool.push_back(std::thread(runWorker, this));
+
+   for (int i = 0; i < threads; i++)
+      pool[i].join();
+
+   return numFailed;
+}
+
+//------------------------------------------------------------------------------------
+// BatchRunner::worker() runs jobs until none remain; a failed job is reported and
+// does not stop the others
+
+void BatchRunner::worker()
+{
+   while (true)
+   {
+      SampleJob *job;
+      {
+         std::lock_guard<std::mutex> lock(mutex);
+
+	 if (nextJob == jobs.size())
+            return;
+
+	 job = jobs[nextJob++];
+      }
+
+      try
+      {
+         job->run("", "");
+      }
+      catch (const std::exception& error)
+      {
+         std::lock_guard<std::mutex> lock(mutex);
+
+	 std::cerr << progname << ": " << job->inputFilename << ": " << error.what()
+		   << std::endl;
+	 numFailed++;
+      }
+   }
+}
+
+//------------------------------------------------------------------------------------
+// sendString() writes all of a string to a socket; false is returned if the write
+// fails
+
+bool sendString(int fd, const std::string& s)
+{
+   size_t offset = 0;
+
+   while (offset < s.length())
+   {
+      ssize_t n = ::write(fd, s.data() + offset, s.length() - offset);
+
+      if (n < 0 && errno == EINTR)
+         continue;
+      if (n <= 0)
+         return false;
+
+      offset += n;
+   }
+
+   return true;
+}
+
+//------------------------------------------------------------------------------------
+// receiveLine() passes back the next line read from a socket, without its newline;
+// buffer holds bytes received beyond the line, and false is returned once the peer
+// has closed the connection
+
+bool receiveLine(int fd, std::string& buffer, std::string& line)
+{
+   size_t newline;
+
+   while ((newline = buffer.find('\n')) == std::string::npos)
+   {
+      char data[4096];
+      ssize_t n = ::read(fd, data, sizeof(data));
+
+      if (n < 0 && errno == EINTR)
+         continue;
+      if (n <= 0)
+         return false;
+
+      buffer.append(data, n);
+   }
+
+   line = buffer.substr(0, newline);
+   buffer.erase(0, newline + 1);
+
+   return true;
+}
+
+//------------------------------------------------------------------------------------
+// socketAddress() fills in the address of a Unix domain socket
+
+void socketAddress(const std::string& path, sockaddr_un& address)
+{
+   if (path.length() >= sizeof(address.sun_path))
+      throw std::runtime_error("socket path is too long: " + path);
+
+   std::memset(&address, 0, sizeof(address));
+   address.sun_family = AF_UNIX;
+   std::strcpy(address.sun_path, path.c_str());
+}
+
+//------------------------------------------------------------------------------------
+// removeStaleSocket() removes a socket left by a server that has exited; an exception
+// is thrown if the path is not a socket or a server is still listening on it
+
+void removeStaleSocket(const std::string& path, const sockaddr_un& address)
+{
+   struct stat info;
+   if (::lstat(path.c_str(), &info) != 0)
+      return; // nothing there
+
+   if (!S_ISSOCK(info.st_mode))
+      throw std::runtime_error(path + " exists and is not a socket");
+
+   int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+   if (fd < 0)
+      throw std::runtime_error("unable to create socket " + path);
+
+   bool live = (::connect(fd, reinterpret_cast<const sockaddr *>(&address),
+			  sizeof(address)) == 0);
+   bool stale = (!live && errno == ECONNREFUSED);
+
+   ::close(fd);
+
+   if (live)
+      throw std::runtime_error("a server is already running on socket " + path);
+
+   if (!stale || ::unlink(path.c_str()) != 0)
+      throw std::runtime_error("unable to replace socket " + path);
+}
+
+//------------------------------------------------------------------------------------
+
+class JobServer // runs the jobs sent to a Unix domain socket, a limited number at a
+                // time
+{
+public:
+   JobServer(int inMaxJobs) : maxJobs(inMaxJobs), numRunning(0), numConnections(0) { }
+
+   // serve() listens on the socket and runs jobs until the process is killed; an
+   // exception is thrown if the socket cannot be set up, or, once the connections
+   // still open have finished, if accepting fails
+   void serve(const std::string& socketPath);
+
+protected:
+   static void runConnection(JobServer *server, int fd) { server->connection(fd); }
+   void connection(int fd);
+   void endConnection();
+
+   std::string runJob(const std::string& line);
+
+   int                     maxJobs;
+   std::mutex              mutex;          // guards numRunning and numConnections
+   std::condition_variable slotFree;       // signaled when a job finishes
+   std::condition_variable connectionDone; // signaled when a connection closes
+   int                     numRunning;
+   int                     numConnections; // connection threads not yet finished
+};
+
+//------------------------------------------------------------------------------------
+// JobServer::serve() binds the socket, replacing a stale one left by an earlier
+// server, and starts a thread for each connection; the threads use the server, so
+// serve() does not return until they have finished
+
+void JobServer::serve(const std::string& socketPath)
+{
+   sockaddr_un address;
+   socketAddress(socketPath, address);
+   removeStaleSocket(socketPath, address);
+
+   int listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+   if (listener < 0)
+      throw std::runtime_error("unable to create socket " + socketPath);
+
+   if (::bind(listener, reinterpret_cast<sockaddr *>(&address),
+	      sizeof(address)) != 0 ||
+       ::listen(listener, SOMAXCONN) != 0)
+   {
+      ::close(listener);
+      throw std::runtime_error("unable to listen on socket " + socketPath);
+   }
+
+   std::signal(SIGPIPE, SIG_IGN); // a client that hangs up is not fatal
+
+   std::string error;
+
+   while (error == "")
+   {
+      int fd = ::accept(listener, NULL, NULL);
+
+      if (fd >= 0)
+      {
+         {
+            std::lock_guard<std::mutex> lock(mutex);
+	    numConnections++;
+         }
+
+	 try
+	 {
+            std::thread(runConnection, this, fd).detach();
+	 }
+	 catch (const std::system_error&)
+	 {
+            ::close(fd);
+	    endConnection();
+	    error = "unable to start a thread for socket " + socketPath;
+	 }
+      }
+      else if (errno != EINTR && errno != ECONNABORTED)
+         error = "unable to accept on socket " + socketPath;
+   }
+
+   ::close(listener);
+
+   // wait for the connection threads before the server can be destroyed
+   std::unique_lock<std::mutex> lock(mutex);
+
+   while (numConnections > 0)
+      connectionDone.wait(lock);
+
+   throw std::runtime_error(error);
+}
+
+//------------------------------------------------------------------------------------
+// JobServer::connection() runs each job requested on a connection in turn, answering
+// each with a status line, until the client closes the connection
+
+void JobServer::connection(int fd)
+{
+   std::string buffer, line;
+
+   while (receiveLine(fd, buffer, line))
+      if (!sendString(fd, runJob(line) + "\n"))
+         break;
+
+   ::close(fd);
+   endConnection();
+}
+
+//------------------------------------------------------------------------------------
+// JobServer::endConnection() counts a finished connection thread; it is the thread's
+// last use of the server
+
+void JobServer::endConnection()
+{
+   std::lock_guard<std::mutex> lock(mutex);
+
+   numConnections--;
+   connectionDone.notify_all();
+}
+
+//------------------------------------------------------------------------------------
+// JobServer::runJob() runs the job of a request line once fewer than maxJobs are
+// running, and returns the status line: "OK", or "ERROR" and a message
+
+std::string JobServer::runJob(const std::string& line)
+{
+   SampleJob *job = parseJob(line);
+   if (!job)
+      return "ERROR invalid job \"" + line + "\"";
+
+   {
+      std::unique_lock<std::mutex> lock(mutex);
+
+      while (numRunning == maxJobs)
+         slotFree.wait(lock);
+
+      numRunning++;
+   }
+
+   std::string status = "OK";
+
+   try
+   {
+      job->run("", "");
+   }
+   catch (const std::exception& error)
+   {
+      status = std::string("ERROR ") + error.what();
+   }
+
+   delete job;
+
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+
+      numRunning--;
+
+      if (metrics && !metrics->writeFile(metrics_filename, "consprep") &&
+	  status == "OK")
+         status = "ERROR unable to write " + metrics_filename;
+   }
+
+   slotFree.notify_one();
+
+   return status;
+}
+
+//------------------------------------------------------------------------------------
+// absolutePath() returns a path that does not depend on the working directory, since
+// the server resolves paths in its own
+
+std::string absolutePath(const std::string& path)
+{
+   if (path != "" && path[0] == '/')
+      return path;
+
+   char cwd[PATH_MAX];
+   if (!::getcwd(cwd, sizeof(cwd)))
+      throw std::runtime_error("unable to get the working directory");
+
+   return std::string(cwd) + "/" + path;
+}
+
+//------------------------------------------------------------------------------------
+// submitJob() sends a job to a server and returns its status line
+
+std::string submitJob(const std::string& socketPath, const std::string& inputFilename,
+		      double jobMedian, const std::string& filenamePrefix)
+{
+   sockaddr_un address;
+   socketAddress(socketPath, address);
+
+   int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+   if (fd < 0 || ::connect(fd, reinterpret_cast<sockaddr *>(&address),
+			   sizeof(address)) != 0)
+   {
+      if (fd >= 0)
+         ::close(fd);
+
+      throw std::runtime_error("unable to connect to socket " + socketPath);
+   }
+
+   char medianText[32];
+   std::sprintf(medianText, "%.17g", jobMedian);
+
+   std::string buffer, status;
+
+   if (!sendString(fd, absolutePath(inputFilename) + "\t" + medianText + "\t" +
+		       absolutePath(filenamePrefix) + "\n") ||
+       !receiveLine(fd, buffer, status))
+      status = "ERROR connection to " + socketPath + " was lost";
+
+   ::close(fd);
+
+   return status;
+}
+
+//------------------------------------------------------------------------------------
+
+int main(int argc, char *argv[])
+{
+   std::string goodbad_filename, wincount_filename, output_filenamePrefix;
+
+   if (!processOptions(argc, argv, goodbad_filename, wincount_filename,
+		       output_filenamePrefix))
+   {
+      showUsage(argv[0]);
+      return 1;
+   }
+
+   try
+   {
+      if (submit_socket != "")
+      {
+         std::string status = submitJob(submit_socket, input_filename, median,
+			                output_filenamePrefix);
+
+	 if (status != "OK")
+	 {
+            std::cerr << argv[0] << ": " << status << std::endl;
+	    return 1;
+	 }
+
+	 return 0;
+      }
+
+      if (metrics_filename != "")
+         metrics = new Metrics;
+
+      // the badlist and numWindows data are read once and shared by all jobs
+      Metrics::Timer timer;
+      readGoodBadList(goodbad_filename);
+      addPhase("readGoodBadList", timer);
+
+      Metrics::Timer windowsTimer;
+      readNumWindows(wincount_filename);
+      addPhase("readNumWindows", windowsTimer);
+
+      if (numThreads == 0)
+         numThreads = std::max(1u, std::thread::hardware_concurrency());
+
+      if (serve_socket != "")
+      {
+         JobServer server(numThreads);
+	 server.serve(serve_socket);
+      }
+      else if (batch_filename != "")
+      {
+         std::vector<SampleJob *> jobs;
+	 readManifest(batch_filename, jobs);
+
+	 BatchRunner runner(jobs, argv[0]);
+	 int numFailed = runner.run(numThreads);
+
+	 for (size_t i = 0; i < jobs.size(); i++)
+            delete jobs[i];
+
+	 writeMetrics();
+
+	 if (numFailed > 0)
+	 {
+            std::cerr << argv[0] << ": " << numFailed << " of " << jobs.size()
+		      << " jobs failed" << std::endl;
+	    return 1;
+	 }
+      }
+      else
+      {
+         SampleJob job(input_filename, median, output_filenamePrefix);
+	 job.run(counts_filename, region_string);
+
+	 writeMetrics();
+      }
    }
    catch (const std::runtime_error& error)
    {
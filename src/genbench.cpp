@@ -0,0 +1,630 @@
+//------------------------------------------------------------------------------------
+//
+// genbench.cpp - program that times the frequently called routines of genutil on
+//                fixed synthetic inputs and writes one tab-delimited line for each
+//                benchmark, giving the nanoseconds per operation and, where it
+//                applies, the bytes processed per second
+//
+// Copyright 2017 St. Jude Children's Research Hospital
+//
+//------------------------------------------------------------------------------------
+
+#include "genutil.h"
+#include <random>
+
+volatile uint64_t sink; // results are added here so that no work is optimized away
+
+std::string tempDirectory; // holds the files written and read by the benchmarks
+
+//------------------------------------------------------------------------------------
+
+class Benchmark // one routine to be timed
+{
+public:
+   Benchmark(const std::string& inName, uint64_t inNumOps)
+      : name(inName), numOps(inNumOps) { }
+
+   virtual ~Benchmark() { }
+
+   // setup() prepares the inputs and is not timed; run() performs numOps operations
+   // and returns the number of bytes processed, or 0 if bytes do not apply
+   virtual void     setup() { }
+   virtual uint64_t run() = 0;
+
+   std::string name;
+   uint64_t    numOps;
+};
+
+//------------------------------------------------------------------------------------
+// randomBases() returns a sequence of random bases
+
+std::string randomBases(std::mt19937& random, size_t length)
+{
+   std::string sequence(length, 'A');
+
+   for (size_t i = 0; i < length; i++)
+      sequence[i] = "ACGT"[random() & 3];
+
+   return sequence;
+}
+
+//------------------------------------------------------------------------------------
+
+class SplitBenchmark : public Benchmark // getDelimitedStrings() on a MAF-like line
+{
+public:
+   SplitBenchmark() : Benchmark("getDelimitedStrings", 2000000) { }
+
+   virtual void setup()
+   {
+      line = "TP53\t7157\tchr17\t7577121\t7577121\tMissense_Mutation\tSNP\tC\tT\t"
+	     "SJOS001_D\tSJOS001_G\t37\t112\t0\t98";
+   }
+
+   virtual uint64_t run()
+   {
+      StringVector column;
+
+      for (uint64_t i = 0; i < numOps; i++)
+      {
+         getDelimitedStrings(line, '\t', column);
+	 sink += column.size();
+      }
+
+      return numOps * line.length();
+   }
+
+   std::string line;
+};
+
+//------------------------------------------------------------------------------------
+
+class IntBenchmark : public Benchmark // stringToInt() on counts and positions
+{
+public:
+   IntBenchmark() : Benchmark("stringToInt", 5000000) { }
+
+   virtual void setup()
+   {
+      std::mt19937 random(1);
+
+      for (int i = 0; i < 1024; i++)
+      {
+         char text[16];
+	 std::sprintf(text, "%u", static_cast<unsigned>((i & 1) ? random() % 1000 :
+					                          random() % 250000000));
+	 value.push_back(text);
+      }
+   }
+
+   virtual uint64_t run()
+   {
+      uint64_t bytes = 0;
+
+      for (uint64_t i = 0; i < numOps; i++)
+      {
+         const std::string& s = value[i & 1023];
+
+	 sink  += stringToInt(s);
+	 bytes += s.length();
+      }
+
+      return bytes;
+   }
+
+   StringVector value;
+};
+
+//------------------------------------------------------------------------------------
+
+class DblBenchmark : public Benchmark // stringToDbl() on coverage values
+{
+public:
+   DblBenchmark() : Benchmark("stringToDbl", 2000000) { }
+
+   virtual void setup()
+   {
+      std::mt19937 random(2);
+
+      for (int i = 0; i < 1024; i++)
+      {
+         char text[16];
+	 std::sprintf(text, "%.2f", (random() % 100000) / 100.0);
+	 value.push_back(text);
+      }
+   }
+
+   virtual uint64_t run()
+   {
+      uint64_t bytes = 0;
+
+      for (uint64_t i = 0; i < numOps; i++)
+      {
+         const std::string& s = value[i & 1023];
+
+	 sink  += static_cast<uint64_t>(stringToDbl(s));
+	 bytes += s.length();
+      }
+
+      return bytes;
+   }
+
+   StringVector value;
+};
+
+//------------------------------------------------------------------------------------
+
+class ChrBenchmark : public Benchmark // getChrNumber() on long, short and unknown
+                                      // names
+{
+public:
+   ChrBenchmark() : Benchmark("getChrNumber", 10000000) { }
+
+   virtual void setup()
+   {
+      for (int chrnum = 1; chrnum <= NUM_CHROMOSOMES; chrnum++)
+      {
+         name.push_back(chrLongName[chrnum]);
+	 name.push_back(chrShortName[chrnum]);
+      }
+
+      name.push_back("chrM");
+      name.push_back("chr1_gl000191_random");
+   }
+
+   virtual uint64_t run()
+   {
+      for (uint64_t i = 0; i < numOps; i++)
+         sink += getChrNumber(name[i % name.size()]);
+
+      return 0;
+   }
+
+   StringVector name;
+};
+
+//------------------------------------------------------------------------------------
+
+class VariantBenchmark : public Benchmark // Variant(const std::string&) on SNV and
+                                          // indel strings
+{
+public:
+   VariantBenchmark() : Benchmark("Variant", 1000000) { }
+
+   virtual void setup()
+   {
+      std::mt19937 random(3);
+
+      for (int i = 0; i < 1024; i++)
+      {
+         int chrnum = 1 + random() % NUM_CHROMOSOMES;
+
+	 // one in four is a deletion and one in four an insertion
+	 std::string ref = randomBases(random, (i % 4 == 1) ? 1 + random() % 8 : 1);
+	 std::string alt = randomBases(random, (i % 4 == 2) ? 1 + random() % 8 : 1);
+
+	 if (i % 4 == 1)
+            alt = "-";
+	 else if (i % 4 == 2)
+            ref = "-";
+	 else if (ref == alt)
+            alt = (ref == "A" ? "C" : "A");
+
+	 char text[100];
+	 std::sprintf(text, "%s.%u.%s.%s", chrLongName[chrnum].c_str(),
+		      static_cast<unsigned>(1 + random() % 100000000), ref.c_str(),
+		      alt.c_str());
+	 value.push_back(text);
+      }
+   }
+
+   virtual uint64_t run()
+   {
+      uint64_t bytes = 0;
+
+      for (uint64_t i = 0; i < numOps; i++)
+      {
+         const std::string& s = value[i & 1023];
+
+	 Variant variant(s);
+	 sink  += variant.position;
+	 bytes += s.length();
+      }
+
+      return bytes;
+   }
+
+   StringVector value;
+};
+
+//------------------------------------------------------------------------------------
+
+class PackedSnvBenchmark : public Benchmark // std::binary_search() for a PackedSnv in
+                                            // a sorted vector of a million SNVs
+{
+public:
+   PackedSnvBenchmark() : Benchmark("PackedSnv", 4000000) { }
+
+   virtual void setup()
+   {
+      std::mt19937 random(4);
+
+      for (int i = 0; i < 1000000; i++)
+      {
+         int ref = random() % 4, alt = (ref + 1 + random() % 3) % 4;
+
+	 value.push_back(PackedSnv(1 + random() % NUM_CHROMOSOMES,
+				   1 + random() % 200000000, "ACGT"[ref], "ACGT"[alt]));
+      }
+
+      std::sort(value.begin(), value.end());
+
+      // half of the keys are present and half are not
+      for (int i = 0; i < 1024; i++)
+      {
+	 PackedSnv snv = value[random() % value.size()];
+	 if (i % 2)
+	    snv.bits ^= 1 << 4; // a neighbouring position
+
+	 key.push_back(snv);
+      }
+   }
+
+   virtual uint64_t run()
+   {
+      for (uint64_t i = 0; i < numOps; i++)
+         sink += std::binary_search(value.begin(), value.end(), key[i & 1023]);
+
+      return 0;
+   }
+
+   PackedSnvVector value, key;
+};
+
+//------------------------------------------------------------------------------------
+
+class VariantStoreBenchmark : public Benchmark // VariantStore::add() and sort() on a
+                                               // million variants, then lookups
+{
+public:
+   VariantStoreBenchmark() : Benchmark("VariantStore", 1000000) { }
+
+   virtual void setup()
+   {
+      std::mt19937 random(5);
+
+      for (int i = 0; i < 1024; i++)
+      {
+         std::string sequence = (i % 4 == 1) ? "D" + randomBases(random, 1 + i % 8) :
+	                        (i % 4 == 2) ? "I" + randomBases(random, 1 + i % 8) :
+				               "SAC";
+
+	 value.push_back(new Variant(1 + random() % NUM_CHROMOSOMES,
+				     1 + random() % 200000000, sequence));
+      }
+   }
+
+   virtual uint64_t run()
+   {
+      VariantStore store;
+
+      // shift the positions so that most of the variants are distinct
+      for (uint64_t i = 0; i < numOps; i++)
+      {
+         Variant& v = *value[i & 1023];
+	 uint32_t position = v.position;
+
+	 v.position += (i >> 10) * 7;
+	 store.add(v);
+	 v.position = position;
+      }
+
+      store.sort();
+
+      for (uint64_t i = 0; i < numOps; i++)
+      {
+         const Variant& v = *value[i & 1023];
+	 sink += (store.find(v.chrNumber, v.position, v.sequence) != NULL);
+      }
+
+      return 0;
+   }
+
+   VariantVector value;
+};
+
+//------------------------------------------------------------------------------------
+
+const uint64_t BINARY_FILE_VALUES = 16 << 20; // 64 MB of uint32 values
+
+class BinaryWriterBenchmark : public Benchmark // BinaryWriter::write_uint32()
+{
+public:
+   BinaryWriterBenchmark() : Benchmark("BinaryWriter", BINARY_FILE_VALUES) { }
+
+   virtual uint64_t run()
+   {
+      std::string filename = tempDirectory + "/binary";
+
+      BinaryWriter writer;
+      if (!writer.openFile(filename.c_str(), true))
+         throw std::runtime_error("unable to open " + filename);
+
+      for (uint64_t i = 0; i < numOps; i++)
+         writer.write_uint32(static_cast<uint32_t>(i * 2654435761u));
+
+      writer.closeFile();
+
+      return numOps * 4;
+   }
+};
+
+//------------------------------------------------------------------------------------
+
+class BinaryReaderBenchmark : public Benchmark // BinaryReader::read_uint32() of the
+                                               // file written by BinaryWriter, with
+                                               // or without read-ahead
+{
+public:
+   BinaryReaderBenchmark(const std::string& inName, bool inReadAhead)
+      : Benchmark(inName, BINARY_FILE_VALUES), readAhead(inReadAhead) { }
+
+   virtual uint64_t run()
+   {
+      std::string filename = tempDirectory + "/binary";
+
+      BinaryReader reader;
+      if (!reader.openFile(filename.c_str(), readAhead))
+         throw std::runtime_error("unable to open " + filename +
+			          "; run the BinaryWriter benchmark first");
+
+      uint32_t value;
+
+      for (uint64_t i = 0; i < numOps; i++)
+      {
+         if (!reader.read_uint32(value))
+            throw std::runtime_error("unexpected EOF in " + filename);
+
+	 sink += value;
+      }
+
+      reader.closeFile();
+
+      return numOps * 4;
+   }
+
+   bool readAhead;
+};
+
+//------------------------------------------------------------------------------------
+
+class ReferenceBenchmark : public Benchmark // ReferenceGenome construction from a 2bit
+                                            // file, as characters or packed, for
+                                            // large regions or many small ones
+{
+public:
+   ReferenceBenchmark(const std::string& inName, bool inPacked,
+		      uint32_t inRegionSize, uint64_t inNumOps)
+      : Benchmark(inName, inNumOps), packed(inPacked), regionSize(inRegionSize) { }
+
+   static const uint32_t NUM_BASES = 16000000; // bases of the synthetic chromosome
+
+   // setup() writes a 2bit file of one random chromosome, chr1, with blocks of N
+   virtual void setup()
+   {
+      std::mt19937 random(4);
+
+      std::vector<uint32_t> nstart, nsize;
+
+      for (uint32_t start = 50000; start < NUM_BASES; start += 1000000)
+      {
+         nstart.push_back(start);
+	 nsize.push_back(10000);
+      }
+
+      filename = tempDirectory + "/chr1.2bit";
+
+      BinaryWriter writer;
+      if (!writer.openFile(filename.c_str(), true))
+         throw std::runtime_error("unable to open " + filename);
+
+      const uint32_t chrOffset = 16 + 1 + 4 + 4; // header, then the index of chr1
+
+      writer.write_uint32(0x1A412743); // signature
+      writer.write_uint32(0);          // version
+      writer.write_uint32(1);          // number of sequences
+      writer.write_uint32(0);          // reserved
+
+      writer.write_uint8(4);
+      writer.write_buffer("chr1", 4);
+      writer.write_uint32(chrOffset);
+
+      writer.write_uint32(NUM_BASES);
+      writer.write_uint32(nstart.size());
+
+      for (size_t i = 0; i < nstart.size(); i++)
+         writer.write_uint32(nstart[i]);
+
+      for (size_t i = 0; i < nsize.size(); i++)
+         writer.write_uint32(nsize[i]);
+
+      writer.write_uint32(0); // no mask blocks
+      writer.write_uint32(0); // reserved
+
+      for (uint32_t i = 0; i < NUM_BASES; i += 4)
+         writer.write_uint8(static_cast<uint8_t>(random()));
+
+      writer.closeFile();
+   }
+
+   virtual uint64_t run()
+   {
+      for (uint64_t i = 0; i < numOps; i++)
+      {
+         uint32_t begin = 1 + (i * 2999999) % (NUM_BASES - regionSize);
+
+	 ReferenceGenome genome(filename, 1, begin, begin + regionSize - 1, "", packed);
+	 sink += genome.getBase(begin + regionSize / 2);
+      }
+
+      return numOps * regionSize;
+   }
+
+   std::string filename;
+   bool        packed;
+   uint32_t    regionSize; // bases extracted by each operation
+};
+
+//------------------------------------------------------------------------------------
+
+class TrieBenchmark : public Benchmark // SequenceTrie::findSequence() on sequences
+                                       // that are and are not in the trie
+{
+public:
+   TrieBenchmark() : Benchmark("SequenceTrie", 5000000) { }
+
+   virtual void setup()
+   {
+      std::mt19937 random(5);
+
+      for (int i = 0; i < 10000; i++)
+         trie.addSequence(randomBases(random, 1 + random() % 20));
+
+      for (int i = 0; i < 1024; i++)
+         value.push_back(randomBases(random, 1 + random() % 20));
+   }
+
+   virtual uint64_t run()
+   {
+      uint64_t bytes = 0;
+
+      for (uint64_t i = 0; i < numOps; i++)
+      {
+         const std::string& s = value[i & 1023];
+
+	 sink  += trie.findSequence(s);
+	 bytes += s.length();
+      }
+
+      return bytes;
+   }
+
+   SequenceTrie trie;
+   StringVector value;
+};
+
+//------------------------------------------------------------------------------------
+// runBenchmark() sets up and times one benchmark and writes its line of results
+
+void runBenchmark(Benchmark& benchmark)
+{
+   benchmark.setup();
+
+   double start   = Metrics::wallSeconds();
+   uint64_t bytes = benchmark.run();
+   double seconds = Metrics::wallSeconds() - start;
+
+   std::printf("%s\t%llu\t%.3f\t", benchmark.name.c_str(),
+	       static_cast<unsigned long long>(benchmark.numOps),
+	       seconds * 1e9 / benchmark.numOps);
+
+   if (bytes > 0 && seconds > 0)
+      std::printf("%.0f\n", bytes / seconds);
+   else
+      std::printf("NA\n");
+
+   std::fflush(stdout);
+}
+
+//------------------------------------------------------------------------------------
+
+int main(int argc, char *argv[])
+{
+   std::vector<Benchmark *> benchmark;
+
+   benchmark.push_back(new SplitBenchmark);
+   benchmark.push_back(new IntBenchmark);
+   benchmark.push_back(new DblBenchmark);
+   benchmark.push_back(new ChrBenchmark);
+   benchmark.push_back(new VariantBenchmark);
+   benchmark.push_back(new PackedSnvBenchmark);
+   benchmark.push_back(new VariantStoreBenchmark);
+   benchmark.push_back(new BinaryWriterBenchmark);
+   benchmark.push_back(new BinaryReaderBenchmark("BinaryReader", false));
+   benchmark.push_back(new BinaryReaderBenchmark("BinaryReaderAhead", true));
+   benchmark.push_back(new ReferenceBenchmark("ReferenceGenome", false, 4000000, 20));
+   benchmark.push_back(new ReferenceBenchmark("ReferenceGenomePacked", true, 4000000,
+			                      20));
+   benchmark.push_back(new ReferenceBenchmark("ReferenceGenomeRegions", false, 100,
+			                      200000));
+   benchmark.push_back(new TrieBenchmark);
+
+   std::set<std::string> selected; // names given on the command line; empty for all
+
+   for (int i = 1; i < argc; i++)
+   {
+      size_t j = 0;
+      while (j < benchmark.size() && benchmark[j]->name != argv[i])
+         j++;
+
+      if (j == benchmark.size())
+      {
+         std::cout << "Usage: " << argv[0] << " [benchmark ...]" << std::endl
+		   << "  benchmarks:";
+
+	 for (j = 0; j < benchmark.size(); j++)
+            std::cout << " " << benchmark[j]->name;
+
+	 std::cout << std::endl;
+	 return 1;
+      }
+
+      selected.insert(argv[i]);
+   }
+
+   // BinaryReader reads the file written by BinaryWriter
+   if (selected.count("BinaryReader"))
+      selected.insert("BinaryWriter");
+
+   const char *tmpdir = std::getenv("TMPDIR");
+
+   std::string pattern = std::string(tmpdir && *tmpdir ? tmpdir : "/tmp") +
+	                 "/genbench.XXXXXX";
+
+   std::vector<char> dirname(pattern.begin(), pattern.end());
+   dirname.push_back('\0');
+
+   if (!mkdtemp(&dirname[0]))
+   {
+      std::cerr << argv[0] << ": unable to create a directory like " << pattern
+	        << std::endl;
+      return 1;
+   }
+
+   tempDirectory = &dirname[0];
+
+   int status = 0;
+
+   try
+   {
+      std::printf("Benchmark\tOps\tNsPerOp\tBytesPerSec\n");
+
+      for (size_t i = 0; i < benchmark.size(); i++)
+         if (selected.empty() || selected.count(benchmark[i]->name))
+            runBenchmark(*benchmark[i]);
+   }
+   catch (const std::runtime_error& error)
+   {
+      std::cerr << argv[0] << ": " << error.what() << std::endl;
+      status = 1;
+   }
+
+   std::remove((tempDirectory + "/binary").c_str());
+   std::remove((tempDirectory + "/chr1.2bit").c_str());
+   rmdir(tempDirectory.c_str());
+
+   for (size_t i = 0; i < benchmark.size(); i++)
+      delete benchmark[i];
+
+   return status;
+}
@@ -0,0 +1,193 @@
+//------------------------------------------------------------------------------------
+//
+// gentest.cpp - program that checks routines of genutil on crafted inputs that the
+//               generated datasets do not exercise, and writes one line for each
+//               test; the exit status is 1 if any test fails
+//
+// Copyright 2017 St. Jude Children's Research Hospital
+//
+//------------------------------------------------------------------------------------
+
+#include "genutil.h"
+#include <bzlib.h>
+#include <random>
+
+std::string tempDirectory; // holds the files written and read by the tests
+
+//------------------------------------------------------------------------------------
+// writeFile() writes a string to a new file in the temporary directory, and returns
+// the name of the file
+
+std::string writeFile(const std::string& name, const std::string& contents)
+{
+   std::string filename = tempDirectory + "/" + name;
+   FILE *file = std::fopen(filename.c_str(), "wb");
+
+   if (!file ||
+       std::fwrite(contents.data(), 1, contents.length(), file) != contents.length() ||
+       std::fclose(file) != 0)
+      throw std::runtime_error("unable to write " + filename);
+
+   return filename;
+}
+
+//------------------------------------------------------------------------------------
+// bzip2Compress() compresses a string as a bzip2 stream with the given block size
+// level
+
+std::string bzip2Compress(const std::string& text, int level)
+{
+   std::string out(text.length() + text.length() / 100 + 600, '\0');
+   unsigned int outLen = out.length();
+
+   if (BZ2_bzBuffToBuffCompress(&out[0], &outLen, const_cast<char *>(text.data()),
+                                text.length(), level, 0, 0) != BZ_OK)
+      throw std::runtime_error("unable to compress with libbz2");
+
+   out.resize(outLen);
+   return out;
+}
+
+//------------------------------------------------------------------------------------
+// readAll() reads a whole file through LineReader and returns its decompressed
+// contents
+
+std::string readAll(const std::string& filename, int numThreads)
+{
+   LineReader reader(numThreads);
+   std::string text;
+   char buffer[65536];
+   size_t numBytes;
+
+   if (!reader.openFile(filename.c_str()))
+      throw std::runtime_error("unable to open " + filename);
+
+   while ((numBytes = reader.readBytes(buffer, sizeof(buffer))) > 0)
+      text.append(buffer, numBytes);
+
+   reader.closeFile();
+   return text;
+}
+
+//------------------------------------------------------------------------------------
+// magicText() returns random text that uses exactly the byte values whose bzip2
+// symbol map spells the given 48-bit magic number; the map follows the 105 bits of
+// block magic, CRC, randomized flag and origin pointer at the start of every block,
+// so every block of the compressed text holds a false copy of the magic number that
+// is not on a block boundary
+
+std::string magicText(uint64_t magic, size_t length)
+{
+   // the map is a 16-bit word whose bit 15 - i is set if any byte in 16 * i to
+   // 16 * i + 15 is used, followed by the 16-bit use word of each of those ranges;
+   // the magic number gives the first word and the first two use words, and the
+   // other ranges that are used get one byte each
+
+   unsigned rangeWord = (magic >> 32) & 0xFFFF;
+   unsigned useWord[2] = { unsigned(magic >> 16) & 0xFFFF, unsigned(magic) & 0xFFFF };
+   std::vector<char> symbols;
+   int numRanges = 0;
+
+   for (int i = 0; i < 16; i++)
+      if (rangeWord & (0x8000 >> i))
+      {
+         for (int j = 0; j < 16; j++)
+            if (numRanges >= 2 ? j == 0 : (useWord[numRanges] & (0x8000 >> j)))
+               symbols.push_back(static_cast<char>(16 * i + j));
+
+         numRanges++;
+      }
+
+   std::mt19937 random(12345);
+   std::string text(length, ' ');
+
+   // no byte is repeated, since bzip2 would add the length of a run of four or more
+   // to the block as a byte value of its own
+
+   for (size_t i = 0; i < length; i++)
+      do
+         text[i] = symbols[(random() >> 4) % symbols.size()];
+      while (i > 0 && text[i] == text[i - 1]);
+
+   return text;
+}
+
+//------------------------------------------------------------------------------------
+// testFalseMagic() checks that a bzip2 file whose blocks contain a false block or
+// stream end magic number is inflated correctly
+
+bool testFalseMagic(const std::string& name, uint64_t magic)
+{
+   std::string text = magicText(magic, 350000);
+   std::string compressed = bzip2Compress(text, 1);
+
+   // the test is void unless the map of the first block spells the magic number
+
+   uint64_t mapBits = 0;
+
+   for (int i = 0; i < 48; i++)
+   {
+      int bit = 32 + 105 + i; // the first block follows the 4-byte stream header
+      mapBits = (mapBits << 1) | ((static_cast<uint8_t>(compressed[bit >> 3]) >>
+                                   (7 - (bit & 7))) & 1);
+   }
+
+   if (mapBits != magic)
+      throw std::runtime_error(name + ": false magic number was not produced");
+
+   // two streams, so that a false magic number is also followed by a real stream
+
+   std::string filename = writeFile(name + ".bz2", compressed + compressed);
+
+   return readAll(filename, 1) == text + text && readAll(filename, 3) == text + text;
+}
+
+//------------------------------------------------------------------------------------
+
+int main(int argc, char *argv[])
+{
+   if (argc != 2)
+   {
+      std::cout << "Usage: " << argv[0]
+	        << " temp_directory"
+		<< std::endl;
+      return 1;
+   }
+
+   tempDirectory = argv[1];
+
+   struct Test
+   {
+      const char *name;
+      uint64_t    magic;
+   };
+
+   const Test tests[] = {
+      { "bzip2_false_block_magic", 0x314159265359ULL },
+      { "bzip2_false_end_magic",   0x177245385090ULL },
+   };
+
+   int numFailed = 0;
+
+   for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++)
+   {
+      std::string result;
+
+      try
+      {
+         result = testFalseMagic(tests[i].name, tests[i].magic) ? "ok" :
+                  "FAILED: wrong data";
+      }
+      catch (const std::runtime_error& error)
+      {
+         result = std::string("FAILED: ") + error.what();
+      }
+
+      if (result != "ok")
+         numFailed++;
+
+      std::cout << tests[i].name << "\t" << result << std::endl;
+   }
+
+   return numFailed > 0 ? 1 : 0;
+}
@@ -10,6 +10,20 @@
 
 #include "genutil.h"
 
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <bzlib.h>
+#include <ctime>
+#include <sys/resource.h>
+#include <thread>
+#include <zlib.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define X86_SIMD // SIMD code is compiled for the target and used if the CPU supports it
+#include <immintrin.h>
+#endif
+
 const std::string chrLongName[NUM_CHROMOSOMES + 1] =
 {
    "",      "chr1",  "chr2",  "chr3",  "chr4",
@@ -348,6 +362,64 @@ std::string Variant::toString() const
    return stream.str();
 }
 
+//------------------------------------------------------------------------------------
+// baseCode() returns the 2-bit code of an uppercase base (0=A, 1=C, 2=G, 3=T), or -1
+// if the character is not A, C, G or T
+
+static int baseCode(char ch)
+{
+   switch (ch)
+   {
+      case 'A': return 0;
+      case 'C': return 1;
+      case 'G': return 2;
+      case 'T': return 3;
+      default:  return -1;
+   }
+}
+
+//------------------------------------------------------------------------------------
+// PackedSnv::PackedSnv(uint8_t, uint32_t, char, char) validates the arguments before
+// packing them
+
+PackedSnv::PackedSnv(uint8_t inChrNumber, uint32_t inPosition, char ref, char alt)
+{
+   int refCode = baseCode(std::toupper(ref));
+   int altCode = baseCode(std::toupper(alt));
+
+   if (inChrNumber < 1 || inChrNumber > NUM_CHROMOSOMES || inPosition < 1 ||
+       inPosition > static_cast<uint32_t>(MAX_PACKED_POSITION) ||
+       refCode < 0 || altCode < 0 || refCode == altCode)
+      throw std::runtime_error("invalid SNV specification");
+
+   bits = static_cast<uint64_t>(inChrNumber) << 32 |
+	  static_cast<uint64_t>(inPosition)  << 4  | refCode << 2 | altCode;
+}
+
+//------------------------------------------------------------------------------------
+// PackedSnv::PackedSnv(const Variant&) packs an SNV; an exception is thrown if the
+// variant is an indel
+
+PackedSnv::PackedSnv(const Variant& v)
+{
+   if (!v.isSubstitution())
+      throw std::runtime_error("cannot pack indel " + v.toString());
+
+   *this = PackedSnv(v.chrNumber, v.position, v.sequence[1], v.sequence[2]);
+}
+
+//------------------------------------------------------------------------------------
+// PackedSnv::toVariant() returns the equivalent Variant object
+
+Variant PackedSnv::toVariant() const
+{
+   std::string sequence = "S";
+   sequence += ref();
+   sequence += alt();
+
+   return Variant(chrNumber(), position(), sequence);
+}
+
 //------------------------------------------------------------------------------------
 // Position::Position(uint8_t, uint32_t) validates the arguments before constructing a
 // Position object
@@ -497,339 +569,734 @@ Chromosome::~Chromosome()
 }
 
 //------------------------------------------------------------------------------------
-// BinaryWriter::BinaryWriter() allocates an internal buffer
+// Arena::allocate() returns memory for the given number of bytes, starting a new
+// block when the current one is too full; a request larger than the block size gets
+// a block of its own
 
-BinaryWriter::BinaryWriter(size_t bufferSize)
-   : fd(-1), bufsize(bufferSize), offset(0), bytesFlushed(0)
+void *Arena::allocate(size_t numBytes)
 {
-   buf = new uint8_t[bufsize];
+   numBytes = (numBytes + 7) & ~static_cast<size_t>(7);
+
+   if (numBytes > available)
+   {
+      size_t size = std::max(numBytes, blockSize);
+
+      block.push_back(new char[size]);
+      used      = 0;
+      available = size;
+   }
+
+   void *p = block.back() + used;
+
+   used      += numBytes;
+   available -= numBytes;
+
+   return p;
 }
 
 //------------------------------------------------------------------------------------
-// BinaryWriter::openFile() creates a new file for writing if newFile is true, and
-// opens an existing file for writing if newFile is false; true is returned if
-// successful
+// Arena::clear() de-allocates all blocks
 
-bool BinaryWriter::openFile(const char *filename, bool newFile)
+void Arena::clear()
 {
-   if (fd != -1) // file is already open
-      return false;
-
-   if (newFile)
-      fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC,
-	        S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-   else
-      fd = open(filename, O_WRONLY);
-
-   if (fd == -1) // error
-      return false;
+   for (size_t i = 0; i < block.size(); i++)
+      delete[] block[i];
 
-   offset       = 0;
-   bytesFlushed = 0;
-   return true;
+   block.clear();
+   used = available = 0;
 }
 
 //------------------------------------------------------------------------------------
-// BinaryWriter::write_buffer() writes a buffer of bytes
+// compareSequence() compares two sequences in the same order as std::string
 
-void BinaryWriter::write_buffer(const void *buffer, size_t numBytes)
+static int compareSequence(const char *a, uint32_t alen, const char *b, uint32_t blen)
 {
-   if (numBytes > bufsize)
-      throw std::runtime_error("binary write buffer is too small");
+   int result = std::memcmp(a, b, std::min(alen, blen));
 
-   if (offset + numBytes > bufsize)
-      flushBuffer();
+   if (result == 0 && alen != blen)
+      result = (alen < blen ? -1 : 1);
 
-   std::memcpy(&buf[offset], buffer, numBytes);
+   return result;
+}
 
-   offset += numBytes;
+//------------------------------------------------------------------------------------
+// entryLess() orders entries by position and then by sequence
+
+static bool entryLess(const VariantStore::Entry& a, const VariantStore::Entry& b)
+{
+   if (a.position != b.position)
+      return (a.position < b.position);
+
+   return (compareSequence(a.sequence, a.length, b.sequence, b.length) < 0);
 }
 
 //------------------------------------------------------------------------------------
-// BinaryWriter::write_string() writes a C-style string, including the trailing null
-// byte
+// entryEqual() returns true if two entries represent the same variant
 
-void BinaryWriter::write_string(const char *string)
+static bool entryEqual(const VariantStore::Entry& a, const VariantStore::Entry& b)
 {
-   write_buffer(string, std::strlen(string) + 1);
+   return (a.position == b.position &&
+	   compareSequence(a.sequence, a.length, b.sequence, b.length) == 0);
 }
 
 //------------------------------------------------------------------------------------
-// BinaryWriter::write_uint8() writes a one-byte integer
+// entryPositionLess() and positionEntryLess() compare an entry with a position
+
+static bool entryPositionLess(const VariantStore::Entry& e, uint32_t position)
+{
+   return (e.position < position);
+}
 
-void BinaryWriter::write_uint8(uint8_t value)
+static bool positionEntryLess(uint32_t position, const VariantStore::Entry& e)
 {
-   write_buffer(&value, 1);
+   return (position < e.position);
 }
 
 //------------------------------------------------------------------------------------
-// BinaryWriter::write_uint16() writes a two-byte integer
+// VariantStore::add() appends a copy of the given variant; sort() must be called
+// before the store is searched
 
-void BinaryWriter::write_uint16(uint16_t value)
+void VariantStore::add(const Variant& v)
 {
-   uint8_t byte[2];
-   byte[0] = static_cast<uint8_t>(value >> 8);
-   byte[1] = static_cast<uint8_t>(value & 0xFF);
+   Entry entry;
+
+   entry.position = v.position;
+   entry.length   = v.sequence.length();
+
+   char *sequence = static_cast<char *>(arena.allocate(entry.length));
+   std::memcpy(sequence, v.sequence.data(), entry.length);
+   entry.sequence = sequence;
 
-   write_buffer(byte, 2);
+   entries[v.chrNumber].push_back(entry);
+   sorted = false;
 }
 
 //------------------------------------------------------------------------------------
-// BinaryWriter::write_uint32() writes a four-byte integer
+// VariantStore::sort() sorts the entries of each chromosome and removes duplicate
+// variants; the sequence of a removed duplicate stays in the arena until clear()
 
-void BinaryWriter::write_uint32(uint32_t value)
+void VariantStore::sort()
 {
-   uint8_t byte[4];
+   for (int chrNumber = 1; chrNumber <= NUM_CHROMOSOMES; chrNumber++)
+   {
+      EntryVector& v = entries[chrNumber];
 
-   for (int i = 0; i < 4; i++)
-      byte[i] = static_cast<uint8_t>((value >> (24 - 8 * i)) & 0xFF);
+      std::sort(v.begin(), v.end(), entryLess);
+      v.erase(std::unique(v.begin(), v.end(), entryEqual), v.end());
+   }
 
-   write_buffer(byte, 4);
+   sorted = true;
 }
 
 //------------------------------------------------------------------------------------
-// BinaryWriter::write_uint64() writes an eight-byte integer
+// VariantStore::size() returns the number of variants in all chromosomes
 
-void BinaryWriter::write_uint64(uint64_t value)
+size_t VariantStore::size() const
 {
-   uint8_t byte[8];
+   size_t total = 0;
 
-   for (int i = 0; i < 8; i++)
-      byte[i] = static_cast<uint8_t>((value >> (56 - 8 * i)) & 0xFF);
+   for (int chrNumber = 1; chrNumber <= NUM_CHROMOSOMES; chrNumber++)
+      total += entries[chrNumber].size();
 
-   write_buffer(byte, 8);
+   return total;
 }
 
 //------------------------------------------------------------------------------------
-// BinaryWriter::write_double() writes a double-precision floating-point value
+// VariantStore::find() returns the entry of the specified variant, or NULL if the
+// variant is not in the store
 
-void BinaryWriter::write_double(double value)
+const VariantStore::Entry *VariantStore::find(uint8_t chrNumber, uint32_t position,
+					     const std::string& sequence) const
 {
-   write_uint64(*(uint64_t *)(&value));
+   std::pair<const Entry *, const Entry *> range = findPosition(chrNumber, position);
+
+   Entry key;
+   key.position = position;
+   key.length   = sequence.length();
+   key.sequence = sequence.data();
+
+   const Entry *p = std::lower_bound(range.first, range.second, key, entryLess);
+
+   return (p != range.second && entryEqual(*p, key) ? p : NULL);
 }
 
 //------------------------------------------------------------------------------------
-// BinaryWriter::flushBuffer() writes the internal buffer to the file
+// VariantStore::findPosition() returns the range of entries at the specified
+// position, which is empty if there are none; an exception is thrown if the store
+// has not been sorted since the last add()
 
-void BinaryWriter::flushBuffer()
+std::pair<const VariantStore::Entry *, const VariantStore::Entry *>
+VariantStore::findPosition(uint8_t chrNumber, uint32_t position) const
 {
-   if (fd == -1)
-      throw std::runtime_error("binary file not open");
+   if (!sorted)
+      throw std::runtime_error("VariantStore searched before sort()");
 
-   if (offset == 0)
-      return; // nothing to flush
+   if (chrNumber < 1 || chrNumber > NUM_CHROMOSOMES || entries[chrNumber].empty())
+      return std::make_pair(static_cast<const Entry *>(NULL),
+			    static_cast<const Entry *>(NULL));
 
-   ssize_t bytes = write(fd, buf, offset);
-   if (bytes != offset)
-      throw std::runtime_error("binary file write error");
+   const Entry *begin = entries[chrNumber].data();
+   const Entry *end   = begin + entries[chrNumber].size();
 
-   offset = 0;
-   bytesFlushed += bytes;
+   begin = std::lower_bound(begin, end, position, entryPositionLess);
+   end   = std::upper_bound(begin, end, position, positionEntryLess);
+
+   return std::make_pair(begin, end);
 }
 
 //------------------------------------------------------------------------------------
-// BinaryWriter::closeFile() writes the internal buffer and closes the file
+// VariantStore::toVariant() returns a Variant object for an entry of the specified
+// chromosome
 
-void BinaryWriter::closeFile()
+Variant VariantStore::toVariant(uint8_t chrNumber, const Entry& entry) const
 {
-   if (fd == -1) // no file is open
-      return;
+   return Variant(chrNumber, entry.position, entry.sequenceString());
+}
 
-   flushBuffer();
+//------------------------------------------------------------------------------------
+// VariantStore::clear() removes all variants and releases the arena in one step
 
-   if (close(fd) == -1)
-      throw std::runtime_error("binary file close error");
+void VariantStore::clear()
+{
+   for (int chrNumber = 1; chrNumber <= NUM_CHROMOSOMES; chrNumber++)
+      EntryVector().swap(entries[chrNumber]);
 
-   fd           = -1;
-   offset       =  0;
-   bytesFlushed =  0;
+   arena.clear();
+   sorted = true;
 }
 
 //------------------------------------------------------------------------------------
-// BinaryReader::BinaryReader() allocates an internal buffer
+// BinaryWriter::BinaryWriter() allocates an internal buffer
 
-BinaryReader::BinaryReader(size_t bufferSize)
-   : fd(-1), bufsize(bufferSize), buflen(0), offset(0)
+BinaryWriter::BinaryWriter(size_t bufferSize)
+   : fd(-1), bufsize(bufferSize), offset(0), bytesFlushed(0)
 {
    buf = new uint8_t[bufsize];
 }
 
 //------------------------------------------------------------------------------------
-// BinaryReader::openFile() opens an existing file for reading; true is returned if
+// BinaryWriter::~BinaryWriter() closes a file left open, as when writing failed,
+// without flushing it, and de-allocates the internal buffer
+
+BinaryWriter::~BinaryWriter()
+{
+   if (fd != -1)
+      close(fd);
+
+   delete[] buf;
+}
+
+//------------------------------------------------------------------------------------
+// BinaryWriter::openFile() creates a new file for writing if newFile is true, and
+// opens an existing file for writing if newFile is false; true is returned if
 // successful
 
-bool BinaryReader::openFile(const char *filename)
+bool BinaryWriter::openFile(const char *filename, bool newFile)
 {
    if (fd != -1) // file is already open
       return false;
 
-   fd = open(filename, O_RDONLY);
+   if (newFile)
+      fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC,
+	        S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+   else
+      fd = open(filename, O_WRONLY);
+
    if (fd == -1) // error
       return false;
 
-   buflen = 0;
-   offset = 0;
+   offset       = 0;
+   bytesFlushed = 0;
    return true;
 }
 
 //------------------------------------------------------------------------------------
-// BinaryReader::seek() performs a seek operation to the specified byte offset from
-// the beginning of the file
+// BinaryWriter::write_buffer() writes a buffer of bytes
 
-void BinaryReader::seek(uint64_t byteOffset)
+void BinaryWriter::write_buffer(const void *buffer, size_t numBytes)
 {
-   if (fd == -1)
-      throw std::runtime_error("binary file not open");
+   if (offset + numBytes > bufsize)
+      flushBuffer();
 
-   if (lseek(fd, byteOffset, SEEK_SET) == -1)
-      throw std::runtime_error("binary file seek error");
+   if (numBytes > bufsize) // too large for the buffer, so write it directly
+   {
+      ssize_t bytes = write(fd, buffer, numBytes);
+      if (bytes != numBytes)
+         throw std::runtime_error("binary file write error");
 
-   buflen = 0;
-   offset = 0;
+      bytesFlushed += bytes;
+      return;
+   }
+
+   std::memcpy(&buf[offset], buffer, numBytes);
+
+   offset += numBytes;
 }
 
 //------------------------------------------------------------------------------------
-// BinaryReader::fillBuffer() reads from the file and puts the bytes read into the
-// internal buffer; false is returned when EOF has been reached
+// BinaryWriter::write_string() writes a C-style string, including the trailing null
+// byte
 
-bool BinaryReader::fillBuffer()
+void BinaryWriter::write_string(const char *string)
+{
+   write_buffer(string, std::strlen(string) + 1);
+}
+
+//------------------------------------------------------------------------------------
+// BinaryWriter::flushBuffer() writes the internal buffer to the file
+
+void BinaryWriter::flushBuffer()
 {
    if (fd == -1)
       throw std::runtime_error("binary file not open");
 
-   ssize_t bytes = read(fd, buf, bufsize);
-   if (bytes == -1)
-      throw std::runtime_error("binary file read error");
+   if (offset == 0)
+      return; // nothing to flush
 
-   if (bytes == 0) // reached EOF
-      return false;
+   ssize_t bytes = write(fd, buf, offset);
+   if (bytes != offset)
+      throw std::runtime_error("binary file write error");
 
-   buflen = bytes;
    offset = 0;
-   return true;
+   bytesFlushed += bytes;
 }
 
 //------------------------------------------------------------------------------------
-// BinaryReader::read_buffer() reads a buffer of bytes; false is returned if EOF is
-// reached before the requested number of bytes has been read
+// BinaryWriter::closeFile() writes the internal buffer and closes the file
 
-bool BinaryReader::read_buffer(uint8_t *buffer, size_t numBytes)
+void BinaryWriter::closeFile()
 {
-   for (int i = 0; i < numBytes; i++)
-   {
-      if (offset >= buflen && !fillBuffer())
-         return false;
+   if (fd == -1) // no file is open
+      return;
 
-      buffer[i] = buf[offset++];
-   }
+   flushBuffer();
 
-   return true;
+   if (close(fd) == -1)
+      throw std::runtime_error("binary file close error");
+
+   fd           = -1;
+   offset       =  0;
+   bytesFlushed =  0;
 }
 
+// BinaryReader::Prefetch holds the thread that reads ahead into a spare buffer; the
+// reader asks for the next read by setting requested, and the thread sets ready when
+// the spare buffer holds the bytes read, which are none at EOF
+
+struct BinaryReader::Prefetch
+{
+   Prefetch(int inFd, size_t size)
+      : fd(inFd), spare(new uint8_t[size]), spareSize(size), spareStart(0), spareEnd(0),
+        nextOffset(0), requested(true), ready(false), stopping(false) { }
+
+   ~Prefetch() { delete[] spare; }
+
+   int                     fd;
+   uint8_t                *spare;
+   size_t                  spareSize, spareStart, spareEnd; // unread bytes of spare
+   uint64_t                nextOffset;                      // file offset of next read
+   bool                    requested, ready, stopping;
+   std::string             error;
+   std::thread             thread;
+   std::mutex              lock;
+   std::condition_variable changed; // signaled when requested or ready is changed
+
+   void run();
+   void waitReady(std::unique_lock<std::mutex>& guard);
+   void request();
+
+   static void runThread(Prefetch *prefetch) { prefetch->run(); }
+};
+
 //------------------------------------------------------------------------------------
-// BinaryReader::read_string() reads a C-style string, copying the characters of the
-// string up to a maximum length or up to and including the trailing null byte; false
-// is returned if EOF is encountered
+// BinaryReader::Prefetch::run() performs requested reads until stopped
 
-bool BinaryReader::read_string(char *string, size_t maxlen)
+void BinaryReader::Prefetch::run()
 {
-   for (int i = 0; i < maxlen; i++)
+   std::unique_lock<std::mutex> guard(lock);
+
+   while (true)
    {
-      uint8_t byte;
-      if (!read_buffer(&byte, 1))
-         return false;
+      while (!requested && !stopping)
+         changed.wait(guard);
 
-      string[i] = static_cast<char>(byte);
-      if (byte == 0)
-         break;
-   }
+      if (stopping)
+         return;
 
-   return true;
+      uint64_t fileOffset = nextOffset;
+
+      guard.unlock();
+      ssize_t bytes = pread(fd, spare, spareSize, fileOffset);
+      guard.lock();
+
+      if (bytes == -1)
+      {
+	 error = "binary file read error";
+	 bytes = 0;
+      }
+
+      totalBytesRead += bytes;
+
+      spareStart  = 0;
+      spareEnd    = bytes;
+      nextOffset += bytes;
+      requested   = false;
+      ready       = true;
+      changed.notify_all();
+   }
 }
 
 //------------------------------------------------------------------------------------
-// BinaryReader::read_uint8() reads a one-byte integer; false is returned if EOF is
-// encountered
+// BinaryReader::Prefetch::waitReady() waits for the spare buffer to be filled; an
+// exception is thrown if the read failed
 
-bool BinaryReader::read_uint8(uint8_t& value)
+void BinaryReader::Prefetch::waitReady(std::unique_lock<std::mutex>& guard)
 {
-   return read_buffer(&value, 1);
+   while (!ready)
+      changed.wait(guard);
+
+   if (error != "")
+      throw std::runtime_error(error);
 }
 
 //------------------------------------------------------------------------------------
-// BinaryReader::read_uint16() reads a two-byte integer; false is returned if EOF is
-// encountered
+// BinaryReader::Prefetch::request() asks the thread for the next read once the spare
+// buffer has been consumed; the lock must be held
 
-bool BinaryReader::read_uint16(uint16_t& value)
+void BinaryReader::Prefetch::request()
 {
-   uint8_t byte[2];
-   if (!read_buffer(byte, 2))
-      return false;
+   ready     = false;
+   requested = true;
+   changed.notify_all();
+}
 
-   value = (byte[0] << 8) + byte[1];
-   return true;
+//------------------------------------------------------------------------------------
+// BinaryReader::BinaryReader() allocates an internal buffer
+
+BinaryReader::BinaryReader(size_t bufferSize)
+   : fd(-1), bufsize(bufferSize), buflen(0), offset(0), internalSize(bufferSize),
+     prefetch(NULL)
+{
+   buf = internalBuf = new uint8_t[bufsize];
 }
 
 //------------------------------------------------------------------------------------
-// BinaryReader::read_uint32() reads a four-byte integer; false is returned if EOF is
-// encountered
+// BinaryReader::~BinaryReader() stops the prefetch thread, unmaps a mapped file,
+// closes a file left open and de-allocates the internal buffer
 
-bool BinaryReader::read_uint32(uint32_t& value)
+BinaryReader::~BinaryReader()
 {
-   uint8_t byte[4];
-   if (!read_buffer(byte, 4))
-      return false;
+   stopPrefetch();
 
-   value = 0;
-   for (int i = 0; i < 4; i++)
-      value = (value << 8) + byte[i];
+   if (isMapped())
+      munmap(buf, buflen);
 
-   return true;
+   if (fd != -1)
+      close(fd);
+
+   delete[] internalBuf;
 }
 
 //------------------------------------------------------------------------------------
-// BinaryReader::read_uint64() reads an eight-byte integer; false is returned if EOF
-// is encountered
+// BinaryReader::openFile() opens an existing file for reading, starting a thread to
+// read ahead if readAhead is true; true is returned if successful
 
-bool BinaryReader::read_uint64(uint64_t& value)
+bool BinaryReader::openFile(const char *filename, bool readAhead)
 {
-   uint8_t byte[8];
-   if (!read_buffer(byte, 8))
+   if (fd != -1) // file is already open
+      return false;
+
+   fd = open(filename, O_RDONLY);
+   if (fd == -1) // error
       return false;
 
-   value = 0;
-   for (int i = 0; i < 8; i++)
-      value = (value << 8) + byte[i];
+   buflen = 0;
+   offset = 0;
+
+   if (readAhead)
+   {
+      prefetch = new Prefetch(fd, bufsize);
+      prefetch->thread = std::thread(Prefetch::runThread, prefetch);
+   }
 
    return true;
 }
 
 //------------------------------------------------------------------------------------
-// BinaryReader::read_double() reads a double-precision floating-point value; false is
-// returned if EOF is encountered
+// BinaryReader::stopPrefetch() stops the prefetch thread, if there is one
 
-bool BinaryReader::read_double(double& value)
+void BinaryReader::stopPrefetch()
 {
-   uint64_t ivalue;
-   if (!read_uint64(ivalue))
-      return false;
+   if (prefetch == NULL)
+      return;
 
-   value = *(double *)(&ivalue);
+   {
+      std::lock_guard<std::mutex> guard(prefetch->lock);
+      prefetch->stopping = true;
+   }
 
-   return true;
+   prefetch->changed.notify_all();
+   prefetch->thread.join();
+
+   delete prefetch;
+   prefetch = NULL;
 }
 
 //------------------------------------------------------------------------------------
-// BinaryReader::skipBytes() skips the specified number of bytes in the input file;
-// false is returned if EOF is encountered
+// BinaryReader::mapFile() opens an existing file for reading and maps all of it into
+// memory, passing the given madvise() advice to the kernel; the mapping is shared, so
+// readers of the same file in any thread use the same pages of the page cache; true
+// is returned if successful, and an empty file is opened without being mapped
 
-bool BinaryReader::skipBytes(size_t numBytes)
+bool BinaryReader::mapFile(const char *filename, int advice)
 {
-   size_t bytesRemaining = (buflen > offset ? buflen - offset : 0);
+   if (!openFile(filename))
+      return false;
 
-   if (numBytes <= bytesRemaining) // all bytes to skip are already in the buffer
-      offset += numBytes;
-   else
+   struct stat info;
+   if (fstat(fd, &info) == -1 || !S_ISREG(info.st_mode))
+   {
+      closeFile();
+      return false;
+   }
+
+   if (info.st_size == 0)
+      return true;
+
+   void *addr = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+   if (addr == MAP_FAILED)
+   {
+      closeFile();
+      return false;
+   }
+
+   madvise(addr, info.st_size, advice); // only a hint, so failure is ignored
+
+   totalBytesRead += info.st_size;
+
+   buf     = static_cast<uint8_t *>(addr);
+   bufsize = buflen = info.st_size;
+   offset  = 0;
+   return true;
+}
+
+//------------------------------------------------------------------------------------
+// BinaryReader::advise() passes madvise() advice for a range of a mapped file, such
+// as MADV_WILLNEED before reading a region; it does nothing if no file is mapped
+
+void BinaryReader::advise(uint64_t byteOffset, uint64_t numBytes, int advice) const
+{
+   if (!isMapped() || byteOffset >= buflen)
+      return;
+
+   uint64_t pageOffset = byteOffset - byteOffset % sysconf(_SC_PAGESIZE);
+   uint64_t end        = std::min(byteOffset + numBytes, static_cast<uint64_t>(buflen));
+
+   madvise(&buf[pageOffset], end - pageOffset, advice); // only a hint
+}
+
+//------------------------------------------------------------------------------------
+// BinaryReader::seek() performs a seek operation to the specified byte offset from
+// the beginning of the file
+
+void BinaryReader::seek(uint64_t byteOffset)
+{
+   if (fd == -1)
+      throw std::runtime_error("binary file not open");
+
+   if (isMapped())
+   {
+      offset = std::min(byteOffset, static_cast<uint64_t>(buflen));
+      return;
+   }
+
+   if (prefetch) // discard the read ahead and read from the new offset instead
+   {
+      std::unique_lock<std::mutex> guard(prefetch->lock);
+
+      while (prefetch->requested)
+         prefetch->changed.wait(guard);
+
+      prefetch->nextOffset = byteOffset;
+      prefetch->error      = ""; // a failed read ahead is discarded with its data
+      prefetch->request();
+
+      buflen = 0;
+      offset = 0;
+      return;
+   }
+
+   if (lseek(fd, byteOffset, SEEK_SET) == -1)
+      throw std::runtime_error("binary file seek error");
+
+   buflen = 0;
+   offset = 0;
+}
+
+//------------------------------------------------------------------------------------
+// BinaryReader::fillBuffer() reads from the file and puts the bytes read into the
+// internal buffer; false is returned when EOF has been reached, which for a mapped
+// file is immediately
+
+bool BinaryReader::fillBuffer()
+{
+   if (fd == -1)
+      throw std::runtime_error("binary file not open");
+
+   if (isMapped()) // the whole file is already in the buffer
+      return false;
+
+   if (prefetch) // take the spare buffer and have the next one read
+   {
+      std::unique_lock<std::mutex> guard(prefetch->lock);
+      prefetch->waitReady(guard);
+
+      size_t bytes = prefetch->spareEnd - prefetch->spareStart;
+      if (bytes == 0) // reached EOF
+         return false;
+
+      if (prefetch->spareStart == 0)
+      {
+         std::swap(internalBuf, prefetch->spare);
+	 buf = internalBuf;
+      }
+      else
+         std::memcpy(buf, &prefetch->spare[prefetch->spareStart], bytes);
+
+      buflen = bytes;
+      offset = 0;
+
+      prefetch->request();
+      return true;
+   }
+
+   ssize_t bytes = read(fd, buf, bufsize);
+   if (bytes == -1)
+      throw std::runtime_error("binary file read error");
+
+   if (bytes == 0) // reached EOF
+      return false;
+
+   totalBytesRead += bytes;
+
+   buflen = bytes;
+   offset = 0;
+   return true;
+}
+
+//------------------------------------------------------------------------------------
+// BinaryReader::refillBuffer() moves the unread bytes to the front of the internal
+// buffer and reads from the file until at least numBytes bytes are unread; false is
+// returned if EOF is reached first or numBytes exceeds the buffer size
+
+bool BinaryReader::refillBuffer(size_t numBytes)
+{
+   if (fd == -1)
+      throw std::runtime_error("binary file not open");
+
+   if (numBytes > bufsize || isMapped())
+      return false;
+
+   size_t unread = (buflen > offset ? buflen - offset : 0);
+
+   std::memmove(buf, &buf[offset], unread);
+   buflen = unread;
+   offset = 0;
+
+   if (prefetch) // append bytes from the spare buffer
+   {
+      std::unique_lock<std::mutex> guard(prefetch->lock);
+
+      while (buflen < numBytes)
+      {
+         prefetch->waitReady(guard);
+
+	 size_t bytes = std::min(prefetch->spareEnd - prefetch->spareStart,
+			         bufsize - buflen);
+	 if (bytes == 0) // reached EOF
+            return false;
+
+         std::memcpy(&buf[buflen], &prefetch->spare[prefetch->spareStart], bytes);
+	 buflen               += bytes;
+	 prefetch->spareStart += bytes;
+
+	 if (prefetch->spareStart == prefetch->spareEnd)
+            prefetch->request();
+      }
+
+      return true;
+   }
+
+   while (buflen < numBytes)
+   {
+      ssize_t bytes = read(fd, &buf[buflen], bufsize - buflen);
+      if (bytes == -1)
+         throw std::runtime_error("binary file read error");
+
+      if (bytes == 0) // reached EOF
+         return false;
+
+      totalBytesRead += bytes;
+      buflen += bytes;
+   }
+
+   return true;
+}
+
+//------------------------------------------------------------------------------------
+// BinaryReader::read_buffer() reads a buffer of bytes; false is returned if EOF is
+// reached before the requested number of bytes has been read
+
+bool BinaryReader::read_buffer(uint8_t *buffer, size_t numBytes)
+{
+   while (numBytes > 0)
+   {
+      if (offset >= buflen && !fillBuffer())
+         return false;
+
+      size_t length = std::min(numBytes, buflen - offset);
+
+      std::memcpy(buffer, &buf[offset], length);
+      offset   += length;
+      buffer   += length;
+      numBytes -= length;
+   }
+
+   return true;
+}
+
+//------------------------------------------------------------------------------------
+// BinaryReader::read_string() reads a C-style string, copying the characters of the
+// string up to a maximum length or up to and including the trailing null byte; false
+// is returned if EOF is encountered
+
+bool BinaryReader::read_string(char *string, size_t maxlen)
+{
+   for (int i = 0; i < maxlen; i++)
+   {
+      uint8_t byte;
+      if (!read_uint8(byte))
+         return false;
+
+      string[i] = static_cast<char>(byte);
+      if (byte == 0)
+         break;
+   }
+
+   return true;
+}
+
+//------------------------------------------------------------------------------------
+// BinaryReader::skipBytes() skips the specified number of bytes in the input file;
+// false is returned if EOF is encountered
+
+bool BinaryReader::skipBytes(size_t numBytes)
+{
+   size_t bytesRemaining = (buflen > offset ? buflen - offset : 0);
+
+   if (numBytes <= bytesRemaining) // all bytes to skip are already in the buffer
+      offset += numBytes;
+   else
    {
       numBytes -= bytesRemaining;
 
@@ -852,194 +1319,2702 @@ bool BinaryReader::skipBytes(size_t numBytes)
 }
 
 //------------------------------------------------------------------------------------
-// BinaryReader::closeFile() closes the file
+// BinaryReader::closeFile() stops the prefetch thread and closes the file, unmapping
+// it if it is mapped
+
+void BinaryReader::closeFile()
+{
+   if (fd == -1) // no file is open
+      return;
+
+   stopPrefetch();
+
+   if (isMapped())
+   {
+      munmap(buf, buflen);
+
+      buf     = internalBuf;
+      bufsize = internalSize;
+   }
+
+   if (close(fd) == -1)
+      throw std::runtime_error("binary file close error");
+
+   fd     = -1;
+   buflen =  0;
+   offset =  0;
+}
+
+//------------------------------------------------------------------------------------
+
+const char digitPairs[201] =
+   "00010203040506070809"
+   "10111213141516171819"
+   "20212223242526272829"
+   "30313233343536373839"
+   "40414243444546474849"
+   "50515253545556575859"
+   "60616263646566676869"
+   "70717273747576777879"
+   "80818283848586878889"
+   "90919293949596979899";
+
+//------------------------------------------------------------------------------------
+// writeAll() writes a buffer to a file descriptor, retrying short writes; false is
+// returned if an error occurs
+
+static bool writeAll(int fd, const char *buffer, size_t numBytes)
+{
+   while (numBytes > 0)
+   {
+      ssize_t bytes = write(fd, buffer, numBytes);
+      if (bytes <= 0)
+         return false;
+
+      buffer   += bytes;
+      numBytes -= bytes;
+   }
+
+   return true;
+}
+
+//------------------------------------------------------------------------------------
+
+struct BackgroundWriter::State
+{
+   State() : stopping(false) { }
+
+   struct Job // one buffer to be written
+   {
+      int         fd;
+      const char *buffer;
+      size_t      numBytes;
+      bool       *pending;
+   };
+
+   std::thread             thread;
+   std::mutex              lock;
+   std::condition_variable queued;  // signaled when a job is queued or on stop
+   std::condition_variable written; // signaled when a job has been written
+   std::deque<Job>         queue;
+   bool                    stopping;
+   std::string             error;
+
+   void run();
+
+   static void runThread(State *state) { state->run(); }
+};
+
+//------------------------------------------------------------------------------------
+// BackgroundWriter::State::run() writes queued buffers in order until stopped
+
+void BackgroundWriter::State::run()
+{
+   std::unique_lock<std::mutex> guard(lock);
+
+   while (true)
+   {
+      while (queue.empty() && !stopping)
+         queued.wait(guard);
+
+      if (queue.empty())
+         return; // stopping and nothing left to write
+
+      Job job = queue.front();
+      queue.pop_front();
+
+      guard.unlock();
+      bool ok = writeAll(job.fd, job.buffer, job.numBytes);
+      guard.lock();
+
+      if (!ok && error == "")
+         error = "text file write error";
+
+      *job.pending = false;
+      written.notify_all();
+   }
+}
+
+//------------------------------------------------------------------------------------
+// BackgroundWriter::BackgroundWriter() starts the writer thread
+
+BackgroundWriter::BackgroundWriter()
+   : state(new State)
+{
+   state->thread = std::thread(State::runThread, state);
+}
+
+//------------------------------------------------------------------------------------
+// BackgroundWriter::~BackgroundWriter() writes any queued buffers and stops the
+// writer thread
+
+BackgroundWriter::~BackgroundWriter()
+{
+   {
+      std::lock_guard<std::mutex> guard(state->lock);
+      state->stopping = true;
+   }
+
+   state->queued.notify_one();
+   state->thread.join();
+
+   delete state;
+}
+
+//------------------------------------------------------------------------------------
+// BackgroundWriter::submit() queues a buffer to be written
+
+void BackgroundWriter::submit(int fd, const char *buffer, size_t numBytes,
+		              bool *pending)
+{
+   State::Job job;
+
+   job.fd       = fd;
+   job.buffer   = buffer;
+   job.numBytes = numBytes;
+   job.pending  = pending;
+
+   {
+      std::lock_guard<std::mutex> guard(state->lock);
+      *pending = true;
+      state->queue.push_back(job);
+   }
+
+   state->queued.notify_one();
+}
+
+//------------------------------------------------------------------------------------
+// BackgroundWriter::wait() waits until a submitted buffer has been written
+
+void BackgroundWriter::wait(const bool *pending)
+{
+   std::unique_lock<std::mutex> guard(state->lock);
+
+   while (*pending)
+      state->written.wait(guard);
+}
+
+//------------------------------------------------------------------------------------
+// BackgroundWriter::checkError() throws an exception if a write has failed
+
+void BackgroundWriter::checkError()
+{
+   std::lock_guard<std::mutex> guard(state->lock);
+
+   if (state->error != "")
+      throw std::runtime_error(state->error);
+}
+
+//------------------------------------------------------------------------------------
+// TextWriter::TextWriter() allocates an internal buffer, or two of them if the
+// buffers are written by a BackgroundWriter
+
+TextWriter::TextWriter(size_t bufferSize, BackgroundWriter *writer)
+   : fd(-1), bufsize(bufferSize), offset(0), bytesFlushed(0), background(writer),
+     container(NULL), section(-1), current(0)
+{
+   buffer[0]  = new char[bufsize];
+   buffer[1]  = (background ? new char[bufsize] : NULL);
+   pending[0] = pending[1] = false;
+
+   buf = buffer[0];
+}
+
+//------------------------------------------------------------------------------------
+// TextWriter::~TextWriter() waits for any buffer still being written, closes a file
+// left open, as when writing failed, without flushing it, and de-allocates the
+// buffers
+
+TextWriter::~TextWriter()
+{
+   if (background)
+   {
+      background->wait(&pending[0]);
+      background->wait(&pending[1]);
+   }
+
+   if (fd != -1 && !container)
+      close(fd);
+
+   delete[] buffer[0];
+   delete[] buffer[1];
+}
+
+//------------------------------------------------------------------------------------
+// TextWriter::openFile() creates a new file for writing; true is returned if
+// successful
+
+bool TextWriter::openFile(const char *filename)
+{
+   if (fd != -1) // file is already open
+      return false;
+
+   fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC,
+	     S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+
+   if (fd == -1) // error
+      return false;
+
+   offset       = 0;
+   bytesFlushed = 0;
+   return true;
+}
+
+//------------------------------------------------------------------------------------
+// TextWriter::openSection() begins a new section of a container file, to which the
+// text will be written; true is returned if successful
+
+bool TextWriter::openSection(ContainerWriter& inContainer, const std::string& name)
+{
+   if (fd != -1 || inContainer.fd == -1)
+      return false;
+
+   fd        = inContainer.fd;
+   container = &inContainer;
+   section   = container->addSection(name);
+
+   offset       = 0;
+   bytesFlushed = 0;
+   return true;
+}
+
+//------------------------------------------------------------------------------------
+// TextWriter::formatFixed() formats a number at p with the given digits (at most 9)
+// after the decimal point, and returns the number of characters; the number is scaled
+// and rounded in double precision, which gives the same digits as printf() unless the
+// scaled number is very close to a rounding tie or is too large, and in those cases
+// snprintf() is used instead
+
+size_t TextWriter::formatFixed(char *p, size_t size, double value, int decimals)
+{
+   static const double scale[10] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8,
+	                             1e9 };
+
+   const double TIE_MARGIN = 1e-6; // exceeds the rounding error of a scaled number
+
+   if (decimals < 0 || decimals > 9)
+      throw std::runtime_error("invalid number of decimals");
+
+   double scaled = value * scale[decimals];
+   double whole  = std::floor(scaled);
+   double frac   = scaled - whole;
+
+   if (!(value >= 0 && scaled < 4e9) || std::fabs(frac - 0.5) < TIE_MARGIN ||
+       size < 22)
+   {
+      int length = std::snprintf(p, size, "%.*f", decimals, value);
+
+      if (length < 0 || length >= size)
+         throw std::runtime_error("text write buffer is too small");
+
+      return length;
+   }
+
+   uint32_t n = static_cast<uint32_t>(whole) + (frac > 0.5 ? 1 : 0);
+   uint32_t divisor = static_cast<uint32_t>(scale[decimals]);
+
+   size_t length = formatUint(p, n / divisor);
+
+   if (decimals > 0)
+   {
+      p[length++] = '.';
+
+      uint32_t fraction = n % divisor;
+
+      for (int i = decimals - 1; i >= 0; i--, fraction /= 10)
+         p[length + i] = static_cast<char>('0' + fraction % 10);
+
+      length += decimals;
+   }
+
+   return length;
+}
+
+//------------------------------------------------------------------------------------
+// TextWriter::flushBuffer() writes the internal buffer to the file; with a
+// BackgroundWriter, the buffer is queued for writing and the other buffer, once it
+// has been written, becomes the internal buffer
+
+void TextWriter::flushBuffer()
+{
+   if (fd == -1)
+      throw std::runtime_error("text file not open");
+
+   if (offset == 0)
+      return; // nothing to flush
+
+   if (container) // the buffer becomes the next chunk of the container
+      container->addChunk(section, offset);
+
+   if (background)
+   {
+      int other = 1 - current;
+
+      background->wait(&pending[other]);
+      background->checkError();
+      background->submit(fd, buf, offset, &pending[current]);
+
+      current = other;
+      buf     = buffer[current];
+   }
+   else if (!writeAll(fd, buf, offset))
+      throw std::runtime_error("text file write error");
+
+   bytesFlushed += offset;
+   offset = 0;
+}
+
+//------------------------------------------------------------------------------------
+// TextWriter::closeFile() writes the internal buffer and closes the file, or ends the
+// section of a container
+
+void TextWriter::closeFile()
+{
+   if (fd == -1) // no file is open
+      return;
+
+   flushBuffer();
+
+   if (background)
+   {
+      background->wait(&pending[0]);
+      background->wait(&pending[1]);
+      background->checkError();
+   }
+
+   if (container) // the container file remains open
+      container = NULL;
+   else if (close(fd) == -1)
+      throw std::runtime_error("text file close error");
+
+   fd           = -1;
+   offset       =  0;
+   bytesFlushed =  0;
+}
+
+//------------------------------------------------------------------------------------
+// put_uint32() and put_uint64() append big-endian integers to a byte vector
+
+static void put_uint32(std::vector<char>& v, uint32_t value)
+{
+   for (int shift = 24; shift >= 0; shift -= 8)
+      v.push_back(static_cast<char>(value >> shift));
+}
+
+static void put_uint64(std::vector<char>& v, uint64_t value)
+{
+   put_uint32(v, static_cast<uint32_t>(value >> 32));
+   put_uint32(v, static_cast<uint32_t>(value));
+}
+
+//------------------------------------------------------------------------------------
+// ContainerWriter::~ContainerWriter() closes a file left open, as when writing failed
+
+ContainerWriter::~ContainerWriter()
+{
+   if (fd != -1)
+      close(fd);
+}
+
+//------------------------------------------------------------------------------------
+// ContainerWriter::openFile() creates a container file and writes its header; true is
+// returned if successful
+
+bool ContainerWriter::openFile(const char *filename)
+{
+   if (fd != -1) // file is already open
+      return false;
+
+   fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC,
+	     S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+
+   if (fd == -1) // error
+      return false;
+
+   std::vector<char> header;
+   put_uint32(header, CONTAINER_MAGIC);
+   put_uint32(header, CONTAINER_VERSION);
+
+   if (!writeAll(fd, &header[0], header.size()))
+      throw std::runtime_error("container file write error");
+
+   endOffset = header.size();
+   section.clear();
+   return true;
+}
+
+//------------------------------------------------------------------------------------
+// ContainerWriter::addSection() adds an empty section and returns its index
+
+int ContainerWriter::addSection(const std::string& name)
+{
+   if (name.length() > 255)
+      throw std::runtime_error("container section name is too long");
+
+   ContainerSection s;
+   s.name = name;
+
+   section.push_back(s);
+   return section.size() - 1;
+}
+
+//------------------------------------------------------------------------------------
+// ContainerWriter::addChunk() records a chunk of a section that is about to be written
+// at the end of the file, and returns its byte offset
+
+uint64_t ContainerWriter::addChunk(int sectionIndex, size_t numBytes)
+{
+   ContainerSection& s = section[sectionIndex];
+
+   s.chunkOffset.push_back(endOffset);
+   s.chunkLength.push_back(numBytes);
+
+   endOffset += numBytes;
+   return s.chunkOffset.back();
+}
+
+//------------------------------------------------------------------------------------
+// ContainerWriter::closeFile() writes the directory and trailer and closes the file;
+// the TextWriters of all sections must be closed first
+
+void ContainerWriter::closeFile()
+{
+   if (fd == -1) // no file is open
+      return;
+
+   std::vector<char> directory;
+
+   put_uint32(directory, section.size());
+
+   for (size_t i = 0; i < section.size(); i++)
+   {
+      const ContainerSection& s = section[i];
+
+      directory.push_back(static_cast<char>(s.name.length()));
+      directory.insert(directory.end(), s.name.begin(), s.name.end());
+
+      put_uint32(directory, s.chunkOffset.size());
+
+      for (size_t j = 0; j < s.chunkOffset.size(); j++)
+      {
+         put_uint64(directory, s.chunkOffset[j]);
+	 put_uint32(directory, s.chunkLength[j]);
+      }
+   }
+
+   put_uint64(directory, endOffset);
+   put_uint32(directory, CONTAINER_MAGIC);
+
+   if (!writeAll(fd, &directory[0], directory.size()))
+      throw std::runtime_error("container file write error");
+
+   if (close(fd) == -1)
+      throw std::runtime_error("container file close error");
+
+   fd        = -1;
+   endOffset =  0;
+   section.clear();
+}
+
+//------------------------------------------------------------------------------------
+// isContainerFile() returns true if the file begins with the magic number of a
+// container file
+
+bool isContainerFile(const char *filename)
+{
+   BinaryReader reader;
+   uint32_t magic;
+
+   if (!reader.openFile(filename))
+      return false;
+
+   bool found = (reader.read_uint32(magic) && magic == CONTAINER_MAGIC);
+
+   reader.closeFile();
+   return found;
+}
+
+//------------------------------------------------------------------------------------
+// ContainerReader::openFile() opens a container file and reads its directory; false
+// is returned if the file cannot be opened, and an exception is thrown if it is not a
+// valid container file
+
+bool ContainerReader::openFile(const char *filename)
+{
+   if (!reader.openFile(filename))
+      return false;
+
+   struct stat info;
+   uint32_t magic, version, numSections;
+   uint64_t directoryOffset;
+
+   if (fstat(reader.fd, &info) == -1 || info.st_size < 20 ||
+       !reader.read_uint32(magic) || magic != CONTAINER_MAGIC ||
+       !reader.read_uint32(version))
+      throw std::runtime_error(std::string(filename) + " is not a container file");
+
+   if (version != CONTAINER_VERSION)
+      throw std::runtime_error("unsupported version of " + std::string(filename));
+
+   reader.seek(info.st_size - 12);
+
+   if (!reader.read_uint64(directoryOffset) || !reader.read_uint32(magic) ||
+       magic != CONTAINER_MAGIC || directoryOffset > info.st_size - 12)
+      throw std::runtime_error(std::string(filename) + " is not a container file");
+
+   reader.seek(directoryOffset);
+
+   if (!reader.read_uint32(numSections))
+      throw std::runtime_error("invalid directory in " + std::string(filename));
+
+   section.resize(numSections);
+
+   for (uint32_t i = 0; i < numSections; i++)
+   {
+      ContainerSection& s = section[i];
+
+      uint8_t  nameLength;
+      uint32_t numChunks;
+      char     name[256];
+
+      if (!reader.read_uint8(nameLength) ||
+	  !reader.read_buffer(reinterpret_cast<uint8_t *>(name), nameLength) ||
+	  !reader.read_uint32(numChunks))
+         throw std::runtime_error("invalid directory in " + std::string(filename));
+
+      s.name.assign(name, nameLength);
+      s.chunkOffset.resize(numChunks);
+      s.chunkLength.resize(numChunks);
+
+      for (uint32_t j = 0; j < numChunks; j++)
+         if (!reader.read_uint64(s.chunkOffset[j]) ||
+	     !reader.read_uint32(s.chunkLength[j]) ||
+	     s.chunkOffset[j] + s.chunkLength[j] > directoryOffset)
+            throw std::runtime_error("invalid directory in " +
+			             std::string(filename));
+   }
+
+   return true;
+}
+
+//------------------------------------------------------------------------------------
+// ContainerReader::readSection() passes back the text of the named section; false is
+// returned if there is no such section
+
+bool ContainerReader::readSection(const std::string& name, std::string& text)
+{
+   text.clear();
+
+   for (size_t i = 0; i < section.size(); i++)
+   {
+      const ContainerSection& s = section[i];
+
+      if (s.name != name)
+         continue;
+
+      for (size_t j = 0; j < s.chunkOffset.size(); j++)
+      {
+         size_t length = text.length();
+	 text.resize(length + s.chunkLength[j]);
+
+	 if (pread(reader.fd, &text[length], s.chunkLength[j], s.chunkOffset[j]) !=
+	     static_cast<ssize_t>(s.chunkLength[j]))
+            throw std::runtime_error("container file read error");
+      }
+
+      return true;
+   }
+
+   return false;
+}
+
+//------------------------------------------------------------------------------------
+// ContainerReader::closeFile() closes the container file
+
+void ContainerReader::closeFile()
+{
+   reader.closeFile();
+   section.clear();
+}
+
+//------------------------------------------------------------------------------------
+// R serialization type codes and flags
+
+const int R_NILVALUE = 254; // end of a pairlist
+const int R_SYMSXP   =   1;
+const int R_LISTSXP  =   2; // pairlist
+const int R_CHARSXP  =   9;
+const int R_INTSXP   =  13;
+const int R_REALSXP  =  14;
+const int R_STRSXP   =  16;
+const int R_VECSXP   =  19; // list
+
+const int R_IS_OBJECT = 1 << 8;
+const int R_HAS_ATTR  = 1 << 9;
+const int R_HAS_TAG   = 1 << 10;
+const int R_ASCII     = 64 << 12; // CHARSXP encoding level
+
+const uint32_t R_NA_INTEGER = 0x80000000;
+
+//------------------------------------------------------------------------------------
+// RdsWriter::openFile() creates the file and writes the serialization header; true is
+// returned if successful
+
+bool RdsWriter::openFile(const char *filename)
+{
+   if (!writer.openFile(filename, true))
+      return false;
+
+   writer.write_uint8('X'); // XDR format
+   writer.write_uint8('\n');
+   writer.write_uint32(2);        // serialization version
+   writer.write_uint32(0x030400); // written as if by R 3.4.0
+   writer.write_uint32(0x020300); // readable by R 2.3.0 and later
+   return true;
+}
+
+//------------------------------------------------------------------------------------
+// RdsWriter::beginDataFrame() writes the header of a list with attributes, which the
+// columns are written into
+
+void RdsWriter::beginDataFrame(int numColumns)
+{
+   writer.write_uint32(R_VECSXP | R_IS_OBJECT | R_HAS_ATTR);
+   writer.write_uint32(numColumns);
+}
+
+//------------------------------------------------------------------------------------
+// RdsWriter::writeIntegerColumn() writes an integer vector
+
+void RdsWriter::writeIntegerColumn(const std::vector<int>& v)
+{
+   writer.write_uint32(R_INTSXP);
+   writer.write_uint32(v.size());
+
+   for (size_t i = 0; i < v.size(); i++)
+      writer.write_uint32(v[i]);
+}
+
+//------------------------------------------------------------------------------------
+// RdsWriter::writeDoubleColumn() writes a double vector; BinaryWriter writes doubles
+// in the IEEE big-endian form that XDR uses
+
+void RdsWriter::writeDoubleColumn(const std::vector<double>& v)
+{
+   writer.write_uint32(R_REALSXP);
+   writer.write_uint32(v.size());
+
+   for (size_t i = 0; i < v.size(); i++)
+      writer.write_double(v[i]);
+}
+
+//------------------------------------------------------------------------------------
+// RdsWriter::writeStringColumn() writes a character vector
+
+void RdsWriter::writeStringColumn(const StringVector& v)
+{
+   writer.write_uint32(R_STRSXP);
+   writer.write_uint32(v.size());
+
+   for (size_t i = 0; i < v.size(); i++)
+      writeString(v[i]);
+}
+
+//------------------------------------------------------------------------------------
+// RdsWriter::endDataFrame() writes the attributes that make the list a data frame:
+// the column names, the class and compact row names
+
+void RdsWriter::endDataFrame(const StringVector& columnNames, int numRows)
+{
+   writer.write_uint32(R_LISTSXP | R_HAS_TAG);
+   writeSymbol("names");
+   writeStringColumn(columnNames);
+
+   writer.write_uint32(R_LISTSXP | R_HAS_TAG);
+   writeSymbol("class");
+   writeStringColumn(StringVector(1, "data.frame"));
+
+   writer.write_uint32(R_LISTSXP | R_HAS_TAG);
+   writeSymbol("row.names");
+   writer.write_uint32(R_INTSXP);
+   writer.write_uint32(2);
+   writer.write_uint32(R_NA_INTEGER); // c(NA, -numRows) means rows 1 to numRows
+   writer.write_uint32(-numRows);
+
+   writer.write_uint32(R_NILVALUE);
+}
+
+//------------------------------------------------------------------------------------
+// RdsWriter::writeString() writes one ASCII string
+
+void RdsWriter::writeString(const std::string& s)
+{
+   writer.write_uint32(R_CHARSXP | R_ASCII);
+   writer.write_uint32(s.length());
+   writer.write_buffer(s.data(), s.length());
+}
+
+//------------------------------------------------------------------------------------
+// RdsWriter::writeSymbol() writes a symbol, such as the tag of an attribute
+
+void RdsWriter::writeSymbol(const std::string& name)
+{
+   writer.write_uint32(R_SYMSXP);
+   writeString(name);
+}
+
+//------------------------------------------------------------------------------------
+// readFully() reads up to numBytes from a file descriptor, retrying short reads; the
+// number of bytes read is returned, which is less than numBytes only at EOF
+
+static size_t readFully(int fd, uint8_t *buffer, size_t numBytes)
+{
+   size_t total = 0;
+
+   while (total < numBytes)
+   {
+      ssize_t bytes = read(fd, buffer + total, numBytes - total);
+      if (bytes == -1)
+         throw std::runtime_error("text file read error");
+
+      if (bytes == 0) // reached EOF
+         break;
+
+      total += bytes;
+   }
+
+   totalBytesRead += total;
+
+   return total;
+}
+
+//------------------------------------------------------------------------------------
+
+class BlockInflater // reads independently compressed blocks and inflates them on a
+                    // pool of threads; the inflated blocks are handed to the consumer
+                    // in file order
+{
+public:
+   BlockInflater(int inFd, const uint8_t *prefix, size_t prefixLen);
+   virtual ~BlockInflater() { stop(); }
+
+   void start(int numThreads);
+   void stop();
+
+   bool nextBlock(std::vector<char>& data);
+
+protected:
+   enum SlotState { EMPTY, INFLATING, DONE };
+
+   struct Slot // holds one block as it passes from reader to worker to consumer
+   {
+      Slot() : numBits(0), state(EMPTY) { }
+
+      std::vector<uint8_t> in;      // compressed block
+      uint64_t             numBits; // bits of the file in a block that is not
+                                    // byte aligned
+      std::vector<char>    out;     // inflated block
+      SlotState            state;
+      std::string          error;
+   };
+
+   // readBlock() is called by one worker at a time; inflateBlock() is called by
+   // several workers at once and must not touch shared state; joinBlocks() is
+   // called for a block that fails to inflate, in case it was split at a false
+   // boundary, and replaces the input of the following block with that of both
+   virtual bool readBlock(Slot& slot) = 0;
+   virtual void inflateBlock(Slot& slot) const = 0;
+   virtual bool joinBlocks(const Slot& first, Slot& second) const { return false; }
+
+   size_t readBytes(uint8_t *buffer, size_t numBytes);
+   void   worker();
+
+   static void runWorker(BlockInflater *inflater) { inflater->worker(); }
+
+   int                  fd;
+   std::vector<uint8_t> pending; // bytes read from fd before this object existed
+   size_t               pendingPos;
+
+   std::vector<Slot>        slot;
+   std::vector<std::thread> thread;
+   std::mutex               mutex;
+   std::condition_variable  changed;
+
+   uint64_t    readSeq, consumeSeq; // sequence numbers of next block to read, consume
+   bool        inputEOF, stopping;
+   std::string readError;
+};
+
+//------------------------------------------------------------------------------------
+// BlockInflater::BlockInflater() saves the bytes already read from the file
+// descriptor while detecting the file format
+
+BlockInflater::BlockInflater(int inFd, const uint8_t *prefix, size_t prefixLen)
+   : fd(inFd), pending(prefix, prefix + prefixLen), pendingPos(0), readSeq(0),
+     consumeSeq(0), inputEOF(false), stopping(false)
+{
+}
+
+//------------------------------------------------------------------------------------
+// BlockInflater::start() starts the worker threads
+
+void BlockInflater::start(int numThreads)
+{
+   slot.resize(4 * numThreads);
+
+   for (int i = 0; i < numThreads; i++)
+      thread.push_back(std::thread(runWorker, this));
+}
+
+//------------------------------------------------------------------------------------
+// BlockInflater::stop() stops and joins the worker threads; it must be called before
+// a derived object is destroyed
+
+void BlockInflater::stop()
+{
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+   }
+
+   changed.notify_all();
+
+   for (size_t i = 0; i < thread.size(); i++)
+      thread[i].join();
+
+   thread.clear();
+}
+
+//------------------------------------------------------------------------------------
+// BlockInflater::readBytes() reads from the pending prefix and then from the file
+// descriptor; the number of bytes read is returned
+
+size_t BlockInflater::readBytes(uint8_t *buffer, size_t numBytes)
+{
+   size_t total = 0;
+
+   while (total < numBytes && pendingPos < pending.size())
+      buffer[total++] = pending[pendingPos++];
+
+   return total + readFully(fd, buffer + total, numBytes - total);
+}
+
+//------------------------------------------------------------------------------------
+// BlockInflater::worker() repeatedly reads the next block into its slot (reading is
+// serialized by the mutex) and then inflates it while other workers read and inflate
+// subsequent blocks
+
+void BlockInflater::worker()
+{
+   std::unique_lock<std::mutex> lock(mutex);
+
+   while (true)
+   {
+      while (!stopping && !inputEOF && slot[readSeq % slot.size()].state != EMPTY)
+         changed.wait(lock);
+
+      if (stopping || inputEOF)
+         break;
+
+      Slot& s = slot[readSeq % slot.size()];
+
+      try
+      {
+         if (!readBlock(s))
+         {
+            inputEOF = true;
+            changed.notify_all();
+            break;
+         }
+      }
+      catch (const std::runtime_error& error)
+      {
+         readError = error.what();
+         inputEOF  = true;
+         changed.notify_all();
+         break;
+      }
+
+      readSeq++;
+      s.state = INFLATING;
+
+      lock.unlock();
+
+      std::string error;
+
+      try
+      {
+         inflateBlock(s);
+      }
+      catch (const std::runtime_error& e)
+      {
+         error = e.what();
+      }
+
+      lock.lock();
+
+      s.error = error;
+      s.state = DONE;
+      changed.notify_all();
+   }
+}
+
+//------------------------------------------------------------------------------------
+// BlockInflater::nextBlock() waits for the next block in file order to be inflated
+// and swaps its data into the caller's vector; a block that fails to inflate is
+// joined with the blocks that follow it until it inflates, or until joinBlocks()
+// gives up; false is returned at EOF
+
+bool BlockInflater::nextBlock(std::vector<char>& data)
+{
+   std::unique_lock<std::mutex> lock(mutex);
+
+   Slot *s = &slot[consumeSeq % slot.size()];
+
+   while (s->state != DONE && !(inputEOF && consumeSeq >= readSeq))
+      changed.wait(lock);
+
+   if (s->state != DONE) // no more blocks
+   {
+      if (readError != "")
+         throw std::runtime_error(readError);
+
+      return false;
+   }
+
+   while (s->error != "")
+   {
+      Slot& next = slot[(consumeSeq + 1) % slot.size()];
+
+      while (next.state != DONE && !(inputEOF && consumeSeq + 1 >= readSeq))
+         changed.wait(lock);
+
+      // no worker touches a slot that is DONE, so the lock is not needed while the
+      // joined block is inflated
+
+      bool haveNext = (next.state == DONE);
+
+      lock.unlock();
+
+      bool joined = haveNext && joinBlocks(*s, next);
+
+      if (joined)
+      {
+         next.error = "";
+
+         try
+         {
+            inflateBlock(next);
+         }
+         catch (const std::runtime_error& error)
+         {
+            next.error = error.what();
+         }
+      }
+
+      lock.lock();
+
+      if (!joined) // a block cut short by the end of a truncated file also fails
+         throw std::runtime_error(!haveNext && readError != "" ? readError :
+                                  s->error);
+
+      s->state = EMPTY;
+      consumeSeq++;
+      changed.notify_all();
+
+      s = &next;
+   }
+
+   data.swap(s->out);
+   s->state = EMPTY;
+   consumeSeq++;
+
+   changed.notify_all();
+   return true;
+}
+
+//------------------------------------------------------------------------------------
+
+class BgzfInflater : public BlockInflater // inflates the blocks of a BGZF file
+{
+public:
+   BgzfInflater(int inFd, const uint8_t *prefix, size_t prefixLen)
+      : BlockInflater(inFd, prefix, prefixLen) { }
+
+protected:
+   virtual bool readBlock(Slot& slot);
+   virtual void inflateBlock(Slot& slot) const;
+};
+
+//------------------------------------------------------------------------------------
+// BgzfInflater::readBlock() reads one complete BGZF block; false is returned at EOF
+
+bool BgzfInflater::readBlock(Slot& s)
+{
+   const size_t HEADER_SIZE = 12; // fixed part of the gzip member header
+
+   std::vector<uint8_t>& block = s.in;
+
+   block.resize(HEADER_SIZE);
+
+   size_t bytes = readBytes(&block[0], HEADER_SIZE);
+   if (bytes == 0)
+      return false; // reached EOF
+
+   if (bytes < HEADER_SIZE || block[0] != 0x1F || block[1] != 0x8B ||
+       block[2] != 8 || (block[3] & 4) == 0)
+      throw std::runtime_error("invalid BGZF block header");
+
+   size_t xlen = block[10] + (block[11] << 8);
+
+   block.resize(HEADER_SIZE + xlen);
+   if (readBytes(&block[HEADER_SIZE], xlen) < xlen)
+      throw std::runtime_error("truncated BGZF file");
+
+   // look for the BC subfield, which gives the total block size minus one
+
+   size_t blockSize = 0;
+
+   for (size_t i = HEADER_SIZE; i + 4 <= HEADER_SIZE + xlen; )
+   {
+      size_t slen = block[i + 2] + (block[i + 3] << 8);
+
+      if (block[i] == 'B' && block[i + 1] == 'C' && slen == 2)
+         blockSize = block[i + 4] + (block[i + 5] << 8) + 1;
+
+      i += 4 + slen;
+   }
+
+   if (blockSize < HEADER_SIZE + xlen + 8)
+      throw std::runtime_error("invalid BGZF block size");
+
+   size_t have = HEADER_SIZE + xlen;
+
+   block.resize(blockSize);
+   if (readBytes(&block[have], blockSize - have) < blockSize - have)
+      throw std::runtime_error("truncated BGZF file");
+
+   return true;
+}
+
+//------------------------------------------------------------------------------------
+// BgzfInflater::inflateBlock() inflates the compressed data of one block and checks
+// its length and CRC against the block footer
+
+void BgzfInflater::inflateBlock(Slot& s) const
+{
+   const std::vector<uint8_t>& in = s.in;
+
+   size_t xlen  = in[10] + (in[11] << 8);
+   size_t start = 12 + xlen;
+   size_t size  = in.size() - start - 8;
+   size_t foot  = in.size() - 8;
+
+   uint32_t crc   = in[foot]     + (in[foot + 1] << 8) + (in[foot + 2] << 16) +
+                    (static_cast<uint32_t>(in[foot + 3]) << 24);
+   uint32_t isize = in[foot + 4] + (in[foot + 5] << 8) + (in[foot + 6] << 16) +
+                    (static_cast<uint32_t>(in[foot + 7]) << 24);
+
+   s.out.resize(isize);
+   if (isize == 0)
+      return; // empty block, such as the EOF marker
+
+   z_stream zs;
+   std::memset(&zs, 0, sizeof(zs));
+
+   if (inflateInit2(&zs, -15) != Z_OK) // raw deflate data
+      throw std::runtime_error("unable to initialize zlib");
+
+   zs.next_in   = const_cast<Bytef *>(&in[start]);
+   zs.avail_in  = size;
+   zs.next_out  = reinterpret_cast<Bytef *>(&s.out[0]);
+   zs.avail_out = isize;
+
+   int status = inflate(&zs, Z_FINISH);
+   uLong total = zs.total_out;
+   inflateEnd(&zs);
+
+   if (status != Z_STREAM_END || total != isize ||
+       crc32(0, reinterpret_cast<const Bytef *>(&s.out[0]), isize) != crc)
+      throw std::runtime_error("corrupt BGZF block");
+}
+
+//------------------------------------------------------------------------------------
+
+class Bzip2Inflater : public BlockInflater // inflates the blocks of a bzip2 file
+{
+public:
+   Bzip2Inflater(int inFd, const uint8_t *prefix, size_t prefixLen)
+      : BlockInflater(inFd, prefix, prefixLen), rawBase(0), bitpos(0),
+        level(0) { }
+
+protected:
+   virtual bool readBlock(Slot& slot);
+   virtual void inflateBlock(Slot& slot) const;
+   virtual bool joinBlocks(const Slot& first, Slot& second) const;
+
+   bool     haveBytes(uint64_t byteOffset);
+   uint64_t getBits(uint64_t bit, int count);
+   bool     findMagic(uint64_t fromBit, uint64_t& foundBit, bool& endOfStream);
+   bool     isStreamEnd(uint64_t endBit);
+   void     skipStreamEnd(uint64_t endBit);
+
+   std::vector<uint8_t> raw;     // compressed bytes not yet handed to a worker
+   uint64_t             rawBase; // file offset of raw[0]
+   uint64_t             bitpos;  // bit offset of the next block in the file, or 0
+                                 // when the next stream header must be read
+   char                 level;   // block size level '1' to '9' of current stream
+};
+
+const uint64_t BZ2_BLOCK_MAGIC = 0x314159265359ULL; // start of each block
+const uint64_t BZ2_END_MAGIC   = 0x177245385090ULL; // end of each stream
+const uint64_t BZ2_MAGIC_MASK  = 0xFFFFFFFFFFFFULL;
+
+//------------------------------------------------------------------------------------
+
+class BitPacker // appends bits to a byte vector, most significant bit first
+{
+public:
+   BitPacker(std::vector<uint8_t>& inOut) : out(inOut), acc(0), accBits(0) { }
+
+   // put() appends the low count bits (at most 56) of value, which must not have
+   // other bits set; flush() pads the last byte with zero bits
+   void put(uint64_t value, int count)
+   {
+      acc = (acc << count) | value;
+      accBits += count;
+
+      while (accBits >= 8)
+      {
+         accBits -= 8;
+         out.push_back(static_cast<uint8_t>(acc >> accBits));
+      }
+   }
+
+   void flush()
+   {
+      if (accBits > 0)
+         out.push_back(static_cast<uint8_t>(acc << (8 - accBits)));
+
+      accBits = 0;
+   }
+
+private:
+   std::vector<uint8_t>& out;
+   uint64_t              acc;     // bits not yet appended are the low accBits
+   int                   accBits;
+};
+
+//------------------------------------------------------------------------------------
+// vectorBits() returns count bits (at most 57) starting at the given bit offset of a
+// byte vector; bits beyond its end are zero
+
+static uint64_t vectorBits(const std::vector<uint8_t>& bytes, uint64_t bit, int count)
+{
+   uint64_t value = 0;
+   uint64_t first = bit >> 3;
+   uint64_t last  = (bit + count - 1) >> 3;
+
+   for (uint64_t i = first; i <= last; i++)
+      value = (value << 8) | (i < bytes.size() ? bytes[i] : 0);
+
+   return (value >> (7 - ((bit + count - 1) & 7))) & ((1ULL << count) - 1);
+}
+
+//------------------------------------------------------------------------------------
+// Bzip2Inflater::haveBytes() reads from the file as needed so that the raw buffer
+// extends through the given file offset; false is returned if EOF comes first
+
+bool Bzip2Inflater::haveBytes(uint64_t byteOffset)
+{
+   const size_t READ_SIZE = 1048576;
+
+   while (rawBase + raw.size() <= byteOffset)
+   {
+      size_t have = raw.size();
+
+      raw.resize(have + READ_SIZE);
+      raw.resize(have + readBytes(&raw[have], READ_SIZE));
+
+      if (raw.size() == have) // reached EOF
+         return false;
+   }
+
+   return true;
+}
+
+//------------------------------------------------------------------------------------
+// Bzip2Inflater::getBits() returns count bits (at most 57) starting at the given bit
+// offset of the file; bits beyond EOF are zero
+
+uint64_t Bzip2Inflater::getBits(uint64_t bit, int count)
+{
+   uint64_t value = 0;
+   uint64_t first = bit >> 3;
+   uint64_t last  = (bit + count - 1) >> 3;
+
+   for (uint64_t i = first; i <= last; i++)
+      value = (value << 8) | (haveBytes(i) ? raw[i - rawBase] : 0);
+
+   return (value >> (7 - ((bit + count - 1) & 7))) & ((1ULL << count) - 1);
+}
+
+//------------------------------------------------------------------------------------
+// Bzip2Inflater::findMagic() searches at every bit offset, starting at fromBit, for
+// the magic number that begins a block or ends a stream; false is returned if
+// neither is found before EOF
+
+bool Bzip2Inflater::findMagic(uint64_t fromBit, uint64_t& foundBit,
+		              bool& endOfStream)
+{
+   uint64_t i = fromBit >> 3; // file offset of the byte being examined
+
+   if (!haveBytes(i + 6)) // the 48 bits at bit offsets 8*i to 8*i+7 need 7 bytes
+      return false;
+
+   uint64_t window = 0; // holds bytes i through i+7
+
+   for (uint64_t j = i; j <= i + 7; j++)
+      window = (window << 8) | (haveBytes(j) ? raw[j - rawBase] : 0);
+
+   while (true)
+   {
+      for (int shift = 0; shift < 8; shift++)
+      {
+         uint64_t value = (window >> (16 - shift)) & BZ2_MAGIC_MASK;
+
+         if ((value == BZ2_BLOCK_MAGIC || value == BZ2_END_MAGIC) &&
+             8 * i + shift >= fromBit)
+         {
+            foundBit    = 8 * i + shift;
+            endOfStream = (value == BZ2_END_MAGIC);
+            return true;
+         }
+      }
+
+      if (!haveBytes(++i + 6))
+         return false;
+
+      window = (window << 8) | (haveBytes(i + 7) ? raw[i + 7 - rawBase] : 0);
+   }
+}
+
+//------------------------------------------------------------------------------------
+// Bzip2Inflater::isStreamEnd() returns true if an end magic number found at the
+// given bit offset is followed by the combined CRC and padding of the stream and
+// then by EOF or another stream; an end magic number found inside a block is not
+
+bool Bzip2Inflater::isStreamEnd(uint64_t endBit)
+{
+   uint64_t next = (endBit + 48 + 32 + 7) >> 3; // file offset of the next stream
+
+   if (!haveBytes(next))
+      return haveBytes(next - 1);
+
+   if (!haveBytes(next + 9) || raw[next - rawBase] != 'B' ||
+       raw[next + 1 - rawBase] != 'Z' || raw[next + 2 - rawBase] != 'h' ||
+       raw[next + 3 - rawBase] < '1' || raw[next + 3 - rawBase] > '9')
+      return false;
+
+   uint64_t magic = getBits(8 * (next + 4), 48);
+
+   return magic == BZ2_BLOCK_MAGIC || magic == BZ2_END_MAGIC;
+}
+
+//------------------------------------------------------------------------------------
+// Bzip2Inflater::readBlock() finds the next block in the file by locating the magic
+// numbers that delimit it, and copies it into a complete single-block bzip2 stream
+// that can be inflated independently; a block magic number that is found inside a
+// block splits it into two blocks that fail to inflate, which joinBlocks() puts
+// back together; false is returned at EOF
+
+bool Bzip2Inflater::readBlock(Slot& s)
+{
+   while (bitpos == 0) // read the header of the next stream, which starts at rawBase
+   {
+      if (!haveBytes(rawBase))
+         return false; // reached EOF
+
+      if (!haveBytes(rawBase + 3) || raw[0] != 'B' || raw[1] != 'Z' ||
+          raw[2] != 'h' || raw[3] < '1' || raw[3] > '9')
+         throw std::runtime_error("invalid bzip2 stream header");
+
+      level = raw[3];
+
+      uint64_t firstBit = 8 * (rawBase + 4);
+      bool     endOfStream;
+
+      if (!findMagic(firstBit, bitpos, endOfStream) || bitpos != firstBit)
+         throw std::runtime_error("corrupt bzip2 stream");
+
+      if (endOfStream) // empty stream
+         skipStreamEnd(bitpos);
+   }
+
+   // the block extends from bitpos to the next magic number
+
+   uint64_t nextBit;
+   bool     endOfStream;
+
+   uint64_t searchBit = bitpos + 48;
+
+   while (true)
+   {
+      if (!findMagic(searchBit, nextBit, endOfStream))
+         throw std::runtime_error("truncated bzip2 file");
+
+      if (!endOfStream || isStreamEnd(nextBit))
+         break;
+
+      searchBit = nextBit + 1; // a false end magic number inside the block
+   }
+
+   uint32_t crc = static_cast<uint32_t>(getBits(bitpos + 48, 32));
+
+   // build a stream holding just this block: header, block bits, end magic and a
+   // combined CRC equal to the block CRC
+
+   s.numBits = nextBit - bitpos;
+
+   s.in.clear();
+   s.in.reserve(4 + (s.numBits + 7) / 8 + 11);
+
+   s.in.push_back('B');
+   s.in.push_back('Z');
+   s.in.push_back('h');
+   s.in.push_back(level);
+
+   BitPacker packer(s.in);
+
+   for (uint64_t bit = bitpos; bit < nextBit; )
+   {
+      int count = static_cast<int>(std::min<uint64_t>(nextBit - bit, 32));
+
+      packer.put(getBits(bit, count), count);
+      bit += count;
+   }
+
+   packer.put(BZ2_END_MAGIC, 48);
+   packer.put(crc, 32);
+   packer.flush();
+
+   // advance past this block, and past the end of the stream if it ends here
+
+   bitpos = nextBit;
+
+   if (endOfStream)
+      skipStreamEnd(nextBit);
+   else
+   {
+      uint64_t keep = bitpos >> 3;
+
+      raw.erase(raw.begin(), raw.begin() + (keep - rawBase));
+      rawBase = keep;
+   }
+
+   return true;
+}
+
+//------------------------------------------------------------------------------------
+// Bzip2Inflater::skipStreamEnd() skips the end magic number and combined CRC of a
+// stream, and the padding to a byte boundary, so that rawBase is the offset of the
+// next stream
+
+void Bzip2Inflater::skipStreamEnd(uint64_t endBit)
+{
+   uint64_t next = (endBit + 48 + 32 + 7) >> 3;
+
+   haveBytes(next);
+   raw.erase(raw.begin(),
+             raw.begin() + std::min<uint64_t>(next - rawBase, raw.size()));
+
+   rawBase = next;
+   bitpos  = 0;
+}
+
+//------------------------------------------------------------------------------------
+// Bzip2Inflater::joinBlocks() replaces the stream built by readBlock() for the
+// second of two consecutive blocks with a stream holding the bits of both, and the
+// CRC of the first; false is returned if the joined block would be longer than any
+// real block, in which case the first block is corrupt rather than split
+
+bool Bzip2Inflater::joinBlocks(const Slot& first, Slot& second) const
+{
+   // a block holds at most 100000 bytes per level, each coded in at most 20 bits,
+   // plus its tables
+
+   uint64_t maxBits = static_cast<uint64_t>(first.in[3] - '0') * 100000 * 20 + 65536;
+
+   if (first.numBits + second.numBits > maxBits)
+      return false;
+
+   std::vector<uint8_t> joined(first.in.begin(), first.in.begin() + 4);
+   BitPacker packer(joined);
+
+   joined.reserve(4 + (first.numBits + second.numBits + 7) / 8 + 11);
+
+   const Slot *part[2] = { &first, &second };
+
+   for (int p = 0; p < 2; p++)
+      for (uint64_t done = 0; done < part[p]->numBits; )
+      {
+         int count = static_cast<int>(std::min<uint64_t>(part[p]->numBits - done, 32));
+
+         packer.put(vectorBits(part[p]->in, 32 + done, count), count);
+         done += count;
+      }
+
+   packer.put(BZ2_END_MAGIC, 48);
+   packer.put(vectorBits(first.in, 32 + 48, 32), 32); // CRC of the first block
+   packer.flush();
+
+   second.in.swap(joined);
+   second.numBits += first.numBits;
+   return true;
+}
+
+//------------------------------------------------------------------------------------
+// Bzip2Inflater::inflateBlock() inflates a single-block stream built by readBlock();
+// libbz2 verifies the block CRC
+
+void Bzip2Inflater::inflateBlock(Slot& s) const
+{
+   bz_stream bz;
+   std::memset(&bz, 0, sizeof(bz));
+
+   if (BZ2_bzDecompressInit(&bz, 0, 0) != BZ_OK)
+      throw std::runtime_error("unable to initialize libbz2");
+
+   s.out.resize(1048576);
+
+   bz.next_in  = reinterpret_cast<char *>(&s.in[0]);
+   bz.avail_in = s.in.size();
+
+   size_t total = 0;
+   int status;
+
+   do
+   {
+      if (total == s.out.size())
+         s.out.resize(2 * s.out.size());
+
+      bz.next_out  = &s.out[total];
+      bz.avail_out = s.out.size() - total;
+
+      status = BZ2_bzDecompress(&bz);
+      total  = s.out.size() - bz.avail_out;
+   }
+   while (status == BZ_OK && (bz.avail_in > 0 || bz.avail_out == 0));
+
+   BZ2_bzDecompressEnd(&bz);
+
+   if (status != BZ_STREAM_END)
+      throw std::runtime_error("corrupt bzip2 block");
+
+   s.out.resize(total);
+}
+
+//------------------------------------------------------------------------------------
+// LineReader::LineReader() allocates an internal buffer; if threads is zero, one
+// thread per processor is used to inflate BGZF and bzip2 blocks
+
+LineReader::LineReader(int threads, size_t bufferSize)
+   : fd(-1), format(PLAIN), numThreads(threads), insize(bufferSize), inlen(0),
+     inpos(0), chunkpos(0), zs(NULL), gzipEnded(false), inflater(NULL),
+     inArchive(false), memberRemaining(0), linesRead(0)
+{
+   if (numThreads <= 0)
+      numThreads = std::thread::hardware_concurrency();
+
+   if (numThreads <= 0)
+      numThreads = 1;
+
+   inbuf = new uint8_t[insize];
+}
+
+//------------------------------------------------------------------------------------
+// LineReader::~LineReader() closes the file and de-allocates the internal buffer
+
+LineReader::~LineReader()
+{
+   closeFile();
+   delete[] inbuf;
+}
+
+//------------------------------------------------------------------------------------
+// LineReader::openFile() opens an existing file (or stdin) for reading and examines
+// its first bytes to determine whether it is plain text, gzip, BGZF or bzip2; a
+// filename that names a member of a tar archive is passed to openArchiveMember();
+// true is returned if successful
+
+bool LineReader::openFile(const char *filename)
+{
+   if (fd != -1) // file is already open
+      return false;
+
+   std::string archiveName, member;
+
+   if (splitArchiveMember(filename, archiveName, member))
+      return openArchiveMember(archiveName.c_str(), member);
+
+   if (std::strcmp(filename, "-") == 0)
+      fd = dup(STDIN_FILENO);
+   else
+      fd = open(filename, O_RDONLY);
+
+   if (fd == -1) // error
+      return false;
+
+   chunk.clear();
+   chunkpos  = 0;
+   inpos     = 0;
+   inlen     = readFully(fd, inbuf, 18); // enough to identify a BGZF header
+   inArchive = false;
+
+   if (inlen >= 4 && inbuf[0] == 'B' && inbuf[1] == 'Z' && inbuf[2] == 'h')
+   {
+      format   = BZIP2;
+      inflater = new Bzip2Inflater(fd, inbuf, inlen);
+      inflater->start(numThreads);
+      inlen    = 0;
+      return true;
+   }
+
+   if (inlen < 2 || inbuf[0] != 0x1F || inbuf[1] != 0x8B)
+   {
+      format = PLAIN;
+      return true;
+   }
+
+   format = GZIP;
+
+   if (inlen == 18 && (inbuf[3] & 4) && inbuf[12] == 'B' && inbuf[13] == 'C')
+   {
+      format   = BGZF;
+      inflater = new BgzfInflater(fd, inbuf, inlen);
+      inflater->start(numThreads);
+      inlen    = 0;
+      return true;
+   }
+
+   zs = new z_stream;
+   std::memset(zs, 0, sizeof(z_stream));
+
+   if (inflateInit2(zs, 15 + 16) != Z_OK) // gzip wrapper
+      throw std::runtime_error("unable to initialize zlib");
+
+   gzipEnded = false;
+
+   return true;
+}
+
+//------------------------------------------------------------------------------------
+// LineReader::openArchiveMember() opens a tar archive (which may be compressed) and
+// reads through it until the header of the given member is found, so that lines are
+// then read from that member only; false is returned if the archive cannot be opened
+// or does not contain the member
+
+bool LineReader::openArchiveMember(const char *archiveName, const std::string& member)
+{
+   const size_t TAR_BLOCK = 512;
+
+   if (!openFile(archiveName))
+      return false;
+
+   std::string longName; // set by a GNU long name header
+
+   while (true)
+   {
+      uint8_t header[TAR_BLOCK];
+
+      if (!readDecoded(header, TAR_BLOCK) || header[0] == 0)
+         break; // reached the end of the archive
+
+      char sizeField[13];
+      std::memcpy(sizeField, &header[124], 12);
+      sizeField[12] = '\0';
+
+      uint64_t size = std::strtoull(sizeField, NULL, 8);
+      char     type = static_cast<char>(header[156]);
+
+      std::string name;
+
+      if (longName != "")
+         name = longName;
+      else
+      {
+         // ustar format splits a long name into a prefix and a name
+         std::string prefix(reinterpret_cast<char *>(&header[345]),
+                            strnlen(reinterpret_cast<char *>(&header[345]), 155));
+
+         name.assign(reinterpret_cast<char *>(header),
+                     strnlen(reinterpret_cast<char *>(header), 100));
+
+         if (prefix != "" && std::memcmp(&header[257], "ustar", 5) == 0)
+            name = prefix + "/" + name;
+      }
+
+      longName = "";
+
+      uint64_t padded = (size + TAR_BLOCK - 1) / TAR_BLOCK * TAR_BLOCK;
+
+      if (type == 'L') // GNU long name of the next member
+      {
+         std::vector<uint8_t> nameBuffer(padded + 1, 0);
+
+         if (padded > 0 && !readDecoded(&nameBuffer[0], padded))
+            break;
+
+         longName = reinterpret_cast<char *>(&nameBuffer[0]);
+         continue;
+      }
+
+      if (name == member && (type == '0' || type == '\0'))
+      {
+         // found it; the member data begins at the current chunk position
+
+         inArchive       = true;
+         memberRemaining = size;
+
+         size_t avail = chunk.size() - chunkpos;
+
+         if (avail > memberRemaining)
+            chunk.resize(chunkpos + memberRemaining);
+
+         memberRemaining -= chunk.size() - chunkpos;
+         return true;
+      }
+
+      // skip the data of this member
+
+      while (padded > 0)
+      {
+         if (chunkpos >= chunk.size() && !decodeChunk())
+            break;
+
+         size_t skip = std::min<uint64_t>(padded, chunk.size() - chunkpos);
+
+         chunkpos += skip;
+         padded   -= skip;
+      }
+   }
+
+   closeFile();
+   return false;
+}
+
+//------------------------------------------------------------------------------------
+// LineReader::readRaw() reads bytes from the internal buffer and then from the file;
+// the number of bytes read is returned
+
+size_t LineReader::readRaw(uint8_t *buffer, size_t numBytes)
+{
+   size_t total = 0;
+
+   if (inpos < inlen)
+   {
+      total = std::min(numBytes, inlen - inpos);
+      std::memmove(buffer, &inbuf[inpos], total);
+      inpos += total;
+   }
+
+   return total + readFully(fd, buffer + total, numBytes - total);
+}
+
+//------------------------------------------------------------------------------------
+// LineReader::nextChunk() replaces the chunk with the next bytes of text from the
+// file, or from the archive member being read; false is returned when EOF has been
+// reached
+
+bool LineReader::nextChunk()
+{
+   if (!inArchive)
+      return decodeChunk();
+
+   if (memberRemaining == 0)
+      return false;
+
+   if (!decodeChunk())
+      throw std::runtime_error("truncated tar archive");
+
+   if (chunk.size() > memberRemaining)
+      chunk.resize(memberRemaining);
+
+   memberRemaining -= chunk.size();
+   return true;
+}
+
+//------------------------------------------------------------------------------------
+// LineReader::readDecoded() copies the next decoded bytes of the file into a buffer;
+// false is returned if EOF is reached first
+
+bool LineReader::readDecoded(uint8_t *buffer, size_t numBytes)
+{
+   while (numBytes > 0)
+   {
+      if (chunkpos >= chunk.size() && !decodeChunk())
+         return false;
+
+      size_t count = std::min(numBytes, chunk.size() - chunkpos);
+
+      std::memcpy(buffer, &chunk[chunkpos], count);
+
+      chunkpos += count;
+      buffer   += count;
+      numBytes -= count;
+   }
+
+   return true;
+}
+
+//------------------------------------------------------------------------------------
+// LineReader::decodeChunk() replaces the chunk with the next decoded bytes of the
+// file; false is returned when EOF has been reached
+
+bool LineReader::decodeChunk()
+{
+   chunkpos = 0;
+
+   if (format == BGZF || format == BZIP2)
+   {
+      while (inflater->nextBlock(chunk))
+         if (chunk.size() > 0)
+            return true;
+
+      chunk.clear();
+      return false;
+   }
+
+   chunk.resize(insize);
+
+   if (format == PLAIN)
+   {
+      chunk.resize(readRaw(reinterpret_cast<uint8_t *>(&chunk[0]), insize));
+      return (chunk.size() > 0);
+   }
+
+   // format is GZIP; inflate until some text is produced, restarting at the beginning
+   // of each member of a multi-member file; the file is truncated if it ends within
+   // a member, and ends after a member if what follows is not another member (such
+   // as the zero padding of a tape block), as with gzip
+
+   zs->next_out  = reinterpret_cast<Bytef *>(&chunk[0]);
+   zs->avail_out = insize;
+
+   while (zs->avail_out == insize)
+   {
+      if (zs->avail_in == 0)
+      {
+         inlen = readRaw(inbuf, insize);
+         inpos = inlen;
+
+         if (inlen == 0) // reached EOF
+         {
+            if (!gzipEnded)
+               throw std::runtime_error("truncated gzip file");
+
+            break;
+         }
+
+         zs->next_in  = inbuf;
+         zs->avail_in = inlen;
+      }
+
+      if (gzipEnded && (zs->next_in[0] != 0x1F ||
+                        (zs->avail_in > 1 && zs->next_in[1] != 0x8B)))
+      {
+         while (inlen > 0) // skip the rest of the file
+            inlen = readRaw(inbuf, insize);
+
+         inpos        = 0;
+         zs->avail_in = 0;
+         break;
+      }
+
+      int status = inflate(zs, Z_NO_FLUSH);
+
+      if (status == Z_STREAM_END)
+      {
+         gzipEnded = true;
+
+         if (inflateReset(zs) != Z_OK)
+            throw std::runtime_error("gzip file inflate error");
+      }
+      else if (status == Z_OK)
+         gzipEnded = false; // within a member
+      else if (status != Z_BUF_ERROR)
+         throw std::runtime_error("corrupt gzip file");
+   }
+
+   chunk.resize(insize - zs->avail_out);
+   return (chunk.size() > 0);
+}
+
+//------------------------------------------------------------------------------------
+// LineReader::readBytes() copies up to numBytes of the next decoded bytes of the file,
+// or of the archive member being read, into a buffer, unchanged; the number of bytes
+// copied is returned, which is zero when EOF has been reached
+
+size_t LineReader::readBytes(char *buffer, size_t numBytes)
+{
+   if (fd == -1)
+      throw std::runtime_error("text file not open");
+
+   size_t total = 0;
+
+   while (total < numBytes)
+   {
+      if (chunkpos >= chunk.size() && !nextChunk())
+         break;
+
+      size_t count = std::min(numBytes - total, chunk.size() - chunkpos);
+
+      std::memcpy(&buffer[total], &chunk[chunkpos], count);
+
+      chunkpos += count;
+      total    += count;
+   }
+
+   return total;
+}
+
+//------------------------------------------------------------------------------------
+// LineReader::getLine() reads the next line of text, excluding the newline; false is
+// returned when EOF has been reached
+
+bool LineReader::getLine(std::string& line)
+{
+   if (fd == -1)
+      throw std::runtime_error("text file not open");
+
+   bool found = false; // true when at least one character of the line has been read
+
+   line.clear();
+
+   while (true)
+   {
+      if (chunkpos >= chunk.size() && !nextChunk())
+      {
+         if (found)
+            linesRead++;
+
+         return found;
+      }
+
+      const char *start = &chunk[chunkpos];
+      size_t      avail = chunk.size() - chunkpos;
+
+      const char *newline = static_cast<const char *>(std::memchr(start, '\n', avail));
+
+      if (newline)
+      {
+         line.append(start, newline - start);
+         chunkpos += newline - start + 1;
+         linesRead++;
+         return true;
+      }
+
+      line.append(start, avail);
+      chunkpos = chunk.size();
+      found    = true;
+   }
+}
+
+//------------------------------------------------------------------------------------
+// LineReader::seek() moves to a byte offset of a plain text file, so that the next
+// line is read from there; false is returned if the file is compressed, is a member
+// of an archive or cannot be repositioned
+
+bool LineReader::seek(uint64_t byteOffset)
+{
+   if (fd == -1 || format != PLAIN || inArchive)
+      return false;
+
+   if (lseek(fd, byteOffset, SEEK_SET) == -1)
+      return false;
+
+   inlen    = 0;
+   inpos    = 0;
+   chunkpos = 0;
+   chunk.clear();
+
+   return true;
+}
+
+//------------------------------------------------------------------------------------
+// LineReader::closeFile() closes the file and stops any inflater threads
+
+void LineReader::closeFile()
+{
+   if (fd == -1) // no file is open
+      return;
+
+   if (inflater)
+   {
+      inflater->stop();
+      delete inflater;
+      inflater = NULL;
+   }
+
+   if (zs)
+   {
+      inflateEnd(zs);
+      delete zs;
+      zs = NULL;
+   }
+
+   close(fd);
+
+   totalLinesRead += linesRead;
+
+   fd        = -1;
+   inlen     =  0;
+   inpos     =  0;
+   chunkpos  =  0;
+   inArchive = false;
+   linesRead =  0;
+   chunk.clear();
+}
+
+//------------------------------------------------------------------------------------
+// splitArchiveMember() determines whether a filename has the form
+// "archive.tar:member" (the archive may be compressed, as in "archive.tar.bz2"), and
+// if so passes back the archive name and member name; a filename that exists as a
+// file is never split
+
+bool splitArchiveMember(const std::string& filename, std::string& archiveName,
+                        std::string& member)
+{
+   size_t tar   = filename.find(".tar");
+   size_t colon = (tar == std::string::npos ? tar : filename.find(':', tar));
+
+   struct stat info;
+
+   if (colon == std::string::npos || stat(filename.c_str(), &info) == 0)
+      return false;
+
+   archiveName = filename.substr(0, colon);
+   member      = filename.substr(colon + 1);
+
+   return (archiveName != "" && member != "");
+}
+
+//------------------------------------------------------------------------------------
+
+std::atomic<uint64_t> totalBytesRead(0);
+std::atomic<uint64_t> totalLinesRead(0);
+
+struct Metrics::State
+{
+   struct Phase
+   {
+      Phase(const std::string& inName)
+         : name(inName), calls(0), wallSeconds(0), cpuSeconds(0) { }
+
+      std::string name;
+      int         calls;
+      double      wallSeconds, cpuSeconds;
+   };
+
+   std::mutex                                       mutex;
+   Timer                                            start;  // when the run began
+   std::vector<Phase>                               phases; // in order of first use
+   std::vector<std::pair<std::string, uint64_t> >   counts; // in order of first use
+};
+
+//------------------------------------------------------------------------------------
+// Metrics::Metrics() notes the starting time of the run
+
+Metrics::Metrics() : state(new State) { }
+
+Metrics::~Metrics()
+{
+   delete state;
+}
+
+//------------------------------------------------------------------------------------
+// Metrics::wallSeconds() returns the elapsed time from an arbitrary starting point
+
+double Metrics::wallSeconds()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+
+   return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+//------------------------------------------------------------------------------------
+// Metrics::cpuSeconds() returns the CPU time used by all threads of the process
+
+double Metrics::cpuSeconds()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+
+   return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+//------------------------------------------------------------------------------------
+// Metrics::addPhase() adds the wall and CPU time since a timer started to a phase
+
+void Metrics::addPhase(const std::string& name, const Timer& timer)
+{
+   Timer now;
+   std::lock_guard<std::mutex> lock(state->mutex);
+
+   size_t i = 0;
+   while (i < state->phases.size() && state->phases[i].name != name)
+      i++;
+
+   if (i == state->phases.size())
+      state->phases.push_back(State::Phase(name));
+
+   state->phases[i].calls++;
+   state->phases[i].wallSeconds += now.wall - timer.wall;
+   state->phases[i].cpuSeconds  += now.cpu  - timer.cpu;
+}
+
+//------------------------------------------------------------------------------------
+// Metrics::addCount() adds to a named counter
+
+void Metrics::addCount(const std::string& name, uint64_t count)
+{
+   std::lock_guard<std::mutex> lock(state->mutex);
+
+   size_t i = 0;
+   while (i < state->counts.size() && state->counts[i].first != name)
+      i++;
+
+   if (i == state->counts.size())
+      state->counts.push_back(std::make_pair(name, 0));
+
+   state->counts[i].second += count;
+}
+
+//------------------------------------------------------------------------------------
+// jsonString() returns a string as a quoted JSON string
+
+static std::string jsonString(const std::string& s)
+{
+   std::string quoted = "\"";
+
+   for (size_t i = 0; i < s.length(); i++)
+      if (s[i] == '"' || s[i] == '\\')
+         quoted += std::string("\\") + s[i];
+      else if (static_cast<unsigned char>(s[i]) < 0x20)
+      {
+         char escape[8];
+         std::sprintf(escape, "\\u%04x", s[i]);
+         quoted += escape;
+      }
+      else
+         quoted += s[i];
+
+   return quoted + "\"";
+}
+
+//------------------------------------------------------------------------------------
+// Metrics::writeFile() writes the report as one JSON object: the program name, the
+// totals of the run, then the phases and counters in the order they were first used
+
+bool Metrics::writeFile(const std::string& filename, const std::string& program)
+{
+   Timer now;
+
+   struct rusage usage;
+   getrusage(RUSAGE_SELF, &usage);
+
+   std::lock_guard<std::mutex> lock(state->mutex);
+
+   FILE *outfile = std::fopen(filename.c_str(), "w");
+   if (!outfile)
+      return false;
+
+   std::fprintf(outfile, "{\n  \"program\": %s,\n", jsonString(program).c_str());
+   std::fprintf(outfile, "  \"wallSeconds\": %.6f,\n", now.wall - state->start.wall);
+   std::fprintf(outfile, "  \"cpuSeconds\": %.6f,\n", now.cpu - state->start.cpu);
+   std::fprintf(outfile, "  \"peakRssKB\": %ld,\n", usage.ru_maxrss);
+   std::fprintf(outfile, "  \"bytesRead\": %llu,\n",
+                static_cast<unsigned long long>(totalBytesRead));
+   std::fprintf(outfile, "  \"linesRead\": %llu,\n",
+                static_cast<unsigned long long>(totalLinesRead));
+
+   std::fprintf(outfile, "  \"phases\": [");
+
+   for (size_t i = 0; i < state->phases.size(); i++)
+   {
+      const State::Phase& phase = state->phases[i];
+
+      std::fprintf(outfile, "%s\n    {\"name\": %s, \"calls\": %d, "
+		   "\"wallSeconds\": %.6f, \"cpuSeconds\": %.6f}",
+		   (i == 0 ? "" : ","), jsonString(phase.name).c_str(), phase.calls,
+		   phase.wallSeconds, phase.cpuSeconds);
+   }
+
+   std::fprintf(outfile, "%s],\n  \"counters\": {",
+                (state->phases.empty() ? "" : "\n  "));
+
+   for (size_t i = 0; i < state->counts.size(); i++)
+      std::fprintf(outfile, "%s\n    %s: %llu", (i == 0 ? "" : ","),
+		   jsonString(state->counts[i].first).c_str(),
+		   static_cast<unsigned long long>(state->counts[i].second));
+
+   std::fprintf(outfile, "%s}\n}\n", (state->counts.empty() ? "" : "\n  "));
+
+   return (std::fclose(outfile) == 0);
+}
+
+//------------------------------------------------------------------------------------
+// swap_uint32() swaps the byte ordering of a four-byte unsigned integer
+
+static uint32_t swap_uint32(uint32_t value)
+{
+   return ((value << 24) + ((value & 0xFF00) << 8) + ((value & 0xFF0000) >> 8) +
+	   (value >> 24));
+}
+
+//------------------------------------------------------------------------------------
+// read_uint32() reads a four-byte unsigned integer from a 2bit file
+
+static uint32_t read_uint32(BinaryReader& reader, bool swapBytes)
+{
+   uint32_t value;
+
+   if (!(swapBytes ? reader.read_le(value) : reader.read_be(value)))
+      throw std::runtime_error("truncated 2bit file");
+
+   return value;
+}
+
+//------------------------------------------------------------------------------------
+// read_uint64() reads an eight-byte unsigned integer from a 2bit file
+
+static uint64_t read_uint64(BinaryReader& reader, bool swapBytes)
+{
+   uint64_t value;
+
+   if (!(swapBytes ? reader.read_le(value) : reader.read_be(value)))
+      throw std::runtime_error("truncated 2bit file");
+
+   return value;
+}
+
+//------------------------------------------------------------------------------------
+// TwoBitTable gives the four bases packed in each byte of 2bit DNA, the first base in
+// the high-order bits
+
+struct TwoBitTable
+{
+   TwoBitTable()
+   {
+      const char symbol[4] = { 'T', 'C', 'A', 'G' };
+
+      for (int byte = 0; byte < 256; byte++)
+         for (int i = 0; i < 4; i++)
+            base[byte][i] = symbol[(byte >> (6 - 2 * i)) & 3];
+   }
+
+   char base[256][4];
+};
+
+static const TwoBitTable twoBitTable;
+
+#ifdef X86_SIMD
+
+//------------------------------------------------------------------------------------
+// decodeTwoBitSsse3() decodes 16 bytes at a time with SSSE3, using a byte shuffle as
+// the table lookup, and returns the number of bytes decoded, a multiple of 16
 
-void BinaryReader::closeFile()
+__attribute__((target("ssse3")))
+static size_t decodeTwoBitSsse3(const uint8_t *byte, size_t numBytes, char *out)
 {
-   if (fd == -1) // no file is open
-      return;
+   const __m128i symbol = _mm_setr_epi8('T', 'C', 'A', 'G', 0, 0, 0, 0,
+				        0, 0, 0, 0, 0, 0, 0, 0);
+   const __m128i mask   = _mm_set1_epi8(3);
 
-   if (close(fd) == -1)
-      throw std::runtime_error("binary file close error");
+   size_t i = 0;
 
-   fd     = -1;
-   buflen =  0;
-   offset =  0;
+   for ( ; i + 16 <= numBytes; i += 16, out += 64)
+   {
+      __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&byte[i]));
+
+      // the first to fourth bases of each byte, as characters
+      __m128i b0 = _mm_shuffle_epi8(symbol, _mm_and_si128(_mm_srli_epi16(x, 6), mask));
+      __m128i b1 = _mm_shuffle_epi8(symbol, _mm_and_si128(_mm_srli_epi16(x, 4), mask));
+      __m128i b2 = _mm_shuffle_epi8(symbol, _mm_and_si128(_mm_srli_epi16(x, 2), mask));
+      __m128i b3 = _mm_shuffle_epi8(symbol, _mm_and_si128(x, mask));
+
+      // interleave them so that the four bases of each byte are adjacent
+      __m128i lo01 = _mm_unpacklo_epi8(b0, b1), hi01 = _mm_unpackhi_epi8(b0, b1);
+      __m128i lo23 = _mm_unpacklo_epi8(b2, b3), hi23 = _mm_unpackhi_epi8(b2, b3);
+
+      __m128i *p = reinterpret_cast<__m128i *>(out);
+      _mm_storeu_si128(p,     _mm_unpacklo_epi16(lo01, lo23));
+      _mm_storeu_si128(p + 1, _mm_unpackhi_epi16(lo01, lo23));
+      _mm_storeu_si128(p + 2, _mm_unpacklo_epi16(hi01, hi23));
+      _mm_storeu_si128(p + 3, _mm_unpackhi_epi16(hi01, hi23));
+   }
+
+   return i;
 }
 
+#endif
+
 //------------------------------------------------------------------------------------
-// swap_uint32() swaps the byte ordering of a four-byte unsigned integer
+// decodeTwoBit() decodes count bases of 2bit DNA into characters, starting with base
+// skip (0 to 3) of the first byte
 
-static uint32_t swap_uint32(uint32_t value)
+static void decodeTwoBit(const uint8_t *byte, uint32_t skip, uint32_t count,
+			 char *out)
 {
-   return ((value << 24) + ((value & 0xFF00) << 8) + ((value & 0xFF0000) >> 8) +
-	   (value >> 24));
-}
+   if (skip > 0 && count > 0) // the first byte is partly used
+   {
+      uint32_t n = std::min(4 - skip, count);
 
-//------------------------------------------------------------------------------------
-// read_uint32() reads a four-byte unsigned integer from a 2bit file
+      std::memcpy(out, &twoBitTable.base[*byte++][skip], n);
+      out   += n;
+      count -= n;
+   }
 
-static uint32_t read_uint32(BinaryReader& reader, bool swapBytes)
-{
-   uint32_t value;
+   size_t wholeBytes = count / 4, i = 0;
 
-   if (!reader.read_uint32(value))
-      throw std::runtime_error("truncated 2bit file");
+#ifdef X86_SIMD
+   static const bool haveSsse3 = __builtin_cpu_supports("ssse3");
+
+   if (haveSsse3)
+      i = decodeTwoBitSsse3(byte, wholeBytes, out);
+#endif
+
+   for ( ; i < wholeBytes; i++)
+      std::memcpy(&out[4 * i], twoBitTable.base[byte[i]], 4);
 
-   return (swapBytes ? swap_uint32(value) : value);
+   if (count % 4 > 0) // the last byte is partly used
+      std::memcpy(&out[4 * wholeBytes], twoBitTable.base[byte[wholeBytes]], count % 4);
 }
 
 //------------------------------------------------------------------------------------
-// ReferenceGenome::ReferenceGenome() extracts a DNA sequence from a 2bit file and
-// stores it in a ReferenceGenome object
-
-ReferenceGenome::ReferenceGenome(const std::string& twobit_filename,
-	                         uint8_t chrNumber, uint32_t beginpos,
-				 uint32_t endpos, std::string chrName)
-{
-   // if no chromosome name specified, validate the specified chromosome number
-   if (chrName == "" && (chrNumber == 0 || chrNumber > NUM_CHROMOSOMES))
-      throw std::runtime_error("invalid chromosome specification");
+// TwoBitFile::TwoBitFile() opens a 2bit file, mapping it if possible, and reads the
+// name table and the header of each sequence into a hash table; the mask blocks are
+// skipped, since only their count is needed
 
-   BinaryReader reader;
+// the index is read with a seek per sequence, so an unmapped file uses a small buffer
+static const size_t TWOBIT_INDEX_BUFFER_SIZE = 65536;
 
-   if (!reader.openFile(twobit_filename.c_str()))
-      throw std::runtime_error("unable to open " + twobit_filename);
+TwoBitFile::TwoBitFile(const std::string& twobit_filename)
+   : filename(twobit_filename), reader(TWOBIT_INDEX_BUFFER_SIZE)
+{
+   if (!reader.mapFile(filename.c_str()) && !reader.openFile(filename.c_str()))
+      throw std::runtime_error("unable to open " + filename);
 
    const uint32_t EXPECTED_SIGNATURE = 0x1A412743;
    uint32_t signature;
 
    if (!reader.read_uint32(signature) || signature != EXPECTED_SIGNATURE &&
        signature != swap_uint32(EXPECTED_SIGNATURE))
-      throw std::runtime_error(twobit_filename + " is not a 2bit file");
+      throw std::runtime_error(filename + " is not a 2bit file");
 
    bool swapBytes = (signature != EXPECTED_SIGNATURE);
 
    uint32_t version  = read_uint32(reader, swapBytes);
-   uint32_t chrCount = read_uint32(reader, swapBytes);
+   uint32_t seqCount = read_uint32(reader, swapBytes);
    uint32_t reserved = read_uint32(reader, swapBytes);
 
-   // get the byte offset of our chromosome
+   if (version > 1)
+      throw std::runtime_error("unsupported 2bit version in " + filename);
+
+   // read the name table; version 1 has 64-bit offsets
 
-   uint32_t chrOffset = 0;
+   std::vector<uint64_t> seqOffset(seqCount);
+   names.reserve(seqCount);
 
-   for (uint32_t i = 0; i < chrCount && chrOffset == 0; i++)
+   for (uint32_t i = 0; i < seqCount; i++)
    {
       uint8_t nameLength, nameBuffer[255];
       if (!reader.read_uint8(nameLength) || 
 	  !reader.read_buffer(nameBuffer, nameLength))
-         throw std::runtime_error("truncated 2bit file " + twobit_filename);
+         throw std::runtime_error("truncated 2bit file " + filename);
+
+      names.push_back(std::string(reinterpret_cast<char *>(nameBuffer), nameLength));
+
+      seqOffset[i] = (version == 1 ? read_uint64(reader, swapBytes) :
+		                     read_uint32(reader, swapBytes));
+   }
+
+   // read the length and unknown regions of each sequence; if a name is repeated,
+   // the first sequence with the name is used
+
+   sequence.reserve(seqCount);
+
+   for (uint32_t i = 0; i < seqCount; i++)
+   {
+      if (sequence.count(names[i]) > 0)
+         continue;
+
+      reader.seek(seqOffset[i]);
+
+      Sequence& seq = sequence[names[i]];
+      seq.numBases = read_uint32(reader, swapBytes);
+
+      uint32_t nBlockCount = read_uint32(reader, swapBytes);
+
+      std::vector<std::pair<uint32_t, uint32_t> > block(nBlockCount);
+
+      for (uint32_t j = 0; j < nBlockCount; j++)
+         block[j].first = read_uint32(reader, swapBytes) + 1; // convert to 1-based
+
+      for (uint32_t j = 0; j < nBlockCount; j++)
+         block[j].second = read_uint32(reader, swapBytes); // the size, for now
+
+      uint32_t maskBlockCount = read_uint32(reader, swapBytes);
+
+      seq.dnaOffset = seqOffset[i] +
+         sizeof(uint32_t) * (2 * static_cast<uint64_t>(nBlockCount) +
+			     2 * static_cast<uint64_t>(maskBlockCount) + 4);
+
+      // keep the unknown regions sorted and merged, so that those overlapping a
+      // region can be found by binary search
+
+      std::sort(block.begin(), block.end());
+
+      for (uint32_t j = 0; j < nBlockCount; j++)
+      {
+         if (block[j].second == 0)
+            continue;
+
+         uint32_t start = block[j].first, stop = start + block[j].second - 1;
+
+         if (!seq.nBlockStop.empty() && start <= seq.nBlockStop.back() + 1)
+            seq.nBlockStop.back() = std::max(seq.nBlockStop.back(), stop); // merge
+         else
+         {
+            seq.nBlockStart.push_back(start);
+	    seq.nBlockStop .push_back(stop);
+         }
+      }
+   }
+}
+
+//------------------------------------------------------------------------------------
+// TwoBitFile::findSequence() returns the index entry of the named sequence, or NULL
+// if the file has no such sequence
+
+const TwoBitFile::Sequence *TwoBitFile::findSequence(const std::string& name) const
+{
+   std::unordered_map<std::string, Sequence>::const_iterator p = sequence.find(name);
+
+   return (p == sequence.end() ? NULL : &p->second);
+}
+
+//------------------------------------------------------------------------------------
+// TwoBitFile::findChromosome() returns the index entry of a chromosome, named as "1"
+// or "chr1", or NULL if the file has neither name
+
+const TwoBitFile::Sequence *TwoBitFile::findChromosome(uint8_t chrNumber) const
+{
+   if (chrNumber == 0 || chrNumber > NUM_CHROMOSOMES)
+      return NULL;
+
+   const Sequence *seq = findSequence(chrShortName[chrNumber]);
+
+   return (seq ? seq : findSequence(chrLongName[chrNumber]));
+}
+
+//------------------------------------------------------------------------------------
+// TwoBitFile::getBytes() returns a pointer to numBytes bytes at the given offset: in
+// the mapping if the file is mapped, and otherwise read into the caller's buffer with
+// a single pread(); NULL is returned if the bytes are not all within the file; it
+// may be called from several threads at once
 
-      uint32_t offset = read_uint32(reader, swapBytes);
+// smaller regions are left to page faults rather than cost an madvise() call
+static const size_t TWOBIT_ADVISE_SIZE = 65536;
 
-      std::string name = "";
-      for (uint32_t j = 0; j < nameLength; j++)
-         name += static_cast<char>(nameBuffer[j]);
+const uint8_t *TwoBitFile::getBytes(uint64_t byteOffset, size_t numBytes,
+		                    std::vector<uint8_t>& buffer) const
+{
+   if (reader.isMapped())
+   {
+      if (numBytes >= TWOBIT_ADVISE_SIZE)
+         reader.advise(byteOffset, numBytes, MADV_WILLNEED);
 
-      if (chrName == "" &&
-          (name == chrShortName[chrNumber] || name == chrLongName[chrNumber]) ||
-	  chrName != "" && name == chrName)
-         chrOffset = offset;
+      return reader.mappedData(byteOffset, numBytes);
    }
 
-   if (chrOffset == 0)
+   buffer.resize(numBytes);
+
+   if (numBytes > 0 &&
+       pread(reader.fd, &buffer[0], numBytes, byteOffset) !=
+          static_cast<ssize_t>(numBytes))
+      return NULL;
+
+   totalBytesRead += numBytes;
+
+   return (numBytes > 0 ? &buffer[0] : NULL);
+}
+
+//------------------------------------------------------------------------------------
+// openTwoBitFile() returns the TwoBitFile for a filename, reading its index only the
+// first time, so that the index is shared by every ReferenceGenome; if the file has
+// since been replaced or modified, its index is read again, and the old TwoBitFile is
+// deleted once no ReferenceGenome holds it
+
+static bool sameFile(const struct stat& a, const struct stat& b)
+{
+   return (a.st_dev == b.st_dev && a.st_ino == b.st_ino && a.st_size == b.st_size &&
+	   a.st_mtim.tv_sec == b.st_mtim.tv_sec && a.st_mtim.tv_nsec == b.st_mtim.tv_nsec);
+}
+
+struct TwoBitCacheEntry
+{
+   TwoBitFilePtr twobit;
+   struct stat   info;
+};
+
+TwoBitFilePtr openTwoBitFile(const std::string& twobit_filename)
+{
+   static std::mutex lock;
+   static std::unordered_map<std::string, TwoBitCacheEntry> cache;
+
+   struct stat info;
+   if (stat(twobit_filename.c_str(), &info) == -1)
+      throw std::runtime_error("unable to open " + twobit_filename);
+
+   std::lock_guard<std::mutex> guard(lock);
+
+   std::unordered_map<std::string, TwoBitCacheEntry>::iterator p =
+      cache.find(twobit_filename);
+
+   if (p != cache.end() && sameFile(p->second.info, info))
+      return p->second.twobit;
+
+   TwoBitCacheEntry entry;
+   entry.twobit = std::make_shared<const TwoBitFile>(twobit_filename);
+   entry.info   = info;
+
+   cache[twobit_filename] = entry;
+   return entry.twobit;
+}
+
+//------------------------------------------------------------------------------------
+// ReferenceGenome::ReferenceGenome() extracts a DNA sequence from a 2bit file and
+// stores it in a ReferenceGenome object, as characters or, if packed is true, as the
+// 2bit file's packed bytes and a list of unknown regions; the file's index is read
+// once and shared through openTwoBitFile()
+
+ReferenceGenome::ReferenceGenome(const std::string& twobit_filename,
+	                         uint8_t chrNumber, uint32_t beginpos,
+				 uint32_t endpos, std::string chrName, bool packed)
+   : sequence(NULL), packedSequence(NULL), packedSkip(0)
+{
+   // validate the chromosome number before any file is opened
+   if (chrName == "" && (chrNumber == 0 || chrNumber > NUM_CHROMOSOMES))
+      throw std::runtime_error("invalid chromosome specification");
+
+   twobit = openTwoBitFile(twobit_filename);
+   load(chrNumber, beginpos, endpos, chrName, packed);
+}
+
+//------------------------------------------------------------------------------------
+// ReferenceGenome::ReferenceGenome() extracts a DNA sequence using an index that the
+// caller has already read
+
+ReferenceGenome::ReferenceGenome(const TwoBitFilePtr& inTwobit, uint8_t chrNumber,
+	                         uint32_t beginpos, uint32_t endpos,
+				 std::string chrName, bool packed)
+   : sequence(NULL), packedSequence(NULL), packedSkip(0), twobit(inTwobit)
+{
+   load(chrNumber, beginpos, endpos, chrName, packed);
+}
+
+//------------------------------------------------------------------------------------
+// ReferenceGenome::load() finds a sequence in the index of the 2bit file, then fetches
+// and stores the selected range of it
+
+void ReferenceGenome::load(uint8_t chrNumber, uint32_t beginpos, uint32_t endpos,
+		           std::string chrName, bool packed)
+{
+   // if no chromosome name specified, validate the specified chromosome number
+   if (chrName == "" && (chrNumber == 0 || chrNumber > NUM_CHROMOSOMES))
+      throw std::runtime_error("invalid chromosome specification");
+
+   if (!twobit)
+      throw std::runtime_error("no 2bit file given");
+
+   const TwoBitFile::Sequence *seq = (chrName == "" ?
+		                      twobit->findChromosome(chrNumber) :
+		                      twobit->findSequence(chrName));
+   if (seq == NULL)
    {
       if (chrName == "")
          chrName = chrShortName[chrNumber];
 
       throw std::runtime_error("chromosome " + chrName + " not found in " +
-		               twobit_filename);
+		               twobit->filename);
    }
 
-   // jump to the chromosome header
-
-   reader.seek(chrOffset);
-   
-   // read the chromosome header
-   
-   uint32_t numBases = read_uint32(reader, swapBytes);
-
    begin = beginpos;
-   end   = (endpos > numBases ? numBases : endpos);
+   end   = (endpos > seq->numBases ? seq->numBases : endpos);
 
    if (begin == 0 || begin > end)
       throw std::runtime_error("invalid begin position");
 
-   sequence = new char[end - begin + 1]; // allocate the internal buffer
+   // allocate the internal buffer; packedCodes() may read 8 bytes past the last
 
-   std::vector<uint32_t> nstart, nstop;
+   if (packed)
+   {
+      packedSequence = new uint8_t[((end - 1) >> 2) - ((begin - 1) >> 2) + 1 + 8]();
+      packedSkip     = (begin - 1) & 3;
+   }
+   else
+      sequence = new char[end - begin + 1];
 
-   uint32_t nBlockCount = read_uint32(reader, swapBytes);
+   // fetch the two-bit sequence data, up to a buffer full at a time if the file is
+   // not mapped, and store it in the internal buffer, as it is or as characters
 
-   for (uint32_t i = 0; i < nBlockCount; i++)
-      nstart.push_back(read_uint32(reader, swapBytes) + 1); // convert to 1-based
+   std::vector<uint8_t> buffer;
 
-   for (uint32_t i = 0; i < nBlockCount; i++)
-      nstop.push_back(nstart[i] + read_uint32(reader, swapBytes) - 1);
+   uint32_t pos = begin;
+   size_t   bytesCopied = 0;
 
-   uint32_t maskBlockCount = read_uint32(reader, swapBytes);
+   while (pos <= end)
+   {
+      size_t numBytes = std::min(static_cast<size_t>(((end - 1) >> 2) -
+						      ((pos - 1) >> 2) + 1),
+				 static_cast<size_t>(DEFAULT_BUFFER_SIZE));
 
-   uint32_t dnaOffset = chrOffset +
-      sizeof(uint32_t) * (2 * nBlockCount + 2 * maskBlockCount + 4);
+      const uint8_t *byte = twobit->getBytes(seq->dnaOffset + ((pos - 1) >> 2),
+		                            numBytes, buffer);
+      if (byte == NULL)
+         throw std::runtime_error("truncated 2bit file " + twobit->filename);
 
-   // jump to the first DNA byte in the selected range
+      // the first byte may hold bases before pos, and the last bases after end
+      uint32_t skip  = (pos - 1) & 3;
+      uint32_t count = std::min(static_cast<uint64_t>(numBytes) * 4 - skip,
+			        static_cast<uint64_t>(end - pos + 1));
 
-   reader.seek(dnaOffset + ((begin - 1) >> 2));
+      if (packed)
+      {
+         std::memcpy(&packedSequence[bytesCopied], byte, numBytes);
+	 bytesCopied += numBytes;
+      }
+      else
+         decodeTwoBit(byte, skip, count, &sequence[pos - begin]);
 
-   // read the two-bit sequence data and store it in the internal buffer as characters
+      pos += count;
+   }
 
-   const char symbol[4] = { 'T', 'C', 'A', 'G' };
+   // now mark the unknown regions in the sequence, or list them if packed; the
+   // index's regions are sorted and disjoint, so the first one that can overlap is
+   // the first ending at or after begin
 
-   uint8_t byte;
-   bool readByte = true;
+   std::vector<uint32_t>::const_iterator p =
+      std::lower_bound(seq->nBlockStop.begin(), seq->nBlockStop.end(), begin);
 
-   for (uint32_t pos = begin; pos <= end; pos++)
+   for (size_t i = p - seq->nBlockStop.begin();
+        i < seq->nBlockStop.size() && seq->nBlockStart[i] <= end; i++)
    {
-      if (readByte && !reader.read_uint8(byte))
-         throw std::runtime_error("truncated 2bit file " + twobit_filename);
+      uint32_t start = std::max(seq->nBlockStart[i], begin);
+      uint32_t stop  = std::min(seq->nBlockStop[i],  end);
+
+      if (packed)
+      {
+         nBlockStart.push_back(start);
+	 nBlockStop .push_back(stop);
+      }
+      else
+         std::memset(&sequence[start - begin], 'N', stop - start + 1); // unknown
+   }
+}
 
-      uint32_t shift = 2 * (3 - ((pos - 1) & 3));
-      uint32_t index = (byte >> shift) & 3;
+//------------------------------------------------------------------------------------
+// ReferenceGenome::isUnknown() returns true if any of the n positions starting at pos
+// is in an unknown region of a packed sequence
 
-      sequence[pos - begin] = symbol[index];
+bool ReferenceGenome::isUnknown(uint32_t pos, uint32_t n) const
+{
+   // the regions are sorted and disjoint, so only the first one ending at or after
+   // pos can overlap
+   std::vector<uint32_t>::const_iterator p =
+      std::lower_bound(nBlockStop.begin(), nBlockStop.end(), pos);
 
-      readByte = (shift == 0);
-   }
+   return (p != nBlockStop.end() &&
+	   nBlockStart[p - nBlockStop.begin()] <= static_cast<uint64_t>(pos) + n - 1);
+}
 
-   // now mark the unknown regions in the sequence
+//------------------------------------------------------------------------------------
+// ReferenceGenome::packedRange() returns true if the n positions starting at pos are
+// all known bases of a packed sequence, so that packedCodes() can be used
 
-   for (uint32_t i = 0; i < nBlockCount; i++)
-      if (nstart[i] <= end && nstop[i] >= begin)
-      {
-         uint32_t start = (nstart[i] < begin ? begin : nstart[i]);
-	 uint32_t stop  = (nstop[i]  > end   ? end   : nstop[i]);
+bool ReferenceGenome::packedRange(uint32_t pos, uint32_t n) const
+{
+   return (packedSequence != NULL && n > 0 && pos >= begin &&
+	   static_cast<uint64_t>(pos) + n - 1 <= end && !isUnknown(pos, n));
+}
 
-	 for (uint32_t pos = start; pos <= stop; pos++)
-            sequence[pos - begin] = 'N'; // unknown position
-      }
+//------------------------------------------------------------------------------------
+// ReferenceGenome::packedCodes() returns the 2-bit codes of the n bases (1 to 32)
+// starting at pos, the first base in the high-order bits
 
-   reader.closeFile();
+uint64_t ReferenceGenome::packedCodes(uint32_t pos, uint32_t n) const
+{
+   uint32_t i = pos - begin + packedSkip;
+   const uint8_t *p = &packedSequence[i >> 2];
+
+   uint64_t word  = loadBigEndian<uint64_t>(p);
+   uint32_t shift = 2 * (i & 3);
+
+   if (shift > 0)
+      word = (word << shift) | (p[8] >> (8 - shift));
+
+   return word >> (64 - 2 * n);
 }
 
 //------------------------------------------------------------------------------------
-// ReferenceGenome::getBase() returns the nucleotide (A, C, G, T or N) at the
-// specified position
+// twoBitCode() returns the 2-bit code of a base as in a 2bit file, or -1 if the
+// character is not T, C, A or G
 
-char ReferenceGenome::getBase(uint32_t pos) const
+static int twoBitCode(char ch)
 {
-   if (pos < begin || pos > end)
-      return 'N';
-   else
-      return sequence[pos - begin];
+   switch (ch)
+   {
+      case 'T': return 0;
+      case 'C': return 1;
+      case 'A': return 2;
+      case 'G': return 3;
+      default:  return -1;
+   }
 }
 
 //------------------------------------------------------------------------------------
-// ReferenceGenome::validDeletion() returns true if the given deletion has a sequence
-// that matches the reference genome
+// ReferenceGenome::matchSequence() returns true if the n bases starting at pos are
+// the characters of seq; packed bases are compared up to 32 at a time
 
-bool ReferenceGenome::validDeletion(uint32_t pos, const std::string& seq) const
+bool ReferenceGenome::matchSequence(uint32_t pos, const char *seq, uint32_t n) const
 {
-   uint32_t n = seq.length();
+   if (packedRange(pos, n))
+   {
+      for (uint32_t i = 0; i < n; i += 32)
+      {
+         uint32_t count = std::min(n - i, static_cast<uint32_t>(32));
+	 uint64_t codes = 0;
+
+	 for (uint32_t j = 0; j < count; j++)
+	 {
+            int code = twoBitCode(seq[i + j]);
+	    if (code < 0)
+               return false;
+
+	    codes = (codes << 2) | code;
+	 }
+
+	 if (codes != packedCodes(pos + i, count))
+            return false;
+      }
+
+      return true;
+   }
+
+   if (sequence && n > 0 && pos >= begin && static_cast<uint64_t>(pos) + n - 1 <= end)
+      return (std::memcmp(&sequence[pos - begin], seq, n) == 0);
 
    for (uint32_t i = 0; i < n; i++)
       if (seq[i] != getBase(pos + i))
@@ -1048,6 +4023,45 @@ bool ReferenceGenome::validDeletion(uint32_t pos, const std::string& seq) const
    return true;
 }
 
+//------------------------------------------------------------------------------------
+// ReferenceGenome::matchGenome() returns true if the n bases starting at pos1 are the
+// same as the n bases starting at pos2; packed bases are compared up to 32 at a time
+
+bool ReferenceGenome::matchGenome(uint32_t pos1, uint32_t pos2, uint32_t n) const
+{
+   if (packedRange(pos1, n) && packedRange(pos2, n))
+   {
+      for (uint32_t i = 0; i < n; i += 32)
+      {
+         uint32_t count = std::min(n - i, static_cast<uint32_t>(32));
+
+	 if (packedCodes(pos1 + i, count) != packedCodes(pos2 + i, count))
+            return false;
+      }
+
+      return true;
+   }
+
+   if (sequence && n > 0 && std::min(pos1, pos2) >= begin &&
+       static_cast<uint64_t>(std::max(pos1, pos2)) + n - 1 <= end)
+      return (std::memcmp(&sequence[pos1 - begin], &sequence[pos2 - begin], n) == 0);
+
+   for (uint32_t i = 0; i < n; i++)
+      if (getBase(pos1 + i) != getBase(pos2 + i))
+         return false;
+
+   return true;
+}
+
+//------------------------------------------------------------------------------------
+// ReferenceGenome::validDeletion() returns true if the given deletion has a sequence
+// that matches the reference genome
+
+bool ReferenceGenome::validDeletion(uint32_t pos, const std::string& seq) const
+{
+   return matchSequence(pos, seq.data(), seq.length());
+}
+
 //------------------------------------------------------------------------------------
 // ReferenceGenome::equivalentInsertions() returns true if two insertions are
 // equivalent; it uses the algorithms given in S.V. Rice, "Determining Whether Two
@@ -1083,48 +4097,20 @@ bool ReferenceGenome::equivalentInsertions(uint32_t pos1, const std::string& seq
    uint32_t m = k - j;
    uint32_t n = seq1.length();
 
-   uint32_t vindex, windex, sindex;
-
-   if (m < n)
-   {
-      for (vindex = 0, windex = n - m, sindex = j + 1;
-	   vindex < m; vindex++, windex++, sindex++)
-         if (v[vindex] != w[windex] || v[vindex] != getBase(sindex))
-            return false;
-
-      for (vindex = m, windex = 0; vindex < n; vindex++, windex++)
-         if (v[vindex] != w[windex])
-            return false;
-
-      return true;
-   }
-
-   if (m == n)
-   {
-      for (vindex = 0, windex = 0, sindex = j + 1;
-	   vindex < n; vindex++, windex++, sindex++)
-         if (v[vindex] != w[windex] || v[vindex] != getBase(sindex))
-            return false;
-
-      return true;
-   }
-
-   // m > n
-
-   for (vindex = 0, sindex = j + 1; vindex < n; vindex++, sindex++)
-      if (v[vindex] != getBase(sindex))
-         return false;
+   if (m < n) // v[0..m) = w[n-m..n) = reference, and v[m..n) = w[0..n-m)
+      return (v.compare(0, m, w, n - m, m) == 0 &&
+	      matchSequence(j + 1, v.data(), m) &&
+	      v.compare(m, n - m, w, 0, n - m) == 0);
 
-   for (windex = 0, sindex = k - n + 1; windex < n; windex++, sindex++)
-      if (w[windex] != getBase(sindex))
-         return false;
+   if (m == n) // v = w = reference
+      return (v == w && matchSequence(j + 1, v.data(), n));
 
-   uint32_t last = k - n;
-   for (sindex = j + 1; sindex <= last; sindex++)
-      if (getBase(sindex) != getBase(sindex + n))
-         return false;
+   // m > n: v and w match the reference at their ends, and the reference between
+   // them repeats with period n
 
-   return true;
+   return (matchSequence(j + 1, v.data(), n) &&
+	   matchSequence(k - n + 1, w.data(), n) &&
+	   matchGenome(j + 1, j + 1 + n, k - n - j));
 }
 
 //------------------------------------------------------------------------------------
@@ -1158,11 +4144,8 @@ bool ReferenceGenome::equivalentDeletions(uint32_t pos1, const std::string& seq1
 
    uint32_t n = seq1.length();
 
-   for (uint32_t sindex = j; sindex < k; sindex++)
-      if (getBase(sindex) != getBase(sindex + n))
-         return false;
-
-   return true;
+   // the reference from j to k - 1 must repeat n positions later
+   return matchGenome(j, j + n, k - j);
 }
 
 //------------------------------------------------------------------------------------
@@ -1171,45 +4154,7 @@ bool ReferenceGenome::equivalentDeletions(uint32_t pos1, const std::string& seq1
 
 StringVector *getChromosomeNames(const std::string& twobit_filename)
 {
-   BinaryReader reader;
-
-   if (!reader.openFile(twobit_filename.c_str()))
-      throw std::runtime_error("unable to open " + twobit_filename);
-
-   const uint32_t EXPECTED_SIGNATURE = 0x1A412743;
-   uint32_t signature;
-
-   if (!reader.read_uint32(signature) || signature != EXPECTED_SIGNATURE &&
-       signature != swap_uint32(EXPECTED_SIGNATURE))
-      throw std::runtime_error(twobit_filename + " is not a 2bit file");
-
-   bool swapBytes = (signature != EXPECTED_SIGNATURE);
-
-   uint32_t version  = read_uint32(reader, swapBytes);
-   uint32_t chrCount = read_uint32(reader, swapBytes);
-   uint32_t reserved = read_uint32(reader, swapBytes);
-
-   StringVector *chrName = new StringVector();
-
-   for (uint32_t i = 0; i < chrCount; i++)
-   {
-      uint8_t nameLength, nameBuffer[255];
-      if (!reader.read_uint8(nameLength) || 
-	  !reader.read_buffer(nameBuffer, nameLength))
-         throw std::runtime_error("truncated 2bit file " + twobit_filename);
-
-      uint32_t offset = read_uint32(reader, swapBytes);
-
-      std::string name = "";
-      for (uint32_t j = 0; j < nameLength; j++)
-         name += static_cast<char>(nameBuffer[j]);
-
-      chrName->push_back(name);
-   }
-
-   reader.closeFile();
-
-   return chrName;
+   return new StringVector(openTwoBitFile(twobit_filename)->names);
 }
 
 //------------------------------------------------------------------------------------
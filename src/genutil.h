@@ -14,6 +14,7 @@
 #define _FILE_OFFSET_BITS 64
 
 #include <algorithm>
+#include <atomic>
 #include <cctype>
 #include <cmath>
 #include <cstdint>
@@ -23,11 +24,15 @@
 #include <fstream>
 #include <iostream>
 #include <map>
+#include <memory>
 #include <set>
 #include <sstream>
+#include <sys/mman.h>
 #include <stdexcept>
 #include <string>
 #include <sys/stat.h>
+#include <type_traits>
+#include <unordered_map>
 #include <unistd.h>
 #include <vector>
 
@@ -92,6 +97,54 @@ typedef std::map<std::string, Variant *> VariantMap; // key is sequence
 
 //------------------------------------------------------------------------------------
 
+const int MAX_PACKED_POSITION = (1 << 28) - 1; // max position of a PackedSnv
+
+class PackedSnv // an SNV packed into 64 bits, ordered by chromosome, position, ref
+                // and alt; bits 32-36 hold the chromosome, bits 4-31 the position,
+                // bits 2-3 the ref and bits 0-1 the alt (0=A, 1=C, 2=G, 3=T)
+{
+public:
+   PackedSnv() : bits(0) { }
+   PackedSnv(uint8_t inChrNumber, uint32_t inPosition, char ref, char alt);
+   explicit PackedSnv(const Variant& v);
+
+   uint8_t  chrNumber() const { return static_cast<uint8_t>(bits >> 32); }
+   uint32_t position()  const { return static_cast<uint32_t>(bits >> 4) & 0xFFFFFFF; }
+   char     ref()       const { return "ACGT"[(bits >> 2) & 3]; }
+   char     alt()       const { return "ACGT"[bits & 3]; }
+
+   Variant     toVariant() const;
+   std::string toString()  const { return toVariant().toString(); }
+
+   bool operator==(const PackedSnv& other) const { return bits == other.bits; }
+   bool operator!=(const PackedSnv& other) const { return bits != other.bits; }
+   bool operator< (const PackedSnv& other) const { return bits <  other.bits; }
+   bool operator> (const PackedSnv& other) const { return bits >  other.bits; }
+   bool operator<=(const PackedSnv& other) const { return bits <= other.bits; }
+   bool operator>=(const PackedSnv& other) const { return bits >= other.bits; }
+
+   uint64_t bits;
+};
+
+static_assert(sizeof(PackedSnv) == 8 && std::is_trivially_copyable<PackedSnv>::value,
+	      "PackedSnv must be a trivially copyable 64-bit value");
+
+typedef std::vector<PackedSnv> PackedSnvVector; // sort to use with binary search
+
+namespace std
+{
+   template<> struct hash<PackedSnv> // for unordered containers of PackedSnv
+   {
+      size_t operator()(const PackedSnv& snv) const
+      {
+	 uint64_t h = snv.bits * 0x9E3779B97F4A7C15ULL; // Fibonacci hashing
+	 return static_cast<size_t>(h ^ (h >> 32));
+      }
+   };
+}
+
+//------------------------------------------------------------------------------------
+
 class Position // represents a position within a chromosome
 {
 public:
@@ -128,23 +181,151 @@ public:
 
 //------------------------------------------------------------------------------------
 
-class BinaryWriter // for writing a binary file
+class Arena // bump allocator that hands out memory from large blocks; the memory is
+            // released only when the arena is cleared or destroyed
+{
+public:
+   Arena(size_t inBlockSize=DEFAULT_BUFFER_SIZE)
+      : blockSize(inBlockSize), used(0), available(0) { }
+
+   virtual ~Arena() { clear(); }
+
+   virtual void *allocate(size_t numBytes); // aligned to 8 bytes
+   virtual void  clear();
+
+   std::vector<char *> block;
+   size_t              blockSize, used, available;
+
+private:
+   Arena(const Arena&);            // not copyable
+   Arena& operator=(const Arena&);
+};
+
+//------------------------------------------------------------------------------------
+
+class VariantStore // alternative to Chromosome/Position/Variant objects for a large
+                   // variant catalog: the variants of each chromosome are kept in a
+                   // flat array sorted by position and sequence, and their sequences
+                   // are copied into an arena
+{
+public:
+   struct Entry // one variant; 16 bytes with no allocation of its own
+   {
+      uint32_t    position;
+      uint32_t    length;   // length of sequence
+      const char *sequence; // "Ialt", "Dref", or "Srefalt", not null-terminated
+
+      std::string sequenceString() const { return std::string(sequence, length); }
+   };
+
+   typedef std::vector<Entry> EntryVector;
+
+   VariantStore() : sorted(true) { }
+   virtual ~VariantStore() { }
+
+   virtual void add(const Variant& v);
+   virtual void sort();
+
+   virtual size_t size() const;
+
+   virtual const Entry *find(uint8_t chrNumber, uint32_t position,
+			     const std::string& sequence) const;
+
+   virtual std::pair<const Entry *, const Entry *> findPosition(uint8_t chrNumber,
+							     uint32_t position) const;
+
+   virtual Variant toVariant(uint8_t chrNumber, const Entry& entry) const;
+
+   virtual void clear();
+
+   EntryVector entries[NUM_CHROMOSOMES + 1]; // indexed by chromosome number
+   Arena       arena;
+   bool        sorted; // false after add() until sort() is called
+};
+
+//------------------------------------------------------------------------------------
+
+// loadBigEndian(), loadLittleEndian(), storeBigEndian() and storeLittleEndian()
+// convert between unsigned integers and their bytes in the given order
+
+template<typename T> inline T loadBigEndian(const uint8_t *p)
+{
+   T value = 0;
+   for (size_t i = 0; i < sizeof(T); i++)
+      value = static_cast<T>(value << 8 | p[i]);
+
+   return value;
+}
+
+template<typename T> inline T loadLittleEndian(const uint8_t *p)
+{
+   T value = 0;
+   for (size_t i = sizeof(T); i > 0; i--)
+      value = static_cast<T>(value << 8 | p[i - 1]);
+
+   return value;
+}
+
+template<typename T> inline void storeBigEndian(uint8_t *p, T value)
+{
+   for (size_t i = sizeof(T); i > 0; i--, value >>= 8)
+      p[i - 1] = static_cast<uint8_t>(value);
+}
+
+template<typename T> inline void storeLittleEndian(uint8_t *p, T value)
+{
+   for (size_t i = 0; i < sizeof(T); i++, value >>= 8)
+      p[i] = static_cast<uint8_t>(value);
+}
+
+//------------------------------------------------------------------------------------
+
+class BinaryWriter // for writing a binary file; integers are big-endian unless
+                   // written with write_le()
 {
 public:
    BinaryWriter(size_t bufferSize=DEFAULT_BUFFER_SIZE);
-   virtual ~BinaryWriter() { delete[] buf; }
+   virtual ~BinaryWriter();
 
    virtual bool openFile(const char *filename, bool newFile);
    virtual void write_buffer(const void *buffer, size_t numBytes);
    virtual void write_string(const char *string);
-   virtual void write_uint8 (uint8_t  value);
-   virtual void write_uint16(uint16_t value);
-   virtual void write_uint32(uint32_t value);
-   virtual void write_uint64(uint64_t value);
-   virtual void write_double(double value);
    virtual void flushBuffer();
    virtual void closeFile();
 
+   // the fixed-width write functions are inline and flush only when the buffer is
+   // nearly full
+
+   template<typename T> void write_be(T value)
+   {
+      if (offset + sizeof(T) > bufsize)
+         flushBuffer();
+
+      storeBigEndian(&buf[offset], value);
+      offset += sizeof(T);
+   }
+
+   template<typename T> void write_le(T value)
+   {
+      if (offset + sizeof(T) > bufsize)
+         flushBuffer();
+
+      storeLittleEndian(&buf[offset], value);
+      offset += sizeof(T);
+   }
+
+   void write_uint8 (uint8_t  value) { write_be(value); }
+   void write_uint16(uint16_t value) { write_be(value); }
+   void write_uint32(uint32_t value) { write_be(value); }
+   void write_uint64(uint64_t value) { write_be(value); }
+
+   void write_double(double value)
+   {
+      uint64_t bits;
+      std::memcpy(&bits, &value, sizeof(bits));
+      write_be(bits);
+   }
+
    virtual uint64_t bytesWritten() const { return bytesFlushed + offset; }
 
    int       fd;
@@ -155,41 +336,494 @@ public:
 
 //------------------------------------------------------------------------------------
 
-class BinaryReader // for reading a binary file
+class BinaryReader // for reading a binary file; integers are big-endian unless read
+                   // with read_le(); a file opened with mapFile() is memory-mapped
+                   // and serves as the buffer, so reads and seeks make no syscalls;
+                   // a file opened with readAhead has its next buffer read by a
+                   // background thread while the current one is consumed
 {
 public:
    BinaryReader(size_t bufferSize=DEFAULT_BUFFER_SIZE);
-   virtual ~BinaryReader() { delete[] buf; }
+   virtual ~BinaryReader();
 
-   virtual bool openFile(const char *filename);
+   virtual bool openFile(const char *filename, bool readAhead=false);
+   virtual bool mapFile(const char *filename, int advice=MADV_RANDOM);
+   virtual void advise(uint64_t byteOffset, uint64_t numBytes, int advice) const;
    virtual void seek(uint64_t byteOffset);
    virtual bool fillBuffer();
+   virtual bool refillBuffer(size_t numBytes);
    virtual bool read_buffer(uint8_t *buffer, size_t numBytes);
    virtual bool read_string(char *string, size_t maxlen);
-   virtual bool read_uint8 (uint8_t&  value);
-   virtual bool read_uint16(uint16_t& value);
-   virtual bool read_uint32(uint32_t& value);
-   virtual bool read_uint64(uint64_t& value);
-   virtual bool read_double(double& value);
    virtual bool skipBytes(size_t numBytes);
    virtual void closeFile();
 
+   // the fixed-width read functions are inline and return false if EOF is
+   // encountered; they call refillBuffer() only when the buffer runs out
+
+   template<typename T> bool read_be(T& value)
+   {
+      if (offset + sizeof(T) > buflen && !refillBuffer(sizeof(T)))
+         return false;
+
+      value = loadBigEndian<T>(&buf[offset]);
+      offset += sizeof(T);
+      return true;
+   }
+
+   template<typename T> bool read_le(T& value)
+   {
+      if (offset + sizeof(T) > buflen && !refillBuffer(sizeof(T)))
+         return false;
+
+      value = loadLittleEndian<T>(&buf[offset]);
+      offset += sizeof(T);
+      return true;
+   }
+
+   bool read_uint8(uint8_t& value)
+   {
+      if (offset >= buflen && !fillBuffer())
+         return false;
+
+      value = buf[offset++];
+      return true;
+   }
+
+   bool read_uint16(uint16_t& value) { return read_be(value); }
+   bool read_uint32(uint32_t& value) { return read_be(value); }
+   bool read_uint64(uint64_t& value) { return read_be(value); }
+
+   bool read_double(double& value)
+   {
+      uint64_t bits;
+      if (!read_be(bits))
+         return false;
+
+      std::memcpy(&value, &bits, sizeof(value));
+      return true;
+   }
+
+   // read_span() returns a pointer to the next numBytes bytes, which stay valid until
+   // the next read; NULL is returned if EOF is encountered or numBytes exceeds the
+   // buffer size
+   const uint8_t *read_span(size_t numBytes)
+   {
+      if (offset + numBytes > buflen && !refillBuffer(numBytes))
+         return NULL;
+
+      const uint8_t *p = &buf[offset];
+      offset += numBytes;
+      return p;
+   }
+
+   // mappedData() returns a pointer to numBytes bytes at the given offset of a mapped
+   // file, or NULL if no file is mapped or the bytes are not all within the file
+   const uint8_t *mappedData(uint64_t byteOffset, size_t numBytes) const
+   {
+      if (!isMapped() || byteOffset > buflen || numBytes > buflen - byteOffset)
+         return NULL;
+
+      return &buf[byteOffset];
+   }
+
+   bool isMapped() const { return (buf != internalBuf); }
+
    int      fd;
-   uint8_t *buf;
+   uint8_t *buf;                  // internalBuf, or the mapped file
    size_t   bufsize, buflen, offset;
+   uint8_t *internalBuf;
+   size_t   internalSize;
+
+protected:
+   struct Prefetch; // the read-ahead thread and its spare buffer
+   Prefetch *prefetch;
+
+   virtual void stopPrefetch();
+};
+
+//------------------------------------------------------------------------------------
+
+class BackgroundWriter // writes filled buffers to files on a dedicated thread
+{
+public:
+   BackgroundWriter();
+   virtual ~BackgroundWriter();
+
+   // submit() queues a buffer to be written, setting *pending until it has been;
+   // wait() returns once *pending is clear, and checkError() throws an exception if
+   // any write has failed
+   void submit(int fd, const char *buffer, size_t numBytes, bool *pending);
+   void wait(const bool *pending);
+   void checkError();
+
+protected:
+   struct State; // the thread and its queue
+   State *state;
+};
+
+//------------------------------------------------------------------------------------
+// A container file holds named sections of text, so that one file can replace many
+// small ones.  Each section is written as chunks, which may be interleaved with the
+// chunks of other sections.  All integers are big-endian:
+//
+//    header     magic "CSEC" (uint32), version (uint32)
+//    chunks     bytes of text
+//    directory  number of sections (uint32), then for each section: name length
+//               (uint8), name, number of chunks (uint32), then for each chunk: byte
+//               offset (uint64) and length (uint32)
+//    trailer    byte offset of the directory (uint64), magic "CSEC" (uint32)
+
+const uint32_t CONTAINER_MAGIC   = 0x43534543; // "CSEC"
+const uint32_t CONTAINER_VERSION = 1;
+
+class ContainerSection // directory entry for one section of a container file
+{
+public:
+   std::string           name;
+   std::vector<uint64_t> chunkOffset;
+   std::vector<uint32_t> chunkLength;
+};
+
+class ContainerWriter // for writing a container file; the text of each section is
+                      // written by a TextWriter opened with openSection()
+{
+public:
+   ContainerWriter() : fd(-1), endOffset(0) { }
+   virtual ~ContainerWriter();
+
+   virtual bool     openFile(const char *filename);
+   virtual int      addSection(const std::string& name);
+   virtual uint64_t addChunk(int sectionIndex, size_t numBytes);
+   virtual void     closeFile();
+
+   int                           fd;
+   uint64_t                      endOffset; // where the next chunk will be written
+   std::vector<ContainerSection> section;
+};
+
+bool isContainerFile(const char *filename);
+
+class ContainerReader // for reading sections of a container file
+{
+public:
+   ContainerReader() { }
+   virtual ~ContainerReader() { }
+
+   virtual bool openFile(const char *filename);
+   virtual bool readSection(const std::string& name, std::string& text);
+   virtual void closeFile();
+
+   BinaryReader                  reader;
+   std::vector<ContainerSection> section;
 };
 
 //------------------------------------------------------------------------------------
 
+extern const char digitPairs[201]; // "00" to "99"
+
+class TextWriter // for writing a text file through a large buffer; numbers are
+                 // formatted directly into the buffer; if a BackgroundWriter is
+                 // given, a full buffer is handed to its thread while writing
+                 // continues into a second buffer
+{
+public:
+   TextWriter(size_t bufferSize=DEFAULT_BUFFER_SIZE,
+	      BackgroundWriter *writer=NULL);
+   virtual ~TextWriter();
+
+   virtual bool openFile(const char *filename);
+   virtual bool openSection(ContainerWriter& container, const std::string& name);
+   virtual void flushBuffer();
+   virtual void closeFile();
+
+   // the write functions are inline and do not flush unless the buffer is nearly full
+
+   void write_char(char ch)
+   {
+      if (offset == bufsize)
+         flushBuffer();
+
+      buf[offset++] = ch;
+   }
+
+   void write_string(const char *s, size_t length)
+   {
+      if (offset + length > bufsize)
+      {
+         flushBuffer();
+
+	 if (length > bufsize)
+            throw std::runtime_error("text write buffer is too small");
+      }
+
+      std::memcpy(&buf[offset], s, length);
+      offset += length;
+   }
+
+   void write_string(const std::string& s) { write_string(s.data(), s.length()); }
+
+   void write_uint(uint32_t value)
+   {
+      if (offset + 10 > bufsize)
+         flushBuffer();
+
+      offset += formatUint(&buf[offset], value);
+   }
+
+   void write_int(int value)
+   {
+      if (value < 0)
+      {
+         write_char('-');
+	 write_uint(-static_cast<uint32_t>(value));
+      }
+      else
+         write_uint(value);
+   }
+
+   // write_fixed() writes a number with the given digits after the decimal point,
+   // exactly as printf("%.*f") would
+   void write_fixed(double value, int decimals)
+   {
+      if (offset + 32 > bufsize)
+         flushBuffer();
+
+      offset += formatFixed(&buf[offset], bufsize - offset, value, decimals);
+   }
+
+   static size_t formatFixed(char *p, size_t size, double value, int decimals);
+
+   virtual uint64_t bytesWritten() const { return bytesFlushed + offset; }
+
+   // formatUint() formats a number at p and returns the number of digits
+   static size_t formatUint(char *p, uint32_t value)
+   {
+      char tmp[10];
+      char *q = tmp + 10;
+
+      while (value >= 100)
+      {
+         const char *pair = &digitPairs[2 * (value % 100)];
+	 value /= 100;
+	 *--q = pair[1];
+	 *--q = pair[0];
+      }
+
+      if (value >= 10)
+      {
+         *--q = digitPairs[2 * value + 1];
+	 *--q = digitPairs[2 * value];
+      }
+      else
+         *--q = static_cast<char>('0' + value);
+
+      size_t length = tmp + 10 - q;
+      std::memcpy(p, q, length);
+      return length;
+   }
+
+   int       fd;
+   char     *buf;
+   size_t    bufsize, offset;
+   uint64_t  bytesFlushed;
+
+protected:
+   BackgroundWriter *background;
+   ContainerWriter  *container;  // set when writing a section of a container
+   int               section;    // index of the section in the container
+   char             *buffer[2];  // buf is one of these
+   bool              pending[2]; // true while a buffer is being written
+   int               current;    // index of buf in buffer
+};
+
+//------------------------------------------------------------------------------------
+
+class RdsWriter // for writing a data frame of integer, double and string columns as
+                // an uncompressed R serialization (XDR, version 2), which R loads
+                // with readRDS()
+{
+public:
+   RdsWriter() { }
+   virtual ~RdsWriter() { }
+
+   // after openFile(), call beginDataFrame(), write each column in order, then call
+   // endDataFrame() and closeFile()
+   virtual bool openFile(const char *filename);
+   virtual void beginDataFrame(int numColumns);
+   virtual void writeIntegerColumn(const std::vector<int>& v);
+   virtual void writeDoubleColumn (const std::vector<double>& v);
+   virtual void writeStringColumn (const StringVector& v);
+   virtual void endDataFrame(const StringVector& columnNames, int numRows);
+   virtual void closeFile() { writer.closeFile(); }
+
+   BinaryWriter writer;
+
+protected:
+   virtual void writeString(const std::string& s);
+   virtual void writeSymbol(const std::string& name);
+};
+
+//------------------------------------------------------------------------------------
+
+class BlockInflater; // inflates BGZF or bzip2 blocks on a pool of threads
+struct z_stream_s;   // zlib stream state
+
+class LineReader // for reading lines of text from a plain, gzip, BGZF or bzip2 file,
+                 // or from one member of a tar archive in any of these formats
+{
+public:
+   LineReader(int threads=0, size_t bufferSize=DEFAULT_BUFFER_SIZE);
+   virtual ~LineReader();
+
+   // a filename of "-" means stdin, and "archive.tar.bz2:member" names a member of
+   // an archive
+   virtual bool openFile(const char *filename);
+   virtual bool openArchiveMember(const char *archiveName, const std::string& member);
+   virtual bool getLine(std::string& line);
+   virtual size_t readBytes(char *buffer, size_t numBytes);
+   virtual bool seek(uint64_t byteOffset);
+   virtual void closeFile();
+
+   enum Format { PLAIN, GZIP, BGZF, BZIP2 };
+
+   int     fd;
+   Format  format;
+   int     numThreads; // number of threads used to inflate BGZF and bzip2 blocks
+
+protected:
+   virtual size_t readRaw(uint8_t *buffer, size_t numBytes);
+   virtual bool   decodeChunk();
+   virtual bool   nextChunk();
+   virtual bool   readDecoded(uint8_t *buffer, size_t numBytes);
+
+   uint8_t *inbuf;                // compressed (or plain) bytes read from the file
+   size_t   insize, inlen, inpos;
+
+   std::vector<char> chunk;       // decompressed bytes not yet returned as lines
+   size_t            chunkpos;
+
+   z_stream_s    *zs;             // used for a gzip file that is not BGZF
+   bool           gzipEnded;      // true if the last gzip member inflated is complete
+   BlockInflater *inflater;       // used for a BGZF or bzip2 file
+
+   bool     inArchive;            // true if reading a member of a tar archive
+   uint64_t memberRemaining;      // bytes of the member not yet put in the chunk
+
+   uint64_t linesRead;            // added to totalLinesRead when the file is closed
+};
+
+bool splitArchiveMember(const std::string& filename, std::string& archiveName,
+                        std::string& member);
+
+//------------------------------------------------------------------------------------
+
+// totals of the bytes read from input files and the lines read by LineReader objects
+// in this process, which -metrics reports
+extern std::atomic<uint64_t> totalBytesRead;
+extern std::atomic<uint64_t> totalLinesRead;
+
+class Metrics // times the phases of a program and totals its counters, for a JSON
+              // report; it may be used by several threads at once
+{
+public:
+   Metrics();
+   virtual ~Metrics();
+
+   class Timer // the wall and CPU time when a phase started
+   {
+   public:
+      Timer() : wall(wallSeconds()), cpu(cpuSeconds()) { }
+
+      double wall, cpu;
+   };
+
+   // addPhase() adds the time since a timer started to the named phase; the times of
+   // a phase run more than once, or on several threads at once, are summed
+   virtual void addPhase(const std::string& name, const Timer& timer);
+   virtual void addCount(const std::string& name, uint64_t count);
+
+   // writeFile() writes the report, with the totals of the whole run and its peak
+   // resident set size; false is returned if the file cannot be written
+   virtual bool writeFile(const std::string& filename, const std::string& program);
+
+   static double wallSeconds(); // since an arbitrary starting point
+   static double cpuSeconds();  // user and system time of the process
+
+protected:
+   struct State; // the phases and counters, and a mutex
+   State *state;
+};
+
+//------------------------------------------------------------------------------------
+
+class TwoBitFile // the index of a 2bit file, read once: the offset, length and
+                 // unknown regions of each sequence, found by name in a hash table;
+                 // the file stays mapped, or open, so a region costs one read
+{
+public:
+   explicit TwoBitFile(const std::string& twobit_filename);
+   virtual ~TwoBitFile() { }
+
+   struct Sequence
+   {
+      uint64_t dnaOffset; // byte offset of the packed bases
+      uint32_t numBases;
+
+      std::vector<uint32_t> nBlockStart, nBlockStop; // unknown regions, 1-based,
+                                                     // sorted and disjoint
+   };
+
+   virtual const Sequence *findSequence(const std::string& name) const;
+   virtual const Sequence *findChromosome(uint8_t chrNumber) const;
+
+   virtual const uint8_t *getBytes(uint64_t byteOffset, size_t numBytes,
+		                   std::vector<uint8_t>& buffer) const;
+
+   std::string  filename;
+   StringVector names; // the sequence names, in file order
+
+protected:
+   std::unordered_map<std::string, Sequence> sequence;
+   BinaryReader reader;
+
+private:
+   TwoBitFile(const TwoBitFile&);            // not copyable
+   TwoBitFile& operator=(const TwoBitFile&);
+};
+
+typedef std::shared_ptr<const TwoBitFile> TwoBitFilePtr;
+
+TwoBitFilePtr openTwoBitFile(const std::string& twobit_filename);
+
+//------------------------------------------------------------------------------------
+
 class ReferenceGenome // for representing a reference genome and determining indel
-                      // equivalence
+                      // equivalence; if packed, the bases are kept four to a byte as
+                      // in the 2bit file, along with a list of the unknown regions
 {
 public:
    ReferenceGenome(const std::string& twobit_filename, uint8_t chrNumber,
-		   uint32_t beginpos, uint32_t endpos, std::string chrName="");
-   virtual ~ReferenceGenome() { delete[] sequence; }
+		   uint32_t beginpos, uint32_t endpos, std::string chrName="",
+		   bool packed=false);
+   ReferenceGenome(const TwoBitFilePtr& inTwobit, uint8_t chrNumber,
+		   uint32_t beginpos, uint32_t endpos, std::string chrName="",
+		   bool packed=false);
+   virtual ~ReferenceGenome() { delete[] sequence; delete[] packedSequence; }
+
+   virtual char getBase(uint32_t pos) const
+   {
+      if (pos < begin || pos > end)
+         return 'N';
+
+      if (sequence)
+         return sequence[pos - begin];
+
+      if (!nBlockStart.empty() && isUnknown(pos, 1))
+         return 'N';
 
-   virtual char getBase(uint32_t pos) const;
+      uint32_t i = pos - begin + packedSkip;
+      return "TCAG"[(packedSequence[i >> 2] >> (6 - 2 * (i & 3))) & 3];
+   }
 
    virtual bool validDeletion(uint32_t pos, const std::string& seq) const;
 
@@ -200,7 +834,24 @@ public:
 		                     uint32_t pos2, const std::string& seq2) const;
 
    uint32_t  begin, end;
-   char     *sequence;
+   char     *sequence;       // one character per base, or NULL if packed
+   uint8_t  *packedSequence; // four bases per byte, or NULL if not packed
+   uint32_t  packedSkip;     // bases before begin in the first byte of packedSequence
+
+   std::vector<uint32_t> nBlockStart, nBlockStop; // unknown regions, if packed
+
+   TwoBitFilePtr twobit; // the index the sequence was read with
+
+protected:
+   void load(uint8_t chrNumber, uint32_t beginpos, uint32_t endpos,
+	     std::string chrName, bool packed);
+
+   bool isUnknown(uint32_t pos, uint32_t n) const;
+   bool packedRange(uint32_t pos, uint32_t n) const;
+   uint64_t packedCodes(uint32_t pos, uint32_t n) const;
+
+   bool matchSequence(uint32_t pos, const char *seq, uint32_t n) const;
+   bool matchGenome(uint32_t pos1, uint32_t pos2, uint32_t n) const;
 };
 
 StringVector *getChromosomeNames(const std::string& twobit_filename);
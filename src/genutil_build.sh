@@ -1,2 +1,2 @@
 #!/bin/bash
-g++ -c -std=c++0x -O3 genutil.cpp
+g++ -c -std=c++0x -O3 -pthread genutil.cpp
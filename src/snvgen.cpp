@@ -0,0 +1,626 @@
+//------------------------------------------------------------------------------------
+//
+// snvgen.cpp - program that generates a synthetic MAF, Bambino ("high_20"), paired
+//              tumor/normal VCF or snvcounts file for load testing snvcounts and
+//              consprep; the output depends only on the options and the seed, so the
+//              same file is generated on any machine
+//
+// Copyright 2017 St. Jude Children's Research Hospital
+//
+//------------------------------------------------------------------------------------
+
+#include "genutil.h"
+#include <random>
+
+// command-line option variables and default values
+
+const double DEFAULT_DENSITY      = 1000; // variants per megabase
+const double DEFAULT_COVERAGE     =   40; // mean total count
+const double DEFAULT_DISPERSION   =    8; // gamma shape of the coverage; larger is
+                                          // less dispersed
+const double DEFAULT_HETFRACTION  = 0.60; // fraction of heterozygous SNVs
+const double DEFAULT_NONSNP       = 0.05; // fraction of indel rows
+const double DEFAULT_SHUFFLE      = 0.00; // fraction of rows moved out of order
+
+enum Format { MAF, HIGH20, VCF, SNVCOUNTS };
+
+Format      format         = MAF;
+uint64_t    seed           = 1;
+double      density        = DEFAULT_DENSITY;
+double      normalCoverage = DEFAULT_COVERAGE;
+double      tumorCoverage  = -1; // -1 means the same as normalCoverage
+double      dispersion     = DEFAULT_DISPERSION;
+double      hetFraction    = DEFAULT_HETFRACTION;
+double      nonsnp         = DEFAULT_NONSNP;
+double      shuffle        = DEFAULT_SHUFFLE;
+std::string chrList;     // comma-separated chromosomes to generate, "" for all
+
+//------------------------------------------------------------------------------------
+
+class RandomSource // deterministic random numbers; the distributions are computed
+                   // here rather than by <random>, whose results differ between
+                   // standard libraries
+{
+public:
+   RandomSource(uint64_t seed) : engine(seed), haveNormal(false) { }
+
+   // uniform() returns a number in (0, 1)
+   double uniform() { return ((engine() >> 11) + 0.5) * (1.0 / 9007199254740992.0); }
+
+   uint64_t below(uint64_t n) { return engine() % n; }
+
+   double normal();
+   double gamma(double shape);
+   int    poisson(double lambda);
+   int    binomial(int n, double p);
+
+   std::mt19937_64 engine;
+   bool            haveNormal;
+   double          nextNormal;
+};
+
+//------------------------------------------------------------------------------------
+// RandomSource::normal() returns a standard normal number (Box-Muller)
+
+double RandomSource::normal()
+{
+   if (haveNormal)
+   {
+      haveNormal = false;
+      return nextNormal;
+   }
+
+   double r     = std::sqrt(-2 * std::log(uniform()));
+   double theta = 2 * M_PI * uniform();
+
+   nextNormal = r * std::sin(theta);
+   haveNormal = true;
+
+   return r * std::cos(theta);
+}
+
+//------------------------------------------------------------------------------------
+// RandomSource::gamma() returns a gamma number with the given shape and a scale of
+// one (Marsaglia and Tsang)
+
+double RandomSource::gamma(double shape)
+{
+   if (shape < 1)
+      return gamma(shape + 1) * std::pow(uniform(), 1 / shape);
+
+   double d = shape - 1.0 / 3;
+   double c = 1 / std::sqrt(9 * d);
+
+   while (true)
+   {
+      double x = normal();
+      double v = 1 + c * x;
+
+      if (v <= 0)
+         continue;
+
+      v = v * v * v;
+
+      if (std::log(uniform()) < 0.5 * x * x + d - d * v + d * std::log(v))
+         return d * v;
+   }
+}
+
+//------------------------------------------------------------------------------------
+// RandomSource::poisson() returns a Poisson number; a normal approximation is used
+// for a large mean
+
+int RandomSource::poisson(double lambda)
+{
+   if (lambda > 64)
+      return std::max(0, roundit(lambda + std::sqrt(lambda) * normal()));
+
+   double limit   = std::exp(-lambda);
+   double product = uniform();
+   int    count   = 0;
+
+   while (product > limit)
+   {
+      product *= uniform();
+      count++;
+   }
+
+   return count;
+}
+
+//------------------------------------------------------------------------------------
+// RandomSource::binomial() returns the number of successes in n trials; a normal
+// approximation is used when the variance is large
+
+int RandomSource::binomial(int n, double p)
+{
+   double variance = n * p * (1 - p);
+
+   if (variance > 16)
+      return std::min(n, std::max(0, roundit(n * p + std::sqrt(variance) *
+					     normal())));
+
+   int count = 0;
+
+   for (int i = 0; i < n; i++)
+      if (uniform() < p)
+         count++;
+
+   return count;
+}
+
+//------------------------------------------------------------------------------------
+
+class SynthRow // one generated variant
+{
+public:
+   uint8_t  chrnum;
+   uint32_t position;
+   char     type;      // 'S' for an SNV, 'I' for an insertion, 'D' for a deletion
+   char     ref, alt;  // bases of an SNV; the first inserted or deleted base of an
+                       // indel
+   uint8_t  length;    // bases inserted or deleted
+   uint16_t tumorRef, tumorAlt, normalRef, normalAlt;
+};
+
+//------------------------------------------------------------------------------------
+// processOptions() processes the command-line arguments; false is returned if any of
+// the arguments are invalid
+
+bool processOptions(int argc, char *argv[], std::string& sizes_filename,
+		    std::string& output_filename)
+{
+   int n = 0; // number of non-option arguments found
+
+   for (int i = 1; i < argc; i++)
+   {
+      std::string s = argv[i];
+      if (s.length() == 0)
+         return false;
+
+      if (s[0] == '-') // found an option
+      {
+         StringVector part;
+	 getDelimitedStrings(s, '=', part);
+
+	 if (part.size() != 2)
+            return false;
+
+	 if (part[0] == "-format")
+	 {
+            if      (part[1] == "maf")       format = MAF;
+	    else if (part[1] == "high20")    format = HIGH20;
+	    else if (part[1] == "vcf")       format = VCF;
+	    else if (part[1] == "snvcounts") format = SNVCOUNTS;
+	    else return false;
+	 }
+	 else if (part[0] == "-seed")
+	 {
+            int value = stringToInt(part[1]);
+	    if (value < 0)
+               return false;
+
+	    seed = value;
+	 }
+	 else if (part[0] == "-chr")
+            chrList = part[1];
+	 else
+	 {
+            double value = stringToDbl(part[1]);
+	    bool   positive = (value > 0);
+	    bool   fraction = (value >= 0 && value <= 1);
+
+	    if      (part[0] == "-density"       && positive) density        = value;
+	    else if (part[0] == "-coverage"      && positive) normalCoverage = value;
+	    else if (part[0] == "-tumorcoverage" && positive) tumorCoverage  = value;
+	    else if (part[0] == "-dispersion"    && positive) dispersion     = value;
+	    else if (part[0] == "-het"           && fraction) hetFraction    = value;
+	    else if (part[0] == "-nonsnp"        && fraction) nonsnp         = value;
+	    else if (part[0] == "-shuffle"       && fraction) shuffle        = value;
+	    else
+               return false;
+	 }
+      }
+      else
+         switch (++n)
+	 {
+            case  1: sizes_filename  = s; break;
+            case  2: output_filename = s; break;
+            default: return false;
+	 }
+   }
+
+   if (tumorCoverage < 0)
+      tumorCoverage = normalCoverage;
+
+   return (n == 2);
+}
+
+//------------------------------------------------------------------------------------
+// showUsage() displays the command-line usage for this program
+
+void showUsage(const char *progname)
+{
+   std::cout << "Usage: " << progname
+	     << " [OPTION ...] chr_sizes_file output_file"
+	     << std::endl << std::endl
+	     << "  -format=F\tmaf, high20, vcf (tumor then normal) or snvcounts,"
+	     << " default is maf"
+	     << std::endl
+	     << "  -seed=N\tseed of the random numbers, default is 1"
+	     << std::endl
+	     << "  -chr=LIST\tcomma-separated chromosomes to generate, default is all"
+	     << " in chr_sizes_file"
+	     << std::endl;
+
+   std::printf("  -density=N\tvariants per megabase, default is %g\n",
+	       DEFAULT_DENSITY);
+   std::printf("  -coverage=N\tmean normal total count, default is %g\n",
+	       DEFAULT_COVERAGE);
+   std::printf("  -tumorcoverage=N\tmean tumor total count, default is the normal"
+	       " coverage\n");
+   std::printf("  -dispersion=N\tgamma shape of the coverage, larger is less"
+	       " dispersed, default is %g\n", DEFAULT_DISPERSION);
+   std::printf("  -het=F\tfraction of heterozygous SNVs, default is %4.2f\n",
+	       DEFAULT_HETFRACTION);
+   std::printf("  -nonsnp=F\tfraction of indel rows, not written to snvcounts files,"
+	       " default is %4.2f\n", DEFAULT_NONSNP);
+   std::printf("  -shuffle=F\tfraction of rows moved out of order, default is %4.2f\n",
+	       DEFAULT_SHUFFLE);
+}
+
+//------------------------------------------------------------------------------------
+// readChrSizes() reads the length of each selected chromosome from a chr_sizes file;
+// the names of the selected chromosomes, as written in the file, are also saved
+
+void readChrSizes(const std::string& filename, std::vector<uint32_t>& chrLength,
+		  StringVector& chrName)
+{
+   std::set<int> selected;
+
+   if (chrList != "")
+   {
+      StringVector name;
+      getDelimitedStrings(chrList, ',', name);
+
+      for (size_t i = 0; i < name.size(); i++)
+      {
+         int chrnum = getChrNumber(name[i]);
+	 if (chrnum == 0)
+            throw std::runtime_error("unrecognized chromosome " + name[i]);
+
+	 selected.insert(chrnum);
+      }
+   }
+
+   chrLength.assign(NUM_CHROMOSOMES + 1, 0);
+   chrName.assign(NUM_CHROMOSOMES + 1, "");
+
+   LineReader infile;
+   if (!infile.openFile(filename.c_str()))
+      throw std::runtime_error("unable to open " + filename);
+
+   std::string line;
+
+   while (infile.getLine(line))
+   {
+      StringVector column;
+      getDelimitedStrings(line, '\t', column);
+
+      int chrnum = getChrNumber(column[0]);
+      if (chrnum == 0)
+         continue; // ignore heading line and unrecognized chromosomes
+
+      if (column.size() < 3 || stringToInt(column[2]) <= 0)
+         throw std::runtime_error("invalid line in " + filename + " \"" + line +
+			          "\"");
+
+      if (selected.empty() || selected.count(chrnum))
+      {
+         chrLength[chrnum] = std::min(stringToInt(column[2]), MAX_POSITION);
+	 chrName[chrnum]   = column[0];
+      }
+   }
+
+   infile.closeFile();
+
+   for (std::set<int>::iterator p = selected.begin(); p != selected.end(); ++p)
+      if (chrLength[*p] == 0)
+         throw std::runtime_error(chrLongName[*p] + " is not in " + filename);
+}
+
+//------------------------------------------------------------------------------------
+// generateRows() generates the variants of all selected chromosomes in order by
+// chromosome and position; the gaps between variants are exponentially distributed
+
+void generateRows(RandomSource& random, const std::vector<uint32_t>& chrLength,
+		  std::vector<SynthRow>& row)
+{
+   const char *base = "ACGT";
+   double meanGap = 1e6 / density;
+
+   for (int chrnum = 1; chrnum <= NUM_CHROMOSOMES; chrnum++)
+   {
+      double position = 0;
+
+      while (true)
+      {
+         position += std::max(1.0, std::floor(-meanGap * std::log(random.uniform())));
+	 if (position > chrLength[chrnum])
+            break;
+
+	 SynthRow r;
+	 r.chrnum   = chrnum;
+	 r.position = static_cast<uint32_t>(position);
+	 int refIndex = random.below(4);
+
+	 r.ref    = base[refIndex];
+	 r.alt    = base[(refIndex + 1 + random.below(3)) % 4];
+	 r.type   = 'S';
+	 r.length = 1;
+
+	 if (random.uniform() < nonsnp)
+	 {
+            r.type   = (random.below(2) ? 'I' : 'D');
+	    r.length = 1 + random.below(6);
+	 }
+
+	 // coverage is a gamma-Poisson mixture, so it is overdispersed like real
+	 // sequencing depth
+	 int normalTotal = random.poisson(normalCoverage *
+			                  random.gamma(dispersion) / dispersion);
+	 int tumorTotal  = random.poisson(tumorCoverage *
+			                  random.gamma(dispersion) / dispersion);
+
+	 normalTotal = std::min(normalTotal, 65535);
+	 tumorTotal  = std::min(tumorTotal,  65535);
+
+	 double vaf = (random.uniform() < hetFraction ? 0.5 : 0.99);
+
+	 r.normalAlt = random.binomial(normalTotal, vaf);
+	 r.normalRef = normalTotal - r.normalAlt;
+	 r.tumorAlt  = random.binomial(tumorTotal,  vaf);
+	 r.tumorRef  = tumorTotal  - r.tumorAlt;
+
+	 row.push_back(r);
+      }
+   }
+}
+
+//------------------------------------------------------------------------------------
+// shuffleRows() moves a fraction of the rows out of order by swapping each chosen row
+// with another chosen at random
+
+void shuffleRows(RandomSource& random, std::vector<SynthRow>& row)
+{
+   if (row.empty())
+      return;
+
+   uint64_t numSwaps = static_cast<uint64_t>(shuffle * row.size() / 2 + 0.5);
+
+   for (uint64_t i = 0; i < numSwaps; i++)
+      std::swap(row[random.below(row.size())], row[random.below(row.size())]);
+}
+
+//------------------------------------------------------------------------------------
+// writeAlleles() writes the reference and alternative alleles of an indel in the form
+// of the output format
+
+void writeAlleles(TextWriter& outfile, const SynthRow& r, bool vcfStyle)
+{
+   std::string indel(r.length, r.ref);
+
+   if (vcfStyle) // the base before the indel is included
+   {
+      outfile.write_char(r.alt);
+      if (r.type == 'D')
+         outfile.write_string(indel);
+
+      outfile.write_char('\t');
+      outfile.write_char(r.alt);
+      if (r.type == 'I')
+         outfile.write_string(indel);
+   }
+   else // a missing allele is "-"
+   {
+      outfile.write_string(r.type == 'I' ? std::string("-") : indel);
+      outfile.write_char('\t');
+      outfile.write_string(r.type == 'D' ? std::string("-") : indel);
+   }
+}
+
+//------------------------------------------------------------------------------------
+// writeRows() writes the heading and the rows in the selected format
+
+void writeRows(const std::string& filename, const std::vector<SynthRow>& row,
+	       const StringVector& chrName)
+{
+   TextWriter outfile;
+   if (!outfile.openFile(filename.c_str()))
+      throw std::runtime_error("unable to open " + filename);
+
+   const std::string tumorSample  = "SYNTH_TUMOR";
+   const std::string normalSample = "SYNTH_NORMAL";
+
+   switch (format)
+   {
+      case MAF:
+         outfile.write_string("Hugo_Symbol\tChromosome\tStart_Position\t"
+			      "End_Position\tVariant_Type\tReference_Allele\t"
+			      "Tumor_Seq_Allele2\tTumor_Sample_Barcode\t"
+			      "Tumor_ReadCount_Alt\tTumor_ReadCount_Total\t"
+			      "Normal_ReadCount_Alt\tNormal_ReadCount_Total\n");
+	 break;
+
+      case HIGH20:
+         outfile.write_string("Chr\tPos\tType\tChr_Allele\tAlternative_Allele\t"
+			      "reference_normal_count\talternative_normal_count\t"
+			      "TumorSample\treference_tumor_count\t"
+			      "alternative_tumor_count\n");
+	 break;
+
+      case VCF:
+         outfile.write_string("##fileformat=VCFv4.1\n"
+			      "##FORMAT=<ID=GT,Number=1,Type=String,"
+			      "Description=\"Genotype\">\n"
+			      "##FORMAT=<ID=AD,Number=R,Type=Integer,"
+			      "Description=\"Allelic depths\">\n"
+			      "#CHROM\tPOS\tID\tREF\tALT\tQUAL\tFILTER\tINFO\tFORMAT\t" +
+			      tumorSample + "\t" + normalSample + "\n");
+	 break;
+
+      case SNVCOUNTS:
+         outfile.write_string("Chr\tPos\tTumorMutant\tTumorTotal\tNormalMutant\t"
+			      "NormalTotal\n");
+	 break;
+   }
+
+   for (size_t i = 0; i < row.size(); i++)
+   {
+      const SynthRow& r = row[i];
+
+      if (format == SNVCOUNTS && r.type != 'S')
+         continue; // snvcounts files hold only SNVs
+
+      if (format == MAF)
+         outfile.write_string("SYNTH\t");
+
+      outfile.write_string(format == SNVCOUNTS ? chrLongName[r.chrnum] :
+		           chrName[r.chrnum]);
+      outfile.write_char('\t');
+
+      if (format == MAF)
+      {
+         outfile.write_uint(r.position);
+	 outfile.write_char('\t');
+	 outfile.write_uint(r.position + (r.type == 'D' ? r.length - 1 : 0));
+	 outfile.write_char('\t');
+	 outfile.write_string(r.type == 'S' ? std::string("SNP") :
+			      r.type == 'I' ? std::string("INS") : std::string("DEL"));
+	 outfile.write_char('\t');
+
+	 if (r.type == 'S')
+	 {
+            outfile.write_char(r.ref);
+	    outfile.write_char('\t');
+	    outfile.write_char(r.alt);
+	 }
+	 else
+            writeAlleles(outfile, r, false);
+
+	 outfile.write_char('\t');
+	 outfile.write_string(tumorSample);
+	 outfile.write_char('\t');
+	 outfile.write_uint(r.tumorAlt);
+	 outfile.write_char('\t');
+	 outfile.write_uint(r.tumorRef + r.tumorAlt);
+	 outfile.write_char('\t');
+	 outfile.write_uint(r.normalAlt);
+	 outfile.write_char('\t');
+	 outfile.write_uint(r.normalRef + r.normalAlt);
+      }
+      else if (format == HIGH20)
+      {
+         outfile.write_uint(r.position);
+	 outfile.write_char('\t');
+	 outfile.write_string(r.type == 'S' ? std::string("SNP") :
+			      r.type == 'I' ? std::string("insertion") :
+			      std::string("deletion"));
+	 outfile.write_char('\t');
+
+	 if (r.type == 'S')
+	 {
+            outfile.write_char(r.ref);
+	    outfile.write_char('\t');
+	    outfile.write_char(r.alt);
+	 }
+	 else
+            writeAlleles(outfile, r, false);
+
+	 outfile.write_char('\t');
+	 outfile.write_uint(r.normalRef);
+	 outfile.write_char('\t');
+	 outfile.write_uint(r.normalAlt);
+	 outfile.write_char('\t');
+	 outfile.write_string(tumorSample);
+	 outfile.write_char('\t');
+	 outfile.write_uint(r.tumorRef);
+	 outfile.write_char('\t');
+	 outfile.write_uint(r.tumorAlt);
+      }
+      else if (format == VCF)
+      {
+         outfile.write_uint(r.position);
+	 outfile.write_string("\t.\t");
+
+	 if (r.type == 'S')
+	 {
+            outfile.write_char(r.ref);
+	    outfile.write_char('\t');
+	    outfile.write_char(r.alt);
+	 }
+	 else
+            writeAlleles(outfile, r, true);
+
+	 outfile.write_string("\t.\tPASS\t.\tGT:AD\t0/1:");
+	 outfile.write_uint(r.tumorRef);
+	 outfile.write_char(',');
+	 outfile.write_uint(r.tumorAlt);
+	 outfile.write_string("\t0/1:");
+	 outfile.write_uint(r.normalRef);
+	 outfile.write_char(',');
+	 outfile.write_uint(r.normalAlt);
+      }
+      else // SNVCOUNTS
+      {
+         outfile.write_uint(r.position);
+	 outfile.write_char('\t');
+	 outfile.write_uint(r.tumorAlt);
+	 outfile.write_char('\t');
+	 outfile.write_uint(r.tumorRef + r.tumorAlt);
+	 outfile.write_char('\t');
+	 outfile.write_uint(r.normalAlt);
+	 outfile.write_char('\t');
+	 outfile.write_uint(r.normalRef + r.normalAlt);
+      }
+
+      outfile.write_char('\n');
+   }
+
+   outfile.closeFile();
+}
+
+//------------------------------------------------------------------------------------
+
+int main(int argc, char *argv[])
+{
+   std::string sizes_filename, output_filename;
+
+   if (!processOptions(argc, argv, sizes_filename, output_filename))
+   {
+      showUsage(argv[0]);
+      return 1;
+   }
+
+   try
+   {
+      std::vector<uint32_t> chrLength;
+      StringVector          chrName;
+
+      readChrSizes(sizes_filename, chrLength, chrName);
+
+      RandomSource random(seed);
+      std::vector<SynthRow> row;
+
+      generateRows(random, chrLength, row);
+      shuffleRows(random, row);
+      writeRows(output_filename, row, chrName);
+   }
+   catch (const std::runtime_error& error)
+   {
+      std::cerr << argv[0] << ": " << error.what() << std::endl;
+      return 1;
+   }
+
+   return 0;
+}
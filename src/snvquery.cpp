@@ -0,0 +1,57 @@
+//------------------------------------------------------------------------------------
+//
+// snvquery.cpp - program that writes the counts in one or more regions of an indexed
+//                text or binary snvcounts file to stdout, in the text format written
+//                by snvcounts; only the bins of the file holding each region are read
+//
+// Copyright 2017 St. Jude Children's Research Hospital
+//
+//------------------------------------------------------------------------------------
+
+#include "snvutil.h"
+
+//------------------------------------------------------------------------------------
+
+int main(int argc, char *argv[])
+{
+   if (argc < 3)
+   {
+      std::cout << "Usage: " << argv[0]
+	        << " snvcounts_file"
+		<< " region ..."
+		<< std::endl
+		<< "  a region is a chromosome (chr7) or a range of positions within"
+		<< " one (chr7:1000000-2000000)"
+		<< std::endl;
+      return 1;
+   }
+
+   try
+   {
+      std::string filename = argv[1];
+
+      std::printf("Chr\tPos\tTumorMutant\tTumorTotal\tNormalMutant\tNormalTotal\n");
+
+      for (int i = 2; i < argc; i++)
+      {
+         SnvRegionReader reader(filename, SnvRegion(argv[i]));
+
+	 int chrnum, position, tumorMutant, tumorTotal, normalMutant, normalTotal;
+
+	 while (reader.nextPosition(chrnum, position, tumorMutant, tumorTotal,
+				    normalMutant, normalTotal))
+            std::printf("%s\t%d\t%d\t%d\t%d\t%d\n", chrLongName[chrnum].c_str(),
+			position, tumorMutant, tumorTotal, normalMutant, normalTotal);
+      }
+
+      if (std::fflush(stdout) != 0)
+         throw std::runtime_error("write error");
+   }
+   catch (const std::runtime_error& error)
+   {
+      std::cerr << argv[0] << ": " << error.what() << std::endl;
+      return 1;
+   }
+
+   return 0;
+}
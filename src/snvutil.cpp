@@ -0,0 +1,1266 @@
+//------------------------------------------------------------------------------------
+//
+// snvutil.cpp - module containing definitions for reading and storing the mutant and
+//               total counts of SNVs in tumor and normal samples; used by snvcounts
+//               and consprep
+//
+// Author: Stephen V. Rice, Ph.D.
+//
+// Copyright 2016 St. Jude Children's Research Hospital
+//
+//------------------------------------------------------------------------------------
+
+#include "snvutil.h"
+
+#include <sys/mman.h>
+
+//------------------------------------------------------------------------------------
+// MAF_Parser::MAF_Parser() determines the column number of columns of interest by
+// parsing a heading line read from a MAF file
+
+MAF_Parser::MAF_Parser(const std::string& headingLine)
+   : chrCol(-1), posCol(-1), typeCol(-1), tumorMutantCol(-1), tumorTotalCol(-1),
+     normalMutantCol(-1), normalTotalCol(-1)
+{
+   StringVector heading;
+   getDelimitedStrings(headingLine, '\t', heading);
+
+   numColumns = heading.size();
+
+   for (int i = 0; i < numColumns; i++)
+   {
+      std::string h = heading[i];
+
+      if (h == "Chromosome")                                   chrCol          = i;
+      else if (h == "Start_Position" || h == "Start_position") posCol          = i;
+      else if (h == "Variant_Type"   || h == "VariantType")    typeCol         = i;
+      else if (h == "Tumor_ReadCount_Alt")                     tumorMutantCol  = i;
+      else if (h == "Tumor_ReadCount_Total")                   tumorTotalCol   = i;
+      else if (h == "Normal_ReadCount_Alt")                    normalMutantCol = i;
+      else if (h == "Normal_ReadCount_Total")                  normalTotalCol  = i;
+   }
+
+   if (chrCol < 0 || posCol < 0 || typeCol < 0 || tumorMutantCol < 0 ||
+       tumorTotalCol < 0 || normalMutantCol < 0 || normalTotalCol < 0)
+      throw std::runtime_error("missing column(s) in MAF file");
+}
+
+//------------------------------------------------------------------------------------
+// MAF_Parser::parseLine() parses a non-heading line read from a MAF file
+
+bool MAF_Parser::parseLine(const std::string& line, std::string& chrName,
+		           int& position, std::string& variantType,
+			   int& tumorMutant, int& tumorTotal,
+			   int& normalMutant, int& normalTotal) const
+{
+   StringVector value;
+   getDelimitedStrings(line, '\t', value);
+
+   if (value.size() != numColumns)
+      return false;
+
+   position     = stringToInt(value[posCol]);
+   tumorMutant  = stringToInt(value[tumorMutantCol]);
+   tumorTotal   = stringToInt(value[tumorTotalCol]);
+   normalMutant = stringToInt(value[normalMutantCol]);
+   normalTotal  = stringToInt(value[normalTotalCol]);
+
+   if (position < 0 || tumorMutant < 0 || tumorTotal < 0 || normalMutant < 0 ||
+       normalTotal < 0)
+      return false; // unable to convert strings to integers
+
+   chrName      = value[chrCol];
+   variantType  = value[typeCol];
+
+   return true;
+}
+
+//------------------------------------------------------------------------------------
+// compressCounts() converts counts from four-byte signed integers to two-byte
+// unsigned integers
+
+void compressCounts(int inMutant, int inTotal, uint16_t& outMutant,
+		    uint16_t& outTotal)
+{
+   if (inMutant > inTotal)
+      inMutant = inTotal;
+
+   if (inTotal > MAX_COUNT) // count is too large to fit in two bytes
+   {
+      // proportionally reduce the mutant count so that the ratio of mutant/total
+      // is preserved
+      inMutant = roundit(MAX_COUNT * static_cast<double>(inMutant) / inTotal);
+      inTotal  = MAX_COUNT;
+   }
+
+   outMutant = static_cast<uint16_t>(inMutant);
+   outTotal  = static_cast<uint16_t>(inTotal);
+}
+
+//------------------------------------------------------------------------------------
+// parseCountsLine() parses a line of a text snvcounts file read from the named source;
+// false is returned for the heading line and lines of unrecognized chromosomes, and
+// an exception is thrown if the line is invalid
+
+bool parseCountsLine(const std::string& line, const std::string& source,
+		     int& chrnum, int& position, int& tumorMutant, int& tumorTotal,
+		     int& normalMutant, int& normalTotal)
+{
+   StringVector column;
+   getDelimitedStrings(line, '\t', column);
+
+   if (column.size() != 6)
+      throw std::runtime_error("unexpected #columns in line read from " + source +
+			       " \"" + line + "\"");
+
+   chrnum = getChrNumber(column[0]);
+   if (chrnum == 0)
+      return false;
+
+   position     = stringToInt(column[1]);
+   tumorMutant  = stringToInt(column[2]);
+   tumorTotal   = stringToInt(column[3]);
+   normalMutant = stringToInt(column[4]);
+   normalTotal  = stringToInt(column[5]);
+
+   if (position < 0 || tumorMutant < 0 || tumorTotal < 0 || normalMutant < 0 ||
+       normalTotal < 0)
+      throw std::runtime_error("invalid data in line read from " + source + " \"" +
+			       line + "\"");
+
+   if (tumorMutant > tumorTotal)
+      tumorMutant = tumorTotal;
+
+   if (normalMutant > normalTotal)
+      normalMutant = normalTotal;
+
+   return true;
+}
+
+//------------------------------------------------------------------------------------
+// SnvCounts::SnvCounts() initializes an empty set of counts
+
+SnvCounts::SnvCounts()
+{
+}
+
+//------------------------------------------------------------------------------------
+// SnvCounts::readFile() reads a Bambino output file or MAF file, which may be gzip or
+// BGZF compressed, and stores the position data in an array of maps
+
+void SnvCounts::readFile(const std::string& filename)
+{
+   BambinoParserTumor *bp = NULL;
+   MAF_Parser         *mp = NULL;
+
+   LineReader infile;
+   if (!infile.openFile(filename.c_str()))
+      throw std::runtime_error("unable to open " + filename);
+
+   std::string line;
+
+   if (!infile.getLine(line))
+      throw std::runtime_error("empty file " + filename);
+
+   // examine the heading line to see what kind of file it is
+
+   try
+   {
+      bp = new BambinoParserTumor(line);
+   }
+   catch (const std::runtime_error&) { }
+
+   if (!bp) // it is not a Bambino output file
+   {
+      try
+      {
+         mp = new MAF_Parser(line);
+      }
+      catch (const std::runtime_error&) { }
+   }
+
+   if (!bp && !mp)
+      throw std::runtime_error("unrecognized file format in " + filename);
+
+   // now read the file
+
+   while (infile.getLine(line))
+   {
+      std::string chrName, type, ref, alt, tumorSample;
+      int position, tumorRef,  tumorMutant,  tumorTotal,
+	            normalRef, normalMutant, normalTotal;
+
+      if (bp && bp->parseLine(line, chrName, position, type, ref, alt, normalRef,
+			      normalMutant, tumorRef, tumorMutant, tumorSample))
+      {
+         tumorTotal  = tumorRef  + tumorMutant;
+	 normalTotal = normalRef + normalMutant;
+      }
+      else if (mp && mp->parseLine(line, chrName, position, type, tumorMutant,
+			           tumorTotal, normalMutant, normalTotal))
+      {
+      }
+      else
+         throw std::runtime_error("unable to parse line in " + filename + " \"" +
+			          line + "\"");
+
+      int chrnum;
+      if (type != "SNP" || (chrnum = getChrNumber(chrName)) == 0)
+         continue; // this is not an SNV or this is an unrecognized chromosome
+
+      PosMap& pmap = posmap[chrnum];         // get the map for this chromosome
+      if (pmap.find(position) == pmap.end()) // this position is not already in map
+      {
+         pmap.insert(std::make_pair(position,
+	             PosCounts(tumorMutant, tumorTotal, normalMutant, normalTotal)));
+
+	 normalCoverage.addCoverage(normalTotal);
+      }
+   }
+
+   infile.closeFile();
+
+   delete bp;
+   delete mp;
+}
+
+//------------------------------------------------------------------------------------
+// SnvCounts::writeCounts() writes the counts in order by chromosome and position,
+// along with the index of the file
+
+void SnvCounts::writeCounts(const std::string& filename) const
+{
+   CountsWriter writer;
+   writer.openFile(filename);
+
+   for (int chrnum = 1; chrnum <= NUM_CHROMOSOMES; chrnum++)
+   {
+      const PosMap& pmap = posmap[chrnum];
+
+      for (PosMap::const_iterator ppos = pmap.begin(); ppos != pmap.end(); ++ppos)
+         writer.writePosition(chrnum, ppos->first,
+			      ppos->second.tumorMutant,  ppos->second.tumorTotal,
+			      ppos->second.normalMutant, ppos->second.normalTotal);
+   }
+
+   writer.closeFile();
+}
+
+//------------------------------------------------------------------------------------
+// CoverageHistogram::valueAt() returns the coverage value of the given rank (1 to
+// occurrences) in sorted order
+
+int CoverageHistogram::valueAt(uint64_t rank) const
+{
+   uint64_t total = count[0];
+   int i = 0;
+
+   while (total < rank)
+      total += count[++i];
+
+   return i;
+}
+
+//------------------------------------------------------------------------------------
+// CoverageHistogram::median() computes the median of the coverage values; for an even
+// number of values, the two middle values are averaged, as the Perl parsers of VCF and
+// SJ_MAF files did
+
+double CoverageHistogram::median() const
+{
+   if (occurrences == 0)
+      return 0;
+
+   if (occurrences % 2 == 1)
+      return valueAt((occurrences + 1) / 2);
+
+   return (valueAt(occurrences / 2) + valueAt(occurrences / 2 + 1)) / 2.0;
+}
+
+//------------------------------------------------------------------------------------
+// CoverageHistogram::lowerMedian() computes the median of the coverage values as
+// snvcounts always has; of the two middle values of an even number of values, the
+// lower is returned
+
+int CoverageHistogram::lowerMedian() const
+{
+   return valueAt((occurrences + 1) / 2);
+}
+
+//------------------------------------------------------------------------------------
+// addMappedCoverage() adds the last column of each line of a text snvcounts file held
+// in memory, skipping the heading line and lines of unrecognized chromosomes; lines
+// that are not valid are left for the full parse to report
+
+static void addMappedCoverage(const char *p, const char *end, CoverageHistogram& h)
+{
+   std::string chrName;
+   int chrnum = 0;
+
+   while (p < end)
+   {
+      const char *eol = static_cast<const char *>(std::memchr(p, '\n', end - p));
+      if (!eol)
+         eol = end;
+
+      const char *tab = static_cast<const char *>(std::memchr(p, '\t', eol - p));
+
+      if (tab)
+      {
+         // the chromosome name only changes between runs of lines
+         if (chrName.compare(0, std::string::npos, p, tab - p) != 0)
+         {
+            chrName.assign(p, tab - p);
+	    chrnum = getChrNumber(chrName);
+	 }
+
+	 const char *q = eol;
+	 while (q > tab && q[-1] != '\t')
+            q--;
+
+	 int coverage = 0;
+	 bool valid   = (q < eol);
+
+	 for (const char *c = q; c < eol && valid; c++)
+            if (*c >= '0' && *c <= '9')
+               coverage = std::min(10 * coverage + (*c - '0'), MAX_COUNT + 1);
+	    else
+               valid = false;
+
+	 if (chrnum != 0 && valid)
+            h.addCoverage(coverage);
+      }
+
+      p = eol + 1;
+   }
+}
+
+//------------------------------------------------------------------------------------
+// CoverageHistogram::addCountsFile() adds the normal coverage values of a text or
+// binary snvcounts file; a plain text file (or stdin redirected from one) is scanned
+// through a memory map without being parsed, and a compressed file is read with
+// LineReader; stdin must be a file, since it is read again afterwards
+
+void CoverageHistogram::addCountsFile(const std::string& filename)
+{
+   bool useStdin = (filename == "-");
+
+   if (!useStdin && isBinaryCountsFile(filename))
+   {
+      SnvCountsBinaryFile infile;
+      SnvBlock block;
+
+      if (!infile.openFile(filename))
+         throw std::runtime_error("unable to open " + filename);
+
+      for (size_t i = 0; i < infile.block.size(); i++)
+      {
+         infile.decodeBlock(i, block);
+
+	 for (size_t j = 0; j < block.normalTotal.size(); j++)
+            addCoverage(block.normalTotal[j]);
+      }
+
+      infile.closeFile();
+      return;
+   }
+
+   std::string name = (useStdin ? "stdin" : filename);
+
+   int fd = (useStdin ? STDIN_FILENO : open(filename.c_str(), O_RDONLY));
+   if (fd == -1)
+      throw std::runtime_error("unable to open " + name);
+
+   struct stat info;
+
+   if (fstat(fd, &info) == -1 || !S_ISREG(info.st_mode))
+   {
+      if (useStdin)
+         throw std::runtime_error("stdin must be a file to compute the median");
+
+      close(fd);
+   }
+   else if (info.st_size == 0)
+   {
+      if (!useStdin)
+         close(fd);
+
+      return;
+   }
+   else
+   {
+      void *addr = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+      if (!useStdin)
+         close(fd);
+
+      if (addr == MAP_FAILED)
+         throw std::runtime_error("unable to map " + name);
+
+      const uint8_t *data = static_cast<const uint8_t *>(addr);
+
+      bool compressed = (info.st_size >= 2 &&
+	                 ((data[0] == 0x1F && data[1] == 0x8B) ||
+			  (data[0] == 'B'  && data[1] == 'Z')));
+
+      if (!compressed)
+      {
+         madvise(addr, info.st_size, MADV_SEQUENTIAL);
+
+	 const char *text = static_cast<const char *>(addr);
+	 addMappedCoverage(text, text + info.st_size, *this);
+
+	 totalBytesRead += info.st_size;
+      }
+
+      munmap(addr, info.st_size);
+
+      if (!compressed)
+         return;
+
+      if (useStdin)
+         throw std::runtime_error("stdin must not be compressed to compute the "
+			          "median");
+   }
+
+   // a compressed file, or one that cannot be mapped
+
+   LineReader infile;
+   if (!infile.openFile(filename.c_str()))
+      throw std::runtime_error("unable to open " + filename);
+
+   std::string line;
+   int chrnum, position, tumorMutant, tumorTotal, normalMutant, normalTotal;
+
+   while (infile.getLine(line))
+      if (parseCountsLine(line, filename, chrnum, position, tumorMutant, tumorTotal,
+			  normalMutant, normalTotal))
+         addCoverage(normalTotal);
+
+   infile.closeFile();
+}
+
+//------------------------------------------------------------------------------------
+// SnvCounts::writeBinary() writes the counts as a binary snvcounts file, in order by
+// chromosome and position, along with the index of the file
+
+void SnvCounts::writeBinary(const std::string& filename) const
+{
+   BinaryWriter writer;
+
+   if (!writer.openFile(filename.c_str(), true))
+      throw std::runtime_error("unable to open " + filename);
+
+   writer.write_uint32(SNV_BINARY_MAGIC);
+   writer.write_uint32(SNV_BINARY_VERSION);
+
+   std::vector<SnvBlockInfo> directory;
+   SnvCountsIndex            index;
+
+   for (int chrnum = 1; chrnum <= NUM_CHROMOSOMES; chrnum++)
+   {
+      const PosMap& pmap = posmap[chrnum];
+      PosMap::const_iterator ppos = pmap.begin();
+
+      while (ppos != pmap.end())
+      {
+         // gather the next block of positions
+
+	 std::vector<PosMap::const_iterator> item;
+
+	 while (ppos != pmap.end() && item.size() < SNV_BLOCK_SIZE)
+            item.push_back(ppos++);
+
+	 SnvBlockInfo info;
+	 info.chrnum   = chrnum;
+	 info.count    = item.size();
+	 info.offset   = writer.bytesWritten();
+	 info.firstPos = item.front()->first;
+	 info.lastPos  = item.back()->first;
+
+	 directory.push_back(info);
+
+	 uint32_t previous = 0;
+
+	 for (size_t i = 0; i < item.size(); i++)
+	 {
+            if (index.startsBin(chrnum, item[i]->first))
+               index.addBin(chrnum, item[i]->first, info.offset, i);
+
+            writer.write_uint32(item[i]->first - previous);
+	    previous = item[i]->first;
+	 }
+
+	 for (size_t i = 0; i < item.size(); i++)
+            writer.write_uint16(item[i]->second.tumorMutant);
+
+	 for (size_t i = 0; i < item.size(); i++)
+            writer.write_uint16(item[i]->second.tumorTotal);
+
+	 for (size_t i = 0; i < item.size(); i++)
+            writer.write_uint16(item[i]->second.normalMutant);
+
+	 for (size_t i = 0; i < item.size(); i++)
+            writer.write_uint16(item[i]->second.normalTotal);
+      }
+   }
+
+   uint64_t directoryOffset = writer.bytesWritten();
+
+   writer.write_uint32(directory.size());
+
+   for (size_t i = 0; i < directory.size(); i++)
+   {
+      writer.write_uint8 (directory[i].chrnum);
+      writer.write_uint32(directory[i].count);
+      writer.write_uint64(directory[i].offset);
+      writer.write_uint32(directory[i].firstPos);
+      writer.write_uint32(directory[i].lastPos);
+   }
+
+   writer.write_uint64(directoryOffset);
+   writer.write_uint32(SNV_BINARY_MAGIC);
+
+   index.dataSize = writer.bytesWritten();
+
+   writer.closeFile();
+
+   index.writeFile(indexFilename(filename));
+}
+
+//------------------------------------------------------------------------------------
+// get_uint16(), get_uint32() and get_uint64() decode big-endian integers in memory
+
+static inline uint16_t get_uint16(const uint8_t *p)
+{
+   return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+static inline uint32_t get_uint32(const uint8_t *p)
+{
+   return ((static_cast<uint32_t>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3]);
+}
+
+static inline uint64_t get_uint64(const uint8_t *p)
+{
+   return ((static_cast<uint64_t>(get_uint32(p)) << 32) | get_uint32(p + 4));
+}
+
+//------------------------------------------------------------------------------------
+// isBinaryCountsFile() returns true if the file begins with the magic number of a
+// binary snvcounts file
+
+bool isBinaryCountsFile(const std::string& filename)
+{
+   BinaryReader reader;
+   uint32_t magic;
+
+   if (!reader.openFile(filename.c_str()))
+      return false;
+
+   bool found = (reader.read_uint32(magic) && magic == SNV_BINARY_MAGIC);
+
+   reader.closeFile();
+   return found;
+}
+
+//------------------------------------------------------------------------------------
+// isTextCountsFile() returns true if the file, which may be compressed, begins with
+// the heading line of a text snvcounts file
+
+bool isTextCountsFile(const std::string& filename)
+{
+   LineReader infile(1);
+   std::string line;
+
+   if (!infile.openFile(filename.c_str()))
+      return false;
+
+   bool found = (infile.getLine(line) &&
+		 line.compare(0, 20, "Chr\tPos\tTumorMutant\t") == 0);
+
+   infile.closeFile();
+   return found;
+}
+
+//------------------------------------------------------------------------------------
+// SnvCountsBinaryFile::openFile() maps a binary snvcounts file into memory and reads
+// its block directory; false is returned if the file cannot be opened, and an
+// exception is thrown if it is not a valid binary snvcounts file
+
+bool SnvCountsBinaryFile::openFile(const std::string& filename)
+{
+   if (data) // file is already open
+      return false;
+
+   int fd = open(filename.c_str(), O_RDONLY);
+   if (fd == -1)
+      return false;
+
+   struct stat info;
+
+   if (fstat(fd, &info) == -1 || info.st_size < 24)
+   {
+      close(fd);
+      throw std::runtime_error(filename + " is not a binary snvcounts file");
+   }
+
+   void *addr = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+
+   if (addr == MAP_FAILED)
+      throw std::runtime_error("unable to map " + filename);
+
+   totalBytesRead += info.st_size;
+
+   madvise(addr, info.st_size, MADV_SEQUENTIAL);
+
+   data = static_cast<const uint8_t *>(addr);
+   size = info.st_size;
+
+   if (get_uint32(data) != SNV_BINARY_MAGIC ||
+       get_uint32(data + size - 4) != SNV_BINARY_MAGIC)
+      throw std::runtime_error(filename + " is not a binary snvcounts file");
+
+   if (get_uint32(data + 4) != SNV_BINARY_VERSION)
+      throw std::runtime_error("unsupported version of " + filename);
+
+   const size_t ENTRY_SIZE = 21;
+
+   uint64_t directoryOffset = get_uint64(data + size - 12);
+
+   if (directoryOffset + 4 > size - 12)
+      throw std::runtime_error("invalid block directory in " + filename);
+
+   uint32_t numBlocks = get_uint32(data + directoryOffset);
+
+   if (directoryOffset + 4 + ENTRY_SIZE * numBlocks != size - 12)
+      throw std::runtime_error("invalid block directory in " + filename);
+
+   const uint8_t *entry = data + directoryOffset + 4;
+
+   block.resize(numBlocks);
+
+   for (uint32_t i = 0; i < numBlocks; i++, entry += ENTRY_SIZE)
+   {
+      SnvBlockInfo& info = block[i];
+
+      info.chrnum   = entry[0];
+      info.count    = get_uint32(entry + 1);
+      info.offset   = get_uint64(entry + 5);
+      info.firstPos = get_uint32(entry + 13);
+      info.lastPos  = get_uint32(entry + 17);
+
+      if (info.chrnum < 1 || info.chrnum > NUM_CHROMOSOMES ||
+	  info.offset + 12 * static_cast<uint64_t>(info.count) > directoryOffset)
+         throw std::runtime_error("invalid block directory in " + filename);
+   }
+
+   return true;
+}
+
+//------------------------------------------------------------------------------------
+// SnvCountsBinaryFile::decodeBlock() decodes the columns of one block
+
+void SnvCountsBinaryFile::decodeBlock(size_t i, SnvBlock& b) const
+{
+   uint32_t n = block[i].count;
+   const uint8_t *p = data + block[i].offset;
+
+   b.position.resize(n);
+   b.tumorMutant.resize(n);
+   b.tumorTotal.resize(n);
+   b.normalMutant.resize(n);
+   b.normalTotal.resize(n);
+
+   uint32_t position = 0;
+
+   for (uint32_t j = 0; j < n; j++, p += 4)
+      b.position[j] = (position += get_uint32(p));
+
+   for (uint32_t j = 0; j < n; j++, p += 2)
+      b.tumorMutant[j] = get_uint16(p);
+
+   for (uint32_t j = 0; j < n; j++, p += 2)
+      b.tumorTotal[j] = get_uint16(p);
+
+   for (uint32_t j = 0; j < n; j++, p += 2)
+      b.normalMutant[j] = get_uint16(p);
+
+   for (uint32_t j = 0; j < n; j++, p += 2)
+      b.normalTotal[j] = get_uint16(p);
+}
+
+//------------------------------------------------------------------------------------
+// SnvCountsBinaryFile::closeFile() unmaps the file
+
+void SnvCountsBinaryFile::closeFile()
+{
+   if (data)
+      munmap(const_cast<uint8_t *>(data), size);
+
+   data = NULL;
+   size = 0;
+   block.clear();
+}
+
+//------------------------------------------------------------------------------------
+// indexFilename() returns the name of the index file of an snvcounts file
+
+std::string indexFilename(const std::string& filename)
+{
+   return filename + ".idx";
+}
+
+//------------------------------------------------------------------------------------
+// SnvRegion::SnvRegion() parses a region specification; an exception is thrown if it
+// is invalid
+
+SnvRegion::SnvRegion(const std::string& s)
+   : chrnum(0), start(1), end(MAX_POSITION)
+{
+   std::string chrName = s;
+   size_t colon = s.find(':');
+
+   if (colon != std::string::npos)
+   {
+      chrName = s.substr(0, colon);
+
+      StringVector part;
+      getDelimitedStrings(s.substr(colon + 1), '-', part);
+
+      try
+      {
+         if (part.size() != 2)
+            throw std::runtime_error("");
+
+	 start = stringToInt(part[0]);
+	 end   = stringToInt(part[1]);
+      }
+      catch (const std::runtime_error&)
+      {
+         throw std::runtime_error("invalid region \"" + s + "\"");
+      }
+   }
+
+   chrnum = getChrNumber(chrName);
+
+   if (chrnum == 0 || !validPosition(start) || !validPosition(end) || start > end)
+      throw std::runtime_error("invalid region \"" + s + "\"");
+}
+
+//------------------------------------------------------------------------------------
+// SnvCountsIndex::startsBin() returns true if the position is in a different bin than
+// the last entry
+
+bool SnvCountsIndex::startsBin(int chrnum, int position) const
+{
+   return (entry.empty() || entry.back().chrnum != chrnum ||
+	   entry.back().bin != position / SNV_INDEX_BIN_SIZE);
+}
+
+//------------------------------------------------------------------------------------
+// SnvCountsIndex::addBin() adds an entry for the bin of the given position
+
+void SnvCountsIndex::addBin(int chrnum, int position, uint64_t offset, uint32_t skip)
+{
+   SnvIndexEntry e;
+
+   e.chrnum = chrnum;
+   e.bin    = position / SNV_INDEX_BIN_SIZE;
+   e.offset = offset;
+   e.skip   = skip;
+
+   entry.push_back(e);
+}
+
+//------------------------------------------------------------------------------------
+// SnvCountsIndex::findRegion() finds the entry of the first bin that can hold
+// positions of a region; false is returned if no positions of the region's
+// chromosome are at or beyond the start of the region
+
+bool SnvCountsIndex::findRegion(const SnvRegion& region, SnvIndexEntry& e) const
+{
+   uint32_t startBin = region.start / SNV_INDEX_BIN_SIZE;
+
+   for (size_t i = 0; i < entry.size(); i++)
+      if (entry[i].chrnum == region.chrnum && entry[i].bin >= startBin)
+      {
+         e = entry[i];
+	 return true;
+      }
+
+   return false;
+}
+
+//------------------------------------------------------------------------------------
+// SnvCountsIndex::writeFile() writes the index file
+
+void SnvCountsIndex::writeFile(const std::string& filename) const
+{
+   BinaryWriter writer;
+
+   if (!writer.openFile(filename.c_str(), true))
+      throw std::runtime_error("unable to open " + filename);
+
+   writer.write_uint32(SNV_INDEX_MAGIC);
+   writer.write_uint32(SNV_INDEX_VERSION);
+   writer.write_uint64(dataSize);
+   writer.write_uint32(SNV_INDEX_BIN_SIZE);
+   writer.write_uint32(entry.size());
+
+   for (size_t i = 0; i < entry.size(); i++)
+   {
+      writer.write_uint8 (entry[i].chrnum);
+      writer.write_uint32(entry[i].bin);
+      writer.write_uint64(entry[i].offset);
+      writer.write_uint32(entry[i].skip);
+   }
+
+   writer.closeFile();
+}
+
+//------------------------------------------------------------------------------------
+// SnvCountsIndex::readFile() reads an index file; an exception is thrown if it cannot
+// be read
+
+void SnvCountsIndex::readFile(const std::string& filename)
+{
+   BinaryReader reader;
+
+   if (!reader.openFile(filename.c_str()))
+      throw std::runtime_error("unable to open " + filename);
+
+   uint32_t magic, version, binSize, numEntries;
+
+   if (!reader.read_uint32(magic) || magic != SNV_INDEX_MAGIC ||
+       !reader.read_uint32(version) || !reader.read_uint64(dataSize) ||
+       !reader.read_uint32(binSize) || !reader.read_uint32(numEntries))
+      throw std::runtime_error(filename + " is not an snvcounts index file");
+
+   if (version != SNV_INDEX_VERSION || binSize != SNV_INDEX_BIN_SIZE)
+      throw std::runtime_error("unsupported version of " + filename);
+
+   entry.resize(numEntries);
+
+   for (uint32_t i = 0; i < numEntries; i++)
+      if (!reader.read_uint8 (entry[i].chrnum) ||
+	  !reader.read_uint32(entry[i].bin)    ||
+	  !reader.read_uint64(entry[i].offset) ||
+	  !reader.read_uint32(entry[i].skip))
+         throw std::runtime_error("truncated index file " + filename);
+
+   reader.closeFile();
+}
+
+//------------------------------------------------------------------------------------
+// CountsWriter::openFile() creates a text snvcounts file and writes the heading line
+
+void CountsWriter::openFile(const std::string& inFilename)
+{
+   filename = inFilename;
+
+   if (!outfile.openFile(filename.c_str()))
+      throw std::runtime_error("unable to open " + filename);
+
+   outfile.write_string("Chr\tPos\tTumorMutant\tTumorTotal\tNormalMutant\t"
+		        "NormalTotal\n");
+
+   index = SnvCountsIndex();
+}
+
+//------------------------------------------------------------------------------------
+// CountsWriter::closeFile() closes the file and writes its index
+
+void CountsWriter::closeFile()
+{
+   index.dataSize = outfile.bytesWritten();
+
+   outfile.closeFile();
+
+   index.writeFile(indexFilename(filename));
+}
+
+//------------------------------------------------------------------------------------
+// SnvRegionReader::SnvRegionReader() reads the index of an snvcounts file and
+// positions the file at the first bin of the region
+
+SnvRegionReader::SnvRegionReader(const std::string& filename,
+		                 const SnvRegion& inRegion)
+   : name(filename), region(inRegion), binary(false), done(false), blockIndex(0),
+     index(0)
+{
+   SnvCountsIndex fileIndex;
+   fileIndex.readFile(indexFilename(filename));
+
+   struct stat info;
+
+   if (stat(filename.c_str(), &info) == -1)
+      throw std::runtime_error("unable to open " + filename);
+
+   if (static_cast<uint64_t>(info.st_size) != fileIndex.dataSize)
+      throw std::runtime_error(indexFilename(filename) + " is out of date");
+
+   SnvIndexEntry e;
+
+   if (!fileIndex.findRegion(region, e))
+   {
+      done = true; // there are no positions in the region
+      return;
+   }
+
+   binary = isBinaryCountsFile(filename);
+
+   if (binary)
+   {
+      if (!binfile.openFile(filename))
+         throw std::runtime_error("unable to open " + filename);
+
+      while (blockIndex < binfile.block.size() &&
+	     binfile.block[blockIndex].offset != e.offset)
+         blockIndex++;
+
+      if (blockIndex == binfile.block.size())
+         throw std::runtime_error(indexFilename(filename) + " does not match " +
+			          filename);
+
+      binfile.decodeBlock(blockIndex++, block);
+      index = e.skip;
+   }
+   else
+   {
+      if (!textfile.openFile(filename.c_str()))
+         throw std::runtime_error("unable to open " + filename);
+
+      if (!textfile.seek(e.offset))
+         throw std::runtime_error("unable to seek in " + filename);
+   }
+}
+
+//------------------------------------------------------------------------------------
+// SnvRegionReader::readPosition() passes back the data of the next position in the
+// file; false is returned if EOF has been reached
+
+bool SnvRegionReader::readPosition(int& chrnum, int& position, int& tumorMutant,
+		                   int& tumorTotal, int& normalMutant,
+				   int& normalTotal)
+{
+   if (!binary)
+   {
+      std::string line;
+
+      while (textfile.getLine(line))
+         if (parseCountsLine(line, name, chrnum, position, tumorMutant, tumorTotal,
+			     normalMutant, normalTotal))
+            return true;
+
+      return false;
+   }
+
+   while (index >= block.position.size())
+   {
+      if (blockIndex >= binfile.block.size())
+         return false;
+
+      binfile.decodeBlock(blockIndex++, block);
+      index = 0;
+   }
+
+   chrnum       = binfile.block[blockIndex - 1].chrnum;
+   position     = block.position[index];
+   tumorTotal   = block.tumorTotal[index];
+   tumorMutant  = std::min<int>(block.tumorMutant[index], tumorTotal);
+   normalTotal  = block.normalTotal[index];
+   normalMutant = std::min<int>(block.normalMutant[index], normalTotal);
+
+   index++;
+   return true;
+}
+
+//------------------------------------------------------------------------------------
+// SnvRegionReader::nextPosition() passes back the data of the next position in the
+// region; false is returned when there are no more
+
+bool SnvRegionReader::nextPosition(int& chrnum, int& position, int& tumorMutant,
+		                   int& tumorTotal, int& normalMutant,
+				   int& normalTotal)
+{
+   while (!done)
+   {
+      if (!readPosition(chrnum, position, tumorMutant, tumorTotal, normalMutant,
+			normalTotal) ||
+	  chrnum != region.chrnum || position > region.end)
+         done = true;
+      else if (position >= region.start)
+         return true;
+   }
+
+   return false;
+}
+
+//------------------------------------------------------------------------------------
+// radixSort() sorts records by key with a stable least-significant-digit radix sort,
+// one pass for each of the five low bytes of the key (chromosome numbers fit in the
+// fifth byte); passes over a byte that is the same in every key are skipped
+
+void radixSort(SortRecordVector& records)
+{
+   const int KEY_BYTES = 5;
+
+   size_t n = records.size();
+   SortRecordVector scratch(n);
+
+   for (int b = 0; b < KEY_BYTES; b++)
+   {
+      int shift = 8 * b;
+      size_t count[256] = { 0 };
+
+      for (size_t i = 0; i < n; i++)
+         count[(records[i].key >> shift) & 0xFF]++;
+
+      if (n == 0 || count[(records[0].key >> shift) & 0xFF] == n)
+         continue; // every key has the same byte
+
+      size_t offset = 0;
+
+      for (int d = 0; d < 256; d++)
+      {
+         size_t c = count[d];
+	 count[d] = offset;
+	 offset  += c;
+      }
+
+      for (size_t i = 0; i < n; i++)
+         scratch[count[(records[i].key >> shift) & 0xFF]++] = records[i];
+
+      records.swap(scratch);
+   }
+}
+
+//------------------------------------------------------------------------------------
+// PositionSorter::PositionSorter() limits the records held in memory so that they and
+// the scratch space of the radix sort fit in memoryLimit bytes
+
+PositionSorter::PositionSorter(size_t memoryLimit)
+   : maxRecords(std::max<size_t>(memoryLimit / (2 * sizeof(SortRecord)), 1024)),
+     index(0), sorted(true)
+{
+}
+
+//------------------------------------------------------------------------------------
+// PositionSorter::~PositionSorter() closes the temporary files
+
+PositionSorter::~PositionSorter()
+{
+   for (size_t i = 0; i < runs.size(); i++)
+      delete runs[i];
+}
+
+//------------------------------------------------------------------------------------
+// PositionSorter::add() adds a record, writing a sorted run if memory is full
+
+void PositionSorter::add(const SortRecord& r)
+{
+   if (!records.empty() && r.key < records.back().key)
+      sorted = false;
+
+   if (records.size() == maxRecords)
+      writeRun();
+
+   records.push_back(r);
+}
+
+//------------------------------------------------------------------------------------
+// PositionSorter::writeRun() sorts the records in memory and writes them to a
+// temporary file, which is then opened for reading and unlinked; the merge reads each
+// run sequentially, so a thread reads ahead in it
+
+void PositionSorter::writeRun()
+{
+   if (!sorted)
+      radixSort(records);
+
+   const char *tmpdir = std::getenv("TMPDIR");
+   std::string filename = std::string(tmpdir ? tmpdir : "/tmp") + "/consprepXXXXXX";
+
+   std::vector<char> name(filename.begin(), filename.end());
+   name.push_back('\0');
+
+   int fd = mkstemp(&name[0]);
+   if (fd == -1)
+      throw std::runtime_error("unable to create a temporary file in " +
+		               filename.substr(0, filename.rfind('/')));
+   close(fd);
+
+   BinaryWriter writer;
+
+   try
+   {
+      if (!writer.openFile(&name[0], false))
+         throw std::runtime_error("unable to open temporary file " +
+		                  std::string(&name[0]));
+
+      for (size_t i = 0; i < records.size(); i++)
+      {
+         const SortRecord& r = records[i];
+
+         writer.write_uint64(r.key);
+         writer.write_uint32(r.tumorMutant);
+         writer.write_uint32(r.tumorTotal);
+         writer.write_uint32(r.normalMutant);
+         writer.write_uint32(r.normalTotal);
+      }
+
+      writer.closeFile();
+   }
+   catch (...)
+   {
+      unlink(&name[0]);
+      throw;
+   }
+
+   // the reader is opened only now, so that it does not read ahead before the run
+   // has been written
+
+   BinaryReader *reader = new BinaryReader;
+
+   bool opened = reader->openFile(&name[0], true);
+   unlink(&name[0]);
+
+   if (!opened)
+   {
+      delete reader;
+      throw std::runtime_error("unable to open temporary file " +
+		               std::string(&name[0]));
+   }
+
+   runs.push_back(reader);
+   records.clear();
+   sorted = true;
+}
+
+//------------------------------------------------------------------------------------
+// PositionSorter::readRecord() reads the next record of a run into its head; false is
+// returned at the end of the run
+
+bool PositionSorter::readRecord(size_t run)
+{
+   SortRecord& r = head[run];
+   uint32_t value[4];
+
+   if (!runs[run]->read_uint64(r.key))
+      return false;
+
+   for (int i = 0; i < 4; i++)
+      if (!runs[run]->read_uint32(value[i]))
+         throw std::runtime_error("temporary file read error");
+
+   r.tumorMutant  = value[0];
+   r.tumorTotal   = value[1];
+   r.normalMutant = value[2];
+   r.normalTotal  = value[3];
+   return true;
+}
+
+//------------------------------------------------------------------------------------
+// PositionSorter::runBefore() returns true if the head of run a comes before the head
+// of run b; equal keys are taken from the earlier run, which keeps the sort stable
+
+bool PositionSorter::runBefore(size_t a, size_t b) const
+{
+   return (head[a].key < head[b].key || (head[a].key == head[b].key && a < b));
+}
+
+//------------------------------------------------------------------------------------
+// PositionSorter::siftDown() restores the heap order below position i of the heap
+
+void PositionSorter::siftDown(size_t i)
+{
+   size_t n = heap.size();
+
+   while (true)
+   {
+      size_t first = i;
+      size_t left  = 2 * i + 1;
+      size_t right = left + 1;
+
+      if (left < n && runBefore(heap[left], heap[first]))
+         first = left;
+
+      if (right < n && runBefore(heap[right], heap[first]))
+         first = right;
+
+      if (first == i)
+         return;
+
+      std::swap(heap[i], heap[first]);
+      i = first;
+   }
+}
+
+//------------------------------------------------------------------------------------
+// PositionSorter::finish() sorts the records, or if runs have been written, writes
+// the last run and begins merging the runs
+
+void PositionSorter::finish()
+{
+   if (runs.empty())
+   {
+      if (!sorted)
+         radixSort(records);
+
+      index = 0;
+      return;
+   }
+
+   if (!records.empty())
+      writeRun();
+
+   SortRecordVector().swap(records); // release the memory
+
+   head.resize(runs.size());
+
+   for (size_t run = 0; run < runs.size(); run++)
+   {
+      runs[run]->seek(0);
+
+      if (readRecord(run))
+         heap.push_back(run);
+   }
+
+   for (size_t i = heap.size() / 2; i-- > 0; )
+      siftDown(i);
+}
+
+//------------------------------------------------------------------------------------
+// PositionSorter::next() passes back the next record in order; false is returned
+// after the last one
+
+bool PositionSorter::next(SortRecord& r)
+{
+   if (runs.empty())
+   {
+      if (index >= records.size())
+         return false;
+
+      r = records[index++];
+      return true;
+   }
+
+   if (heap.empty())
+      return false;
+
+   size_t run = heap[0];
+   r = head[run];
+
+   if (!readRecord(run))
+   {
+      heap[0] = heap.back();
+      heap.pop_back();
+   }
+
+   if (!heap.empty())
+      siftDown(0);
+
+   return true;
+}
@@ -0,0 +1,333 @@
+//------------------------------------------------------------------------------------
+//
+// snvutil.h - module containing definitions for reading and storing the mutant and
+//             total counts of SNVs in tumor and normal samples; used by snvcounts
+//             and consprep
+//
+// Author: Stephen V. Rice, Ph.D.
+//
+// Copyright 2016 St. Jude Children's Research Hospital
+//
+//------------------------------------------------------------------------------------
+
+#ifndef SNVUTIL_H
+#define SNVUTIL_H
+
+#include "genutil.h"
+
+const uint16_t MAX_COUNT = 65535;
+
+void compressCounts(int inMutant, int inTotal, uint16_t& outMutant,
+		    uint16_t& outTotal);
+
+bool parseCountsLine(const std::string& line, const std::string& source,
+		     int& chrnum, int& position, int& tumorMutant, int& tumorTotal,
+		     int& normalMutant, int& normalTotal);
+
+//------------------------------------------------------------------------------------
+
+class PosCounts // concisely stores the counts for one sample
+{
+public:
+   PosCounts(int inTumorMutant, int inTumorTotal, int inNormalMutant,
+	     int inNormalTotal)
+   {
+      compressCounts(inTumorMutant,  inTumorTotal,  tumorMutant,  tumorTotal);
+      compressCounts(inNormalMutant, inNormalTotal, normalMutant, normalTotal);
+   }
+
+   uint16_t tumorMutant, tumorTotal, normalMutant, normalTotal;
+};
+
+typedef std::map<int, PosCounts> PosMap; // key is position
+
+//------------------------------------------------------------------------------------
+
+class MAF_Parser // for parsing lines in Mutation Annotation Format (MAF)
+{
+public:
+   MAF_Parser(const std::string& headingLine);
+   virtual ~MAF_Parser() { }
+
+   virtual bool parseLine(const std::string& line, std::string& chrName,
+		          int& position, std::string& variantType,
+			  int& tumorMutant, int& tumorTotal,
+			  int& normalMutant, int& normalTotal) const;
+
+   //column numbers of columns of interest
+   int chrCol, posCol, typeCol, tumorMutantCol, tumorTotalCol, normalMutantCol,
+       normalTotalCol;
+
+   int numColumns;
+};
+
+//------------------------------------------------------------------------------------
+
+class CoverageHistogram // exact histogram of normal coverage values, from which the
+                        // median normal coverage is found
+{
+public:
+   CoverageHistogram() : occurrences(0), count(MAX_COUNT + 1, 0) { }
+   virtual ~CoverageHistogram() { }
+
+   void addCoverage(int coverage)
+   {
+      occurrences++;
+      count[coverage > MAX_COUNT ? MAX_COUNT : (coverage < 0 ? 0 : coverage)]++;
+   }
+
+   virtual void   addCountsFile(const std::string& filename);
+   virtual double median() const;
+   virtual int    lowerMedian() const;
+
+   uint64_t              occurrences; // number of normal coverage values
+   std::vector<uint64_t> count;       // number of occurrences of each value
+
+protected:
+   int valueAt(uint64_t rank) const;
+};
+
+//------------------------------------------------------------------------------------
+
+class SnvCounts // holds the counts at each SNV position of a sample, read from a
+                // Bambino output file ("high_20") or a MAF file
+{
+public:
+   SnvCounts();
+   virtual ~SnvCounts() { }
+
+   virtual void readFile(const std::string& filename);
+   virtual void writeCounts(const std::string& filename) const;
+   virtual void writeBinary(const std::string& filename) const;
+   virtual int  medianNormalCoverage() const { return normalCoverage.lowerMedian(); }
+
+   PosMap posmap[NUM_CHROMOSOMES + 1]; // one map for each chromosome
+
+   CoverageHistogram normalCoverage; // normal coverage of each position
+};
+
+//------------------------------------------------------------------------------------
+// A binary snvcounts file holds the same data as the text file in columnar form.  All
+// integers are big-endian, as written by BinaryWriter:
+//
+//    header     magic "SNVC" (uint32), version (uint32)
+//    blocks     for each block of up to SNV_BLOCK_SIZE positions of one chromosome:
+//               position deltas (uint32 each, the first relative to zero), then the
+//               tumorMutant, tumorTotal, normalMutant and normalTotal columns
+//               (uint16 each)
+//    directory  number of blocks (uint32), then for each block: chromosome number
+//               (uint8), number of positions (uint32), byte offset (uint64), first
+//               and last position (uint32 each)
+//    trailer    byte offset of the directory (uint64), magic "SNVC" (uint32)
+
+const uint32_t SNV_BINARY_MAGIC   = 0x534E5643; // "SNVC"
+const uint32_t SNV_BINARY_VERSION = 1;
+const uint32_t SNV_BLOCK_SIZE     = 65536;      // max positions in a block
+
+bool isBinaryCountsFile(const std::string& filename);
+bool isTextCountsFile  (const std::string& filename);
+
+class SnvBlockInfo // directory entry for one block of a binary snvcounts file
+{
+public:
+   uint8_t  chrnum;
+   uint32_t count;
+   uint64_t offset;
+   uint32_t firstPos, lastPos;
+};
+
+class SnvBlock // decoded columns of one block
+{
+public:
+   std::vector<uint32_t> position;
+   std::vector<uint16_t> tumorMutant, tumorTotal, normalMutant, normalTotal;
+};
+
+class SnvCountsBinaryFile // for reading a binary snvcounts file through a memory map
+{
+public:
+   SnvCountsBinaryFile() : data(NULL), size(0) { }
+   virtual ~SnvCountsBinaryFile() { closeFile(); }
+
+   virtual bool openFile(const std::string& filename);
+   virtual void decodeBlock(size_t i, SnvBlock& b) const;
+   virtual void closeFile();
+
+   std::vector<SnvBlockInfo> block; // the block directory
+
+   const uint8_t *data; // the mapped file
+   size_t         size;
+};
+
+//------------------------------------------------------------------------------------
+// An index file ("FILE.idx") is written beside each text or binary snvcounts file.
+// It divides each chromosome into bins of SNV_INDEX_BIN_SIZE positions and gives,
+// for each bin holding at least one position, the byte offset of its first position:
+// the start of a line in a text file, or the start of a block in a binary file plus
+// the number of positions in the block that precede the bin.  All integers are
+// big-endian:
+//
+//    header   magic "SNVI" (uint32), version (uint32), size of the indexed file
+//             (uint64), bin size (uint32), number of entries (uint32)
+//    entries  chromosome number (uint8), bin number (uint32), byte offset (uint64),
+//             positions to skip (uint32)
+
+const uint32_t SNV_INDEX_MAGIC    = 0x534E5649; // "SNVI"
+const uint32_t SNV_INDEX_VERSION  = 1;
+const uint32_t SNV_INDEX_BIN_SIZE = 1000000;    // positions per bin
+
+std::string indexFilename(const std::string& filename);
+
+class SnvRegion // a chromosome, or a range of positions within one, given as
+                // "chr1" or "chr1:1000000-2000000"
+{
+public:
+   SnvRegion(const std::string& s);
+   virtual ~SnvRegion() { }
+
+   int chrnum, start, end;
+};
+
+class SnvIndexEntry // locates the first position of one bin
+{
+public:
+   uint8_t  chrnum;
+   uint32_t bin;
+   uint64_t offset;
+   uint32_t skip;
+};
+
+class SnvCountsIndex // the index of a text or binary snvcounts file
+{
+public:
+   SnvCountsIndex() : dataSize(0) { }
+   virtual ~SnvCountsIndex() { }
+
+   virtual bool startsBin(int chrnum, int position) const;
+   virtual void addBin(int chrnum, int position, uint64_t offset, uint32_t skip);
+   virtual bool findRegion(const SnvRegion& region, SnvIndexEntry& e) const;
+   virtual void writeFile(const std::string& filename) const;
+   virtual void readFile(const std::string& filename);
+
+   uint64_t                   dataSize; // size of the indexed file
+   std::vector<SnvIndexEntry> entry;    // in order by chromosome and bin
+};
+
+class CountsWriter // writes a text snvcounts file, position by position in order by
+                   // chromosome and position, along with its index
+{
+public:
+   CountsWriter() { }
+   virtual ~CountsWriter() { }
+
+   virtual void openFile(const std::string& filename);
+   virtual void closeFile();
+
+   void writePosition(int chrnum, int position, int tumorMutant, int tumorTotal,
+		      int normalMutant, int normalTotal)
+   {
+      if (index.startsBin(chrnum, position))
+         index.addBin(chrnum, position, outfile.bytesWritten(), 0);
+
+      outfile.write_string(chrLongName[chrnum]);
+      outfile.write_char('\t');
+      outfile.write_int(position);
+      outfile.write_char('\t');
+      outfile.write_int(tumorMutant);
+      outfile.write_char('\t');
+      outfile.write_int(tumorTotal);
+      outfile.write_char('\t');
+      outfile.write_int(normalMutant);
+      outfile.write_char('\t');
+      outfile.write_int(normalTotal);
+      outfile.write_char('\n');
+   }
+
+   std::string    filename;
+   TextWriter     outfile;
+   SnvCountsIndex index;
+};
+
+class SnvRegionReader // reads the positions in one region of an indexed text or
+                      // binary snvcounts file
+{
+public:
+   SnvRegionReader(const std::string& filename, const SnvRegion& inRegion);
+   virtual ~SnvRegionReader() { }
+
+   virtual bool nextPosition(int& chrnum, int& position, int& tumorMutant,
+		             int& tumorTotal, int& normalMutant, int& normalTotal);
+
+   std::string name;   // the snvcounts filename
+   SnvRegion   region;
+   bool        binary; // true for a binary snvcounts file
+   bool        done;   // true when the end of the region has been passed
+
+   LineReader          textfile;
+   SnvCountsBinaryFile binfile;
+   SnvBlock            block;      // the decoded current block of binfile
+   size_t              blockIndex; // index of the next block to decode
+   size_t              index;      // index of the next position in the block
+
+protected:
+   virtual bool readPosition(int& chrnum, int& position, int& tumorMutant,
+		             int& tumorTotal, int& normalMutant, int& normalTotal);
+};
+
+//------------------------------------------------------------------------------------
+
+class SortRecord // the counts of one position, with a key that orders positions by
+                 // chromosome and position
+{
+public:
+   SortRecord() { }
+
+   SortRecord(int chrnum, int position, int inTumorMutant, int inTumorTotal,
+	      int inNormalMutant, int inNormalTotal)
+      : key((static_cast<uint64_t>(chrnum) << 32) | static_cast<uint32_t>(position)),
+	tumorMutant(inTumorMutant), tumorTotal(inTumorTotal),
+	normalMutant(inNormalMutant), normalTotal(inNormalTotal) { }
+
+   int chrnum()   const { return static_cast<int>(key >> 32); }
+   int position() const { return static_cast<int>(key & 0xFFFFFFFF); }
+
+   uint64_t key;
+   int32_t  tumorMutant, tumorTotal, normalMutant, normalTotal;
+};
+
+typedef std::vector<SortRecord> SortRecordVector;
+
+class PositionSorter // sorts records by key: records are radix sorted in memory, and
+                     // beyond the memory limit the sorted runs are written to
+                     // temporary files and merged
+{
+public:
+   PositionSorter(size_t memoryLimit);
+   virtual ~PositionSorter();
+
+   // add() every record, then call finish(); next() then passes back the records in
+   // order, records with equal keys in the order they were added
+   virtual void add(const SortRecord& r);
+   virtual void finish();
+   virtual bool next(SortRecord& r);
+
+   size_t           maxRecords; // records held in memory at once
+   SortRecordVector records;    // records not yet written to a run
+   size_t           index;      // index of the next record of records to pass back
+   bool             sorted;     // true while the records have been added in order
+
+   std::vector<BinaryReader *> runs;    // the sorted runs written to temporary files
+   SortRecordVector            head;    // the next record of each run
+   std::vector<size_t>         heap;    // indexes of runs, ordered by their heads
+
+protected:
+   virtual void writeRun();
+   virtual bool readRecord(size_t run);
+   virtual bool runBefore(size_t a, size_t b) const;
+   virtual void siftDown(size_t i);
+};
+
+void radixSort(SortRecordVector& records);
+
+//------------------------------------------------------------------------------------
+#endif
@@ -0,0 +1,103 @@
+//------------------------------------------------------------------------------------
+//
+// tarcat.cpp - program that writes one member of a tar archive to stdout; the archive
+//              may be gzip, BGZF or bzip2 compressed, and compressed blocks are
+//              inflated in parallel, so reference bundles can be read without first
+//              being extracted; the archive may also be a container file written by
+//              consprep -container, in which case the named section is written; if
+//              no member is named, the whole archive is written decompressed, to be
+//              extracted in one pass by tar
+//
+// Copyright 2017 St. Jude Children's Research Hospital
+//
+//------------------------------------------------------------------------------------
+
+#include "genutil.h"
+
+//------------------------------------------------------------------------------------
+// copyToStdout() writes the remaining bytes of a file or archive member to stdout,
+// unchanged
+
+void copyToStdout(LineReader& reader)
+{
+   std::vector<char> buffer(DEFAULT_BUFFER_SIZE);
+   size_t numBytes;
+
+   while ((numBytes = reader.readBytes(&buffer[0], buffer.size())) > 0)
+      if (std::fwrite(&buffer[0], 1, numBytes, stdout) != numBytes)
+         throw std::runtime_error("write error");
+}
+
+//------------------------------------------------------------------------------------
+
+int main(int argc, char *argv[])
+{
+   if (argc != 2 && argc != 3)
+   {
+      std::cout << "Usage: " << argv[0]
+	        << " archive_file"
+		<< " [member_name]"
+		<< std::endl;
+      return 1;
+   }
+
+   try
+   {
+      std::string archiveName = argv[1];
+
+      if (argc == 2) // the whole archive
+      {
+         LineReader reader;
+
+         if (!reader.openFile(archiveName.c_str()))
+            throw std::runtime_error("unable to open " + archiveName);
+
+         copyToStdout(reader);
+         reader.closeFile();
+
+         if (std::fflush(stdout) != 0)
+            throw std::runtime_error("write error");
+
+         return 0;
+      }
+
+      std::string member = argv[2];
+
+      if (isContainerFile(archiveName.c_str()))
+      {
+         ContainerReader container;
+	 std::string text;
+
+	 if (!container.openFile(archiveName.c_str()) ||
+	     !container.readSection(member, text))
+            throw std::runtime_error("unable to find " + member + " in " +
+			             archiveName);
+
+	 container.closeFile();
+
+	 if (std::fwrite(text.data(), 1, text.length(), stdout) != text.length() ||
+	     std::fflush(stdout) != 0)
+            throw std::runtime_error("write error");
+
+	 return 0;
+      }
+
+      LineReader reader;
+
+      if (!reader.openArchiveMember(archiveName.c_str(), member))
+         throw std::runtime_error("unable to find " + member + " in " + archiveName);
+
+      copyToStdout(reader);
+      reader.closeFile();
+
+      if (std::fflush(stdout) != 0)
+         throw std::runtime_error("write error");
+   }
+   catch (const std::runtime_error& error)
+   {
+      std::cerr << argv[0] << ": " << error.what() << std::endl;
+      return 1;
+   }
+
+   return 0;
+}